@@ -0,0 +1,424 @@
+/**
+ * Allocation counts and memory footprint per stage and per frame.
+ *
+ * @file alloc_stats.cpp
+ * @author Emily Ng
+ * @date Apr 28 2016
+ */
+
+#include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <opencv2/core.hpp>
+
+#include "alloc_stats.h"
+#include "profile.h"
+
+using namespace cv;
+
+// Counts of one stage.  Static, so zero before any constructor runs, and
+// never allocated, as the hooks below cannot allocate.
+struct stage_counts {
+    std::atomic<uint64_t> allocs;
+    std::atomic<uint64_t> frees;
+    std::atomic<uint64_t> bytes;
+    std::atomic<int64_t> live;          // bytes allocated and not freed
+    std::atomic<int64_t> live_blocks;
+    std::atomic<int64_t> peak;          // most live bytes
+    std::atomic<uint64_t> frame_allocs;
+    std::atomic<uint64_t> frame_bytes;
+};
+
+// Stage names by slot, slot 0 for none.  Names are compared by pointer, as
+// they are the literals given to `StageScope`.
+static std::atomic<const char *> names[ALLOC_STAGES];
+static struct stage_counts counts[ALLOC_STAGES];
+
+static std::atomic<int64_t> total_live;
+static std::atomic<int64_t> total_peak;
+static std::atomic<int64_t> frame_peak;
+
+// Frames, one at a time.
+static int64_t frame_start_live;
+static unsigned long frames;
+static uint64_t frame_allocs_sum;
+static uint64_t frame_bytes_sum;
+static uint64_t frame_allocs_max;
+static int check_warmup = -1;
+static int failures;
+
+#if ALLOC_TRACK
+
+static void atomicMax(std::atomic<int64_t> &a, int64_t x)
+{
+    int64_t cur = a.load(std::memory_order_relaxed);
+
+    while (x > cur && !a.compare_exchange_weak(cur, x,
+                std::memory_order_relaxed)) {
+    }
+}
+
+/**
+ * Slot of stage \p name, taking a free one the first time it is seen.
+ */
+static int stageSlot(const char *name)
+{
+    if (!name) return 0;
+
+    const uint64_t h = ((uintptr_t)name >> 3) * 0x9e3779b97f4a7c15ull;
+
+    for (int k = 0; k < ALLOC_STAGES - 1; k++) {
+        const int s = 1 + (h + k) % (ALLOC_STAGES - 1);
+        const char *cur = names[s].load(std::memory_order_acquire);
+
+        if (cur == name) return s;
+        if (!cur) {
+            if (names[s].compare_exchange_strong(cur, name)) return s;
+            if (cur == name) return s;
+        }
+    }
+
+    return 0;
+}
+
+static void record(int slot, size_t n)
+{
+    struct stage_counts &c = counts[slot];
+    const std::memory_order relaxed = std::memory_order_relaxed;
+
+    c.allocs.fetch_add(1, relaxed);
+    c.bytes.fetch_add(n, relaxed);
+    c.live_blocks.fetch_add(1, relaxed);
+    atomicMax(c.peak, c.live.fetch_add(n, relaxed) + n);
+    c.frame_allocs.fetch_add(1, relaxed);
+    c.frame_bytes.fetch_add(n, relaxed);
+
+    const int64_t live = total_live.fetch_add(n, relaxed) + n;
+    atomicMax(total_peak, live);
+    atomicMax(frame_peak, live);
+}
+
+static void release(int slot, size_t n)
+{
+    struct stage_counts &c = counts[slot];
+    const std::memory_order relaxed = std::memory_order_relaxed;
+
+    c.frees.fetch_add(1, relaxed);
+    c.live.fetch_sub(n, relaxed);
+    c.live_blocks.fetch_sub(1, relaxed);
+    total_live.fetch_sub(n, relaxed);
+}
+
+// Ahead of every block from `new`.  16 bytes, so blocks stay aligned as
+// `malloc` aligns them.
+struct alloc_header {
+    uint64_t size;
+    uint32_t slot;
+    uint32_t magic;
+};
+
+#define ALLOC_MAGIC 0xa110c8edu
+
+static void *trackedAlloc(size_t n)
+{
+    for (;;) {
+        struct alloc_header *h =
+            (struct alloc_header *)malloc(sizeof(*h) + (n ? n : 1));
+
+        if (h) {
+            h->size = n;
+            h->slot = stageSlot(currentStage());
+            h->magic = ALLOC_MAGIC;
+            record(h->slot, n);
+            return h + 1;
+        }
+
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) return NULL;
+        handler();
+    }
+}
+
+static void trackedFree(void *p)
+{
+    if (!p) return;
+
+    struct alloc_header *h = (struct alloc_header *)p - 1;
+
+    assert(h->magic == ALLOC_MAGIC);
+    h->magic = 0;
+    release(h->slot, h->size);
+    free(h);
+}
+
+void *operator new(size_t n)
+{
+    void *p = trackedAlloc(n);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t n)
+{
+    void *p = trackedAlloc(n);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void *operator new(size_t n, const std::nothrow_t &) noexcept
+{
+    return trackedAlloc(n);
+}
+
+void *operator new[](size_t n, const std::nothrow_t &) noexcept
+{
+    return trackedAlloc(n);
+}
+
+void operator delete(void *p) noexcept
+{
+    trackedFree(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    trackedFree(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    trackedFree(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    trackedFree(p);
+}
+
+/**
+ * Image data, which OpenCV allocates with `fastMalloc` rather than `new`.
+ * Wraps the standard allocator, and keeps the slot of a block, plus one, in
+ * its `userdata`.
+ */
+class TrackingMatAllocator : public MatAllocator {
+public:
+    UMatData *allocate(int dims, const int *sizes, int type, void *data,
+            size_t *step, int flags, UMatUsageFlags usage) const
+    {
+        UMatData *u = Mat::getStdAllocator()->allocate(dims, sizes, type,
+                data, step, flags, usage);
+        if (!u) return u;
+
+        // Come back here to free it.
+        u->currAllocator = this;
+
+        if (!data) {
+            const int slot = stageSlot(currentStage());
+
+            u->userdata = (void *)(intptr_t)(slot + 1);
+            record(slot, u->size);
+        }
+        return u;
+    }
+
+    bool allocate(UMatData *u, int access, UMatUsageFlags usage) const
+    {
+        return Mat::getStdAllocator()->allocate(u, access, usage);
+    }
+
+    void deallocate(UMatData *u) const
+    {
+        if (!u) return;
+
+        if (u->userdata) {
+            release((int)((intptr_t)u->userdata - 1), u->size);
+            u->userdata = NULL;
+        }
+        Mat::getStdAllocator()->deallocate(u);
+    }
+};
+
+static TrackingMatAllocator mat_allocator;
+
+#endif
+
+/**
+ * Whether allocations are counted, i.e. built with ALLOC_TRACK.
+ */
+bool allocTracking()
+{
+    return ALLOC_TRACK;
+}
+
+/**
+ * Count image data from now on, as well as `new`.  Images allocated before
+ * are freed without being counted.
+ */
+void startAllocTracking()
+{
+#if ALLOC_TRACK
+    Mat::setDefaultAllocator(&mat_allocator);
+#endif
+}
+
+static int64_t stageLive()
+{
+    int64_t live = 0;
+
+    for (int s = 1; s < ALLOC_STAGES; s++) {
+        live += counts[s].live.load(std::memory_order_relaxed);
+    }
+    return live;
+}
+
+/**
+ * Start counting the allocations of a frame.
+ */
+void allocFrameBegin()
+{
+    if (!ALLOC_TRACK) return;
+
+    for (int s = 0; s < ALLOC_STAGES; s++) {
+        counts[s].frame_allocs = 0;
+        counts[s].frame_bytes = 0;
+    }
+    frame_peak = total_live.load();
+    frame_start_live = stageLive();
+}
+
+/**
+ * Allocations of the frame since `allocFrameBegin`.  In steady-state check
+ * mode, a frame past the warm-up that allocated is logged as a failure,
+ * with the stage that allocated most.
+ *
+ * @param frame_id  Frame, for the log.
+ */
+struct alloc_frame allocFrameEnd(int frame_id)
+{
+    struct alloc_frame f = { 0, 0, 0, 0 };
+
+    if (!ALLOC_TRACK) return f;
+
+    int worst = 0;
+    uint64_t worst_allocs = 0;
+    for (int s = 1; s < ALLOC_STAGES; s++) {
+        const uint64_t n = counts[s].frame_allocs;
+
+        f.allocs += n;
+        f.bytes += counts[s].frame_bytes;
+        if (n > worst_allocs) {
+            worst = s;
+            worst_allocs = n;
+        }
+    }
+    f.peak = frame_peak;
+    f.kept = stageLive() - frame_start_live;
+
+    frames++;
+    frame_allocs_sum += f.allocs;
+    frame_bytes_sum += f.bytes;
+    if (f.allocs > frame_allocs_max) frame_allocs_max = f.allocs;
+
+    DLOG("frame %d: %llu allocations, %llu bytes, peak %llu KB, %+lld bytes "
+            "kept", frame_id, (unsigned long long)f.allocs,
+            (unsigned long long)f.bytes, (unsigned long long)f.peak >> 10,
+            (long long)f.kept);
+
+    if (check_warmup >= 0 && (int)frames > check_warmup && f.allocs) {
+        if (failures < ALLOC_FAILURES) {
+            ELOG("frame %d allocated %llu times, %llu bytes, in steady state; "
+                    "most in %s (%llu)", frame_id,
+                    (unsigned long long)f.allocs, (unsigned long long)f.bytes,
+                    names[worst].load(), (unsigned long long)worst_allocs);
+        }
+        failures++;
+    }
+
+    return f;
+}
+
+/**
+ * Check that frames allocate nothing once the first \p warmup have run.
+ */
+void setAllocCheck(int warmup)
+{
+    if (!ALLOC_TRACK) {
+        WLOG("allocations are not tracked in this build, see ALLOC_TRACK");
+        return;
+    }
+    check_warmup = warmup;
+}
+
+/**
+ * Frames that failed the steady-state check.
+ */
+int allocCheckFailures()
+{
+    return failures;
+}
+
+/**
+ * Log allocations, bytes, peak and still live bytes of each stage, then the
+ * frame averages and the peak footprint of the process.  What is still live
+ * is either kept on purpose, such as caches, or leaked.
+ */
+void reportAllocs()
+{
+    if (!ALLOC_TRACK) return;
+
+    ILOG("%-20s %10s %10s %10s %10s %8s %10s", "stage", "allocs", "frees",
+            "MB", "peak KB", "live", "live KB");
+
+    for (int s = 0; s < ALLOC_STAGES; s++) {
+        const char *name = names[s].load();
+        if (s && !name) continue;
+
+        // The same name from another file has a slot of its own.
+        bool seen = false;
+        for (int t = 1; t < s && name; t++) {
+            const char *other = names[t].load();
+            seen = seen || (other && !strcmp(other, name));
+        }
+        if (seen) continue;
+
+        uint64_t allocs = 0, frees = 0, bytes = 0;
+        int64_t peak = 0, live = 0, blocks = 0;
+        for (int t = s; t < ALLOC_STAGES; t++) {
+            const char *other = names[t].load();
+            if (t != s && (!s || !other || strcmp(other, name))) continue;
+
+            allocs += counts[t].allocs;
+            frees += counts[t].frees;
+            bytes += counts[t].bytes;
+            peak = std::max(peak, counts[t].peak.load());
+            live += counts[t].live;
+            blocks += counts[t].live_blocks;
+        }
+        if (!allocs) continue;
+
+        ILOG("%-20s %10llu %10llu %10.2f %10lld %8lld %10lld",
+                s ? name : "(none)", (unsigned long long)allocs,
+                (unsigned long long)frees, bytes / 1048576.0,
+                (long long)peak >> 10, (long long)blocks,
+                (long long)live >> 10);
+    }
+
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+
+    ILOG("%lu frames, %.1f allocations and %.1f KB per frame, at most %llu; "
+            "peak heap %lld KB, peak resident %ld KB", frames,
+            frames ? (double)frame_allocs_sum / frames : 0,
+            frames ? frame_bytes_sum / 1024.0 / frames : 0,
+            (unsigned long long)frame_allocs_max,
+            (long long)total_peak.load() >> 10, ru.ru_maxrss);
+
+    if (check_warmup >= 0) {
+        ILOG("steady-state check: %d of %lu frames allocated after %d "
+                "warm-up frames", failures, frames, check_warmup);
+    }
+}
@@ -0,0 +1,61 @@
+/**
+ * Allocation counts and memory footprint per stage and per frame.
+ *
+ * Built with ALLOC_TRACK set (see CMakeLists.txt), global `operator new` and
+ * `operator delete` are replaced, and a `MatAllocator` wraps the one OpenCV
+ * uses for image data, which does not go through `new`.  Every allocation is
+ * charged to the innermost `StageScope` of the thread that makes it, or to
+ * none outside any stage.  Each block remembers its stage, so a free lowers
+ * the live bytes of the stage that allocated it, and what is still live on
+ * exit shows which stages leak or keep caches.
+ *
+ * Between `allocFrameBegin` and `allocFrameEnd`, allocations charged to a
+ * stage count towards the frame.  Those of threads outside any stage, such as
+ * decoders and the display, do not.  In steady-state check mode, any frame
+ * after the warm-up frames that allocates is reported as a failure.  Counts
+ * are global, so frames are counted one at a time; the detection server
+ * counts a batch of requests as one frame.
+ *
+ * Memory from `malloc` or `posix_memalign` directly, such as the arena of an
+ * `ObjectTable`, is not seen.
+ *
+ * Without ALLOC_TRACK, nothing is replaced and these functions do nothing.
+ *
+ * @file alloc_stats.h
+ * @author Emily Ng
+ * @date Apr 28 2016
+ */
+
+#ifndef __ALLOC_STATS_H
+#define __ALLOC_STATS_H
+
+#include <stdint.h>
+
+#include "debug.h"
+
+#ifndef ALLOC_TRACK
+#define ALLOC_TRACK 0
+#endif
+
+// Stages told apart, at most.  Further stages are charged to none.
+#define ALLOC_STAGES 256
+
+// Failing frames listed by the steady-state check, at most.
+#define ALLOC_FAILURES 8
+
+struct alloc_frame {
+    uint64_t allocs;            // allocations charged to stages
+    uint64_t bytes;             // bytes of them
+    uint64_t peak;              // most bytes live at once, all threads
+    int64_t kept;               // bytes live at the end less at the start
+};
+
+bool allocTracking();
+void startAllocTracking();
+void allocFrameBegin();
+struct alloc_frame allocFrameEnd(int frame_id);
+void setAllocCheck(int warmup);
+int allocCheckFailures();
+void reportAllocs();
+
+#endif
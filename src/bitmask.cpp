@@ -0,0 +1,346 @@
+/**
+ * Bit-packed binary images.
+ *
+ * @file bitmask.cpp
+ * @author Emily Ng
+ * @date Mar 20 2016
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <opencv2/imgproc.hpp>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "bitmask.h"
+#include "rle.h"
+
+#define WORD_BITS 64
+
+/**
+ * Size \p mask for an image and clear it.
+ */
+void createBitMask(struct bit_mask &mask, int rows, int cols)
+{
+    mask.rows = rows;
+    mask.cols = cols;
+    mask.words = (cols + WORD_BITS - 1) / WORD_BITS;
+    mask.bits.assign((size_t)rows * mask.words, 0);
+}
+
+/**
+ * Pack one row of pixels into bits, setting pixels above \p thresh.
+ *
+ * Pixels are compared 16 at a time and gathered into a word with movemask
+ * where SSE2 is available.
+ *
+ * @param src       Row of 8-bit pixels.
+ * @param dst       Row of words, at least cols / 64 rounded up.
+ * @param cols      Pixels in the row.
+ * @param thresh    Threshold.
+ */
+void packBits(const uchar *src, uint64_t *dst, int cols, uchar thresh)
+{
+    int j = 0;
+
+#ifdef __SSE2__
+    // Unsigned compare, by flipping the sign bit of both sides.
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    const __m128i t = _mm_set1_epi8((char)(thresh ^ 0x80));
+
+    for (; j + WORD_BITS <= cols; j += WORD_BITS) {
+        uint64_t w = 0;
+
+        for (int k = 0; k < 4; k++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + j + 16 * k));
+            __m128i gt = _mm_cmpgt_epi8(_mm_xor_si128(v, bias), t);
+            w |= (uint64_t)(unsigned)_mm_movemask_epi8(gt) << (16 * k);
+        }
+
+        dst[j / WORD_BITS] = w;
+    }
+#endif
+
+    for (int w = j / WORD_BITS; w < (cols + WORD_BITS - 1) / WORD_BITS; w++) {
+        dst[w] = 0;
+    }
+    for (; j < cols; j++) {
+        if (src[j] > thresh) {
+            dst[j / WORD_BITS] |= 1ULL << (j % WORD_BITS);
+        }
+    }
+}
+
+/**
+ * Threshold an image straight into bits.
+ *
+ * @param src       Grayscale image.
+ * @param dst       Pixels of \p src above \p thresh are set.
+ * @param thresh    Threshold.
+ */
+void thresholdBits(const Mat &src, struct bit_mask &dst, uchar thresh)
+{
+    assert(src.channels() == GRAY);
+
+    createBitMask(dst, src.rows, src.cols);
+
+    for (int i = 0; i < src.rows; i++) {
+        packBits(src.ptr<uchar>(i), dst.row(i), src.cols, thresh);
+    }
+}
+
+/**
+ * Expand bits into a WHITE / BLACK image.
+ */
+void unpackBits(const struct bit_mask &src, Mat &dst)
+{
+    dst = Mat::zeros(src.rows, src.cols, CV_8U);
+
+    for (int i = 0; i < src.rows; i++) {
+        const uint64_t *row = src.row(i);
+        uchar *p = dst.ptr<uchar>(i);
+
+        for (int w = 0; w < src.words; w++) {
+            uint64_t x = row[w];
+
+            while (x) {
+                p[w * WORD_BITS + __builtin_ctzll(x)] = WHITE;
+                x &= x - 1;
+            }
+        }
+    }
+}
+
+/**
+ * Pixel test that treats everything outside the image as background.
+ */
+static bool testBit(const struct bit_mask &m, int i, int j)
+{
+    if (i < 0 || i >= m.rows || j < 0 || j >= m.cols) {
+        return false;
+    }
+    return (m.row(i)[j / WORD_BITS] >> (j % WORD_BITS)) & 1;
+}
+
+/**
+ * Mask of bits [a, b) within word \p w.
+ */
+static uint64_t rangeMask(int w, int a, int b)
+{
+    int lo = a - w * WORD_BITS;
+    int hi = b - w * WORD_BITS;
+
+    lo = (lo < 0) ? 0 : lo;
+    hi = (hi > WORD_BITS) ? WORD_BITS : hi;
+    if (lo >= hi) {
+        return 0;
+    }
+
+    uint64_t m = (hi == WORD_BITS) ? ~0ULL : (1ULL << hi) - 1;
+    return m & (~0ULL << lo);
+}
+
+/**
+ * Check for set pixels in columns [a, b) of row \p i.
+ */
+static bool anyInRange(const struct bit_mask &m, int i, int a, int b)
+{
+    if (i < 0 || i >= m.rows) {
+        return false;
+    }
+
+    a = (a < 0) ? 0 : a;
+    b = (b > m.cols) ? m.cols : b;
+
+    const uint64_t *row = m.row(i);
+    for (int w = a / WORD_BITS; a < b && w <= (b - 1) / WORD_BITS; w++) {
+        if (row[w] & rangeMask(w, a, b)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Clear columns [a, b) of row \p i.
+ */
+static void clearRange(struct bit_mask &m, int i, int a, int b)
+{
+    uint64_t *row = m.row(i);
+
+    for (int w = a / WORD_BITS; a < b && w <= (b - 1) / WORD_BITS; w++) {
+        row[w] &= ~rangeMask(w, a, b);
+    }
+}
+
+static void markPixel(Mat *dst, int i, int j)
+{
+    if (dst && i >= 0 && i < dst->rows && j >= 0 && j < dst->cols) {
+        dst->data[i * dst->cols + j] = WHITE;
+    }
+}
+
+/**
+ * Extract a single contour from a bit-packed image of many contours.
+ *
+ * Same as `extractObject`, but the search for the first pixel skips empty
+ * words, row checks test whole words and erasing clears whole words.  Pixels
+ * outside the image count as background, so the bounds never leave it.
+ *
+ * @param src   Bit-packed image of contours.  The object found is erased.
+ * @param dst   Bounding corners drawn, or NULL to only find the bounds.
+ *
+ * @return A rect struct that defines the boundaries of the identified object.
+ */
+struct rect extractObjectBits(struct bit_mask &src, Mat *dst)
+{
+    const int rows = src.rows;
+    const int cols = src.cols;
+
+    assert(!dst || dst->isContinuous());
+    assert(!dst || (dst->rows == rows && dst->cols == cols));
+
+    struct rect r = (struct rect) {0, 0, 0, 0};
+    int start_x = -1, start_y = -1;
+    int top, left, bottom, right;
+    int i, j;
+
+    // Find first pixel
+    for (i = 0; i < rows && start_x < 0; i++) {
+        const uint64_t *row = src.row(i);
+
+        for (int w = 0; w < src.words; w++) {
+            if (row[w]) {
+                start_x = w * WORD_BITS + __builtin_ctzll(row[w]);
+                start_y = i;
+                break;
+            }
+        }
+    }
+
+    if (start_x < 0) {
+        // Did not find any white pixels.
+        ILOG("empty image");
+        return r;
+    }
+
+    markPixel(dst, start_y, start_x);
+
+    // Inch forwards diagonally until no more pixels
+    i = start_y + 10;
+    j = start_x + 10;
+    for (;;) {
+        int found_pixel = 0;
+
+        // check col j
+        for (int ii = start_y; ii < i; ii++) {
+            if (testBit(src, ii, j)) {
+                markPixel(dst, i, j);
+                found_pixel = 1;
+                j++;
+                break;
+            }
+        }
+
+        // check row i
+        if (anyInRange(src, i, start_x, j)) {
+            markPixel(dst, i, j);
+            found_pixel = 1;
+            i++;
+        }
+
+        if (i >= rows || j >= cols) {
+            WLOG("at bottom right corner of image");
+            i = (i > rows) ? rows : i;
+            j = (j > cols) ? cols : j;
+        }
+        if (!found_pixel || i == rows || j == cols) {
+            markPixel(dst, i, j);
+            bottom = i;
+            right = j;
+            break;
+        }
+    }
+
+    j = start_x;
+    i = start_y;
+    for (;;) {
+        int found_pixel = 0;
+
+        // check col j
+        for (int ii = bottom; ii >= i; ii--) {
+            if (testBit(src, ii, j)) {
+                markPixel(dst, i, j);
+                found_pixel = 1;
+                j--;
+                break;
+            }
+        }
+
+        // check row i
+        if (anyInRange(src, i, j, right + 1)) {
+            markPixel(dst, i, j);
+            found_pixel = 1;
+            i--;
+        }
+
+        if (i <= 0 || j <= 0) {
+            WLOG("at top left corner of image");
+            i = (i < 0) ? 0 : i;
+            j = (j < 0) ? 0 : j;
+        }
+        if (!found_pixel || i == 0 || j == 0) {
+            markPixel(dst, i, j);
+            top = i;
+            left = j;
+            break;
+        }
+    }
+
+    // Erase from src image.
+    for (i = top; i < bottom; i++) {
+        clearRange(src, i, left, right);
+    }
+
+    r.top = top;
+    r.bottom = bottom;
+    r.left = left;
+    r.right = right;
+
+    // draw bounding box
+    if (dst) {
+        rectangle(*dst, Point(left, top), Point(right, bottom),
+                Scalar::all(255));
+    }
+    ILOG("obj is %d x %d", r.right - r.left, r.bottom - r.top);
+
+    return r;
+}
+
+/**
+ * Connected components labeling of a bit-packed image.
+ *
+ * 8-connected, like `connectedComponentsLabeling`.  The image is run-length
+ * encoded with count-trailing-zeros and the runs are labeled, see
+ * `labelRuns`.  Labels are 32-bit and numbered 1..N without gaps, so there is
+ * no limit on the number of components.
+ *
+ * @param src   Bit-packed binary image.
+ * @param dst   Each connected component replaced with label (CV_32S).
+ * @return Number of components found.
+ */
+unsigned int connectedComponentsLabelingBits(const struct bit_mask &src,
+        Mat &dst)
+{
+    struct rle_mask runs;
+    std::vector<int> labels;
+
+    runLengthEncode(src, runs);
+    unsigned int num_labels = labelRuns(runs, labels);
+    paintRuns(runs, labels, dst);
+
+    ILOG("Found %u labels", num_labels);
+
+    return num_labels;
+}
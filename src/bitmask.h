@@ -0,0 +1,44 @@
+/**
+ * Bit-packed binary images.
+ *
+ * A thresholded image only holds WHITE or BLACK, so one bit per pixel is
+ * enough.  Each row is padded to whole 64-bit words, with bit k of word w
+ * holding column 64 * w + k.  Scans test a whole word at a time and find set
+ * pixels with count-trailing-zeros, so empty background costs almost nothing.
+ *
+ * @file bitmask.h
+ * @author Emily Ng
+ * @date Mar 20 2016
+ */
+
+#ifndef __BITMASK_H
+#define __BITMASK_H
+
+#include <stdint.h>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "debug.h"
+#include "img_proc.h"
+
+using namespace cv;
+
+struct bit_mask {
+    int rows;
+    int cols;
+    int words;                      // words per row
+    std::vector<uint64_t> bits;
+
+    uint64_t *row(int i) { return &bits[(size_t)i * words]; }
+    const uint64_t *row(int i) const { return &bits[(size_t)i * words]; }
+};
+
+void createBitMask(struct bit_mask &mask, int rows, int cols);
+void packBits(const uchar *src, uint64_t *dst, int cols, uchar thresh);
+void thresholdBits(const Mat &src, struct bit_mask &dst, uchar thresh);
+void unpackBits(const struct bit_mask &src, Mat &dst);
+struct rect extractObjectBits(struct bit_mask &src, Mat *dst);
+unsigned int connectedComponentsLabelingBits(const struct bit_mask &src,
+        Mat &dst);
+
+#endif
@@ -0,0 +1,214 @@
+/**
+ * Cache of intermediate images, keyed by content.
+ *
+ * @file cache.cpp
+ * @author Emily Ng
+ * @date Mar 05 2016
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cache.h"
+#include "frame_io.h"
+
+#define FNV_OFFSET (14695981039346656037ULL)
+#define FNV_PRIME (1099511628211ULL)
+
+/**
+ * Hash the size, type and pixels of an image.
+ *
+ * A word-at-a-time variant of FNV-1a.  It is not cryptographic; it only has
+ * to tell apart images that are fed to the same stage.
+ *
+ * @param src   Image to hash.
+ *
+ * @return 64-bit hash of \p src.
+ */
+uint64_t hashMat(const Mat &src)
+{
+    uint64_t h = FNV_OFFSET;
+
+    h = (h ^ (uint64_t)src.rows) * FNV_PRIME;
+    h = (h ^ (uint64_t)src.cols) * FNV_PRIME;
+    h = (h ^ (uint64_t)src.type()) * FNV_PRIME;
+
+    const size_t len_row = src.cols * src.elemSize();
+
+    for (int i = 0; i < src.rows; i++) {
+        const uchar *p = src.ptr(i);
+        size_t j = 0;
+
+        for (; j + 8 <= len_row; j += 8) {
+            uint64_t w;
+            memcpy(&w, p + j, 8);
+            h = (h ^ w) * FNV_PRIME;
+            h ^= h >> 29;
+        }
+        for (; j < len_row; j++) {
+            h = (h ^ p[j]) * FNV_PRIME;
+        }
+    }
+
+    return h;
+}
+
+/**
+ * Build the lookup key of an entry.
+ */
+static std::string makeKey(uint64_t hash, const char *stage,
+        const char *params)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%016llx-%s-%s", (unsigned long long)hash,
+            stage, params ? params : "");
+    return buf;
+}
+
+/**
+ * @param budget        Bytes of image data to keep in memory.
+ * @param spill_dir     Directory to write evicted entries to, or NULL to
+ *                      discard them.
+ */
+StageCache::StageCache(size_t budget, const char *spill_dir)
+    : budget(budget), bytes(0), spill_dir(spill_dir ? spill_dir : ""),
+      hits(0), spill_hits(0), misses(0)
+{
+}
+
+/**
+ * File name of a spilled entry.  Characters that are awkward in file names
+ * are replaced.
+ */
+std::string StageCache::spillPath(const std::string &key) const
+{
+    std::string name = key;
+
+    for (size_t i = 0; i < name.size(); i++) {
+        char c = name[i];
+        if (!isalnum((unsigned char)c) && c != '-' && c != '.') {
+            name[i] = '_';
+        }
+    }
+
+    return spill_dir + "/" + name + ".raw";
+}
+
+/**
+ * Look up an intermediate image.
+ *
+ * @param hash      Hash of the pipeline input, see `hashMat`.
+ * @param stage     Name of the stage that produced the image.
+ * @param params    Stage parameters, as a string.
+ * @param dst       Cached image, if found.
+ *
+ * @return true on a hit.
+ */
+bool StageCache::get(uint64_t hash, const char *stage, const char *params,
+        Mat &dst)
+{
+    std::string key = makeKey(hash, stage, params);
+
+    std::map<std::string, std::list<struct entry>::iterator>::iterator it =
+        index.find(key);
+    if (it != index.end()) {
+        lru.splice(lru.begin(), lru, it->second);
+        dst = it->second->img;
+        hits++;
+        DLOG("hit %s", key.c_str());
+        return true;
+    }
+
+    if (!spill_dir.empty()) {
+        std::string path = spillPath(key);
+        FILE *fp = fopen(path.c_str(), "rb");
+
+        if (fp) {
+            fclose(fp);
+
+            struct frame_file ff;
+            Mat img;
+            if (!openFrameFile(path.c_str(), &ff) && !readFrame(&ff, 0, img)) {
+                // Copy out of the mapping, which is closed below.
+                dst = img.clone();
+                closeFrameFile(&ff);
+
+                spill_hits++;
+                DLOG("spill hit %s", key.c_str());
+                put(hash, stage, params, dst);
+                return true;
+            }
+            closeFrameFile(&ff);
+        }
+    }
+
+    misses++;
+    DLOG("miss %s", key.c_str());
+    return false;
+}
+
+/**
+ * Insert an intermediate image.
+ *
+ * @param hash      Hash of the pipeline input, see `hashMat`.
+ * @param stage     Name of the stage that produced the image.
+ * @param params    Stage parameters, as a string.
+ * @param src       Image to cache.  Shared, not copied.
+ */
+void StageCache::put(uint64_t hash, const char *stage, const char *params,
+        const Mat &src)
+{
+    std::string key = makeKey(hash, stage, params);
+
+    if (index.count(key)) {
+        return;
+    }
+
+    struct entry e;
+    e.key = key;
+    e.img = src;
+    e.bytes = src.total() * src.elemSize();
+
+    lru.push_front(e);
+    index[key] = lru.begin();
+    bytes += e.bytes;
+
+    evict();
+}
+
+/**
+ * Drop least recently used entries until within budget, spilling them if a
+ * spill directory is set.  The most recent entry is always kept.
+ */
+void StageCache::evict()
+{
+    while (bytes > budget && lru.size() > 1) {
+        struct entry &e = lru.back();
+
+        if (!spill_dir.empty()) {
+            std::string path = spillPath(e.key);
+            FILE *fp = fopen(path.c_str(), "wb");
+
+            if (!fp || writeFrame(fp, e.img)) {
+                WLOG("cannot spill %s", path.c_str());
+            }
+            if (fp) fclose(fp);
+        }
+
+        DLOG("evict %s", e.key.c_str());
+        bytes -= e.bytes;
+        index.erase(e.key);
+        lru.pop_back();
+    }
+}
+
+/**
+ * Log hit rates and memory use.
+ */
+void StageCache::report() const
+{
+    ILOG("cache: %u hits, %u spill hits, %u misses, %zu entries, "
+            "%zu / %zu bytes", hits, spill_hits, misses, lru.size(), bytes,
+            budget);
+}
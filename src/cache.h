@@ -0,0 +1,63 @@
+/**
+ * Cache of intermediate images, keyed by content.
+ *
+ * Entries are keyed by a hash of the input image, the name of the stage that
+ * produced them and the stage parameters.  Recently used entries are kept in
+ * memory up to a byte budget.  Evicted entries are optionally spilled to disk
+ * as raw frames, and read back on a later miss.
+ *
+ * Cached images are shared, not copied.  Treat them as read-only.
+ *
+ * @file cache.h
+ * @author Emily Ng
+ * @date Mar 05 2016
+ */
+
+#ifndef __CACHE_H
+#define __CACHE_H
+
+#include <stdint.h>
+#include <list>
+#include <map>
+#include <string>
+#include <opencv2/core.hpp>
+
+#include "debug.h"
+
+using namespace cv;
+
+uint64_t hashMat(const Mat &src);
+
+class StageCache {
+public:
+    StageCache(size_t budget, const char *spill_dir = NULL);
+
+    bool get(uint64_t hash, const char *stage, const char *params, Mat &dst);
+    void put(uint64_t hash, const char *stage, const char *params,
+            const Mat &src);
+
+    void report() const;
+
+private:
+    struct entry {
+        std::string key;
+        Mat img;
+        size_t bytes;
+    };
+
+    std::string spillPath(const std::string &key) const;
+    void evict();
+
+    std::list<struct entry> lru;        // most recently used first
+    std::map<std::string, std::list<struct entry>::iterator> index;
+
+    size_t budget;
+    size_t bytes;
+    std::string spill_dir;
+
+    unsigned int hits;
+    unsigned int spill_hits;
+    unsigned int misses;
+};
+
+#endif
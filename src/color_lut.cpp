@@ -0,0 +1,223 @@
+/**
+ * Color classification through a lookup table.
+ *
+ * @file color_lut.cpp
+ * @author Emily Ng
+ * @date Mar 29 2016
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <opencv2/imgproc.hpp>
+
+#include "color_lut.h"
+
+#define LUT_SHIFT (8 - LUT_BITS)
+
+/**
+ * Read classification rules from a text file.
+ *
+ * One rule per line, with '#' starting a comment:
+ *
+ *      name bgr|hsv lo0 lo1 lo2 hi0 hi1 hi2
+ *
+ * Rules are tried in order, and the first that matches a color decides its
+ * class.  Rules with the same name form one class.
+ *
+ * @return 0 on success, -1 on a malformed file.
+ */
+int parseColorRules(const char *path, std::vector<struct color_rule> &rules)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        ELOG("cannot open %s", path);
+        return -1;
+    }
+
+    char line[256];
+    int line_no = 0;
+    int ret = 0;
+
+    rules.clear();
+
+    while (!ret && fgets(line, sizeof(line), fp)) {
+        line_no++;
+
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        struct color_rule r;
+        char space[8];
+        int v[6];
+
+        memset(&r, 0, sizeof(r));
+
+        int n = sscanf(line, "%15s %7s %d %d %d %d %d %d", r.name, space,
+                &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]);
+        if (n <= 0) {
+            continue;
+        }
+        if (n != 8 || (strcmp(space, "bgr") && strcmp(space, "hsv"))) {
+            ELOG("%s:%d: expected 'name bgr|hsv lo0 lo1 lo2 hi0 hi1 hi2'",
+                    path, line_no);
+            ret = -1;
+            break;
+        }
+
+        r.space = strcmp(space, "hsv") ? RULE_BGR : RULE_HSV;
+        for (int k = 0; k < 3; k++) {
+            r.lo[k] = saturate_cast<uchar>(v[k]);
+            r.hi[k] = saturate_cast<uchar>(v[k + 3]);
+        }
+
+        rules.push_back(r);
+    }
+
+    fclose(fp);
+    return ret;
+}
+
+static bool inRange(uchar x, uchar lo, uchar hi, bool wraps)
+{
+    if (wraps && lo > hi) {
+        return x >= lo || x <= hi;
+    }
+    return x >= lo && x <= hi;
+}
+
+static bool matches(const struct color_rule &r, const uchar *bgr,
+        const uchar *hsv)
+{
+    const uchar *p = (r.space == RULE_HSV) ? hsv : bgr;
+    const bool hue_wraps = r.space == RULE_HSV;
+
+    return inRange(p[0], r.lo[0], r.hi[0], hue_wraps)
+        && inRange(p[1], r.lo[1], r.hi[1], false)
+        && inRange(p[2], r.lo[2], r.hi[2], false);
+}
+
+/**
+ * Build the lookup table from rules.
+ *
+ * Each quantized color is classified by the centre of its bin.  The HSV of
+ * all bins is found with one `cvtColor` over a 32768 pixel image.
+ *
+ * @param rules     Rules, first match wins.
+ * @param lut       Table.  Class k + 1 is the k-th distinct rule name.
+ */
+void buildColorLut(const std::vector<struct color_rule> &rules,
+        struct color_lut &lut)
+{
+    std::vector<int> cls(rules.size());
+
+    memset(&lut, 0, sizeof(lut));
+    strcpy(lut.names[0], "none");
+    lut.num_classes = 1;
+
+    for (size_t r = 0; r < rules.size(); r++) {
+        int c;
+        for (c = 1; c < lut.num_classes; c++) {
+            if (!strcmp(lut.names[c], rules[r].name)) break;
+        }
+        if (c == lut.num_classes) {
+            if (c == MAX_CLASSES) {
+                WLOG("more than %d classes, ignoring %s", MAX_CLASSES - 1,
+                        rules[r].name);
+                cls[r] = 0;
+                continue;
+            }
+            strcpy(lut.names[c], rules[r].name);
+            lut.num_classes++;
+        }
+        cls[r] = c;
+    }
+
+    // Bin centres, in table order.
+    Mat bgr(1, LUT_SIZE, CV_8UC3), hsv;
+    for (int idx = 0; idx < LUT_SIZE; idx++) {
+        uchar *p = bgr.ptr<uchar>(0) + idx * COLOR;
+
+        p[BLUE] = ((idx >> (2 * LUT_BITS)) << LUT_SHIFT) + (1 << LUT_SHIFT) / 2;
+        p[GREEN] = (((idx >> LUT_BITS) & ((1 << LUT_BITS) - 1)) << LUT_SHIFT)
+            + (1 << LUT_SHIFT) / 2;
+        p[RED] = ((idx & ((1 << LUT_BITS) - 1)) << LUT_SHIFT)
+            + (1 << LUT_SHIFT) / 2;
+    }
+    cvtColor(bgr, hsv, CV_BGR2HSV);
+
+    for (int idx = 0; idx < LUT_SIZE; idx++) {
+        const uchar *b = bgr.ptr<uchar>(0) + idx * COLOR;
+        const uchar *h = hsv.ptr<uchar>(0) + idx * COLOR;
+
+        for (size_t r = 0; r < rules.size(); r++) {
+            if (matches(rules[r], b, h)) {
+                lut.table[idx] = cls[r];
+                break;
+            }
+        }
+    }
+
+    ILOG("%d color classes", lut.num_classes - 1);
+}
+
+/**
+ * Label each pixel with its class, and sum the position of each class.
+ *
+ * The table index of a whole row is computed first, which vectorizes, and
+ * the table is then read once per pixel.  Counts and sums of x are kept per
+ * row, so each row adds to the sums of y once per class.
+ *
+ * @param src       Color image.
+ * @param lut       Table, from `buildColorLut`.
+ * @param labels    Class of each pixel (CV_8U), 0 for none.
+ * @param classes   Pixel count and position sums of each class.  The
+ *                  centroid of class c is (sum_x, sum_y) / count.
+ */
+void classifyColors(const Mat &src, const struct color_lut &lut, Mat &labels,
+        struct color_class classes[MAX_CLASSES])
+{
+    assert(src.type() == CV_8UC3);
+
+    const int rows = src.rows;
+    const int cols = src.cols;
+
+    labels.create(rows, cols, CV_8UC1);
+    memset(classes, 0, sizeof(struct color_class) * MAX_CLASSES);
+
+    std::vector<uint16_t> idx(cols);
+
+    for (int i = 0; i < rows; i++) {
+        const uchar *p = src.ptr<uchar>(i);
+        uchar *l = labels.ptr<uchar>(i);
+        uint32_t count[MAX_CLASSES] = { 0 };
+        uint64_t sum_x[MAX_CLASSES] = { 0 };
+
+        for (int j = 0; j < cols; j++) {
+            const uchar *q = p + j * COLOR;
+
+            idx[j] = ((q[BLUE] >> LUT_SHIFT) << (2 * LUT_BITS))
+                | ((q[GREEN] >> LUT_SHIFT) << LUT_BITS)
+                | (q[RED] >> LUT_SHIFT);
+        }
+
+        for (int j = 0; j < cols; j++) {
+            const uchar c = lut.table[idx[j]];
+
+            l[j] = c;
+            count[c]++;
+            sum_x[c] += j;
+        }
+
+        for (int c = 1; c < lut.num_classes; c++) {
+            classes[c].count += count[c];
+            classes[c].sum_x += sum_x[c];
+            classes[c].sum_y += (uint64_t)count[c] * i;
+        }
+    }
+
+    classes[0].count = (uint64_t)rows * cols;
+    for (int c = 1; c < lut.num_classes; c++) {
+        classes[0].count -= classes[c].count;
+    }
+}
@@ -0,0 +1,63 @@
+/**
+ * Color classification through a lookup table.
+ *
+ * Colors are quantized to 5 bits per channel and each of the 32 x 32 x 32
+ * quantized colors maps to a class, in a 32 KB table built once from rules.
+ * Classifying a pixel is then a shift, an or and a load, for any number of
+ * classes, and centroids of each class are summed in the same pass.
+ *
+ * @file color_lut.h
+ * @author Emily Ng
+ * @date Mar 29 2016
+ */
+
+#ifndef __COLOR_LUT_H
+#define __COLOR_LUT_H
+
+#include <stdint.h>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "debug.h"
+#include "img_proc.h"
+
+using namespace cv;
+
+#define LUT_BITS 5
+#define LUT_SIZE (1 << (3 * LUT_BITS))
+
+// Classes, including class 0 for pixels that match no rule.
+#define MAX_CLASSES 16
+
+// Color space of a rule.
+#define RULE_BGR 0
+#define RULE_HSV 1
+
+// Box in BGR or HSV.  HSV follows OpenCV's 8-bit ranges, hue in 0..179.  A
+// hue range with lo > hi wraps around, as red does.
+struct color_rule {
+    char name[16];
+    int space;
+    uchar lo[3];
+    uchar hi[3];
+};
+
+struct color_lut {
+    uchar table[LUT_SIZE];
+    int num_classes;                // classes in use, including class 0
+    char names[MAX_CLASSES][16];
+};
+
+struct color_class {
+    uint64_t count;
+    uint64_t sum_x;
+    uint64_t sum_y;
+};
+
+int parseColorRules(const char *path, std::vector<struct color_rule> &rules);
+void buildColorLut(const std::vector<struct color_rule> &rules,
+        struct color_lut &lut);
+void classifyColors(const Mat &src, const struct color_lut &lut, Mat &labels,
+        struct color_class classes[MAX_CLASSES]);
+
+#endif
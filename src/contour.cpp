@@ -0,0 +1,303 @@
+/**
+ * Contour tracing of binary images.
+ *
+ * @file contour.cpp
+ * @author Emily Ng
+ * @date Mar 26 2016
+ */
+
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+
+#include "contour.h"
+
+const int chain_dx[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+const int chain_dy[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+
+#define WEST 4
+
+/**
+ * Pixel test that treats everything outside the image as background.
+ */
+static bool isSet(const Mat &src, int x, int y)
+{
+    if (x < 0 || x >= src.cols || y < 0 || y >= src.rows) {
+        return false;
+    }
+    return src.ptr<uchar>(y)[x] > BLACK;
+}
+
+/**
+ * Trace the outer boundary of one object, by Moore neighbour tracing.
+ *
+ * Neighbours are searched clockwise, starting after the last background pixel
+ * seen.  Tracing stops on leaving the start pixel by the same move as the
+ * first time (Jacob's stopping criterion), so objects that pass through their
+ * start pixel more than once are traced in full.
+ *
+ * @param src   Binary image.
+ * @param x     Column of the start pixel.
+ * @param y     Row of the start pixel.  The pixels to its left and above must
+ *              be background, as for the first pixel of an object in raster
+ *              order.
+ * @param dst   Contour.  The chain is empty for an isolated pixel.
+ */
+void traceContour(const Mat &src, int x, int y, struct contour &dst)
+{
+    assert(src.channels() == GRAY);
+    assert(isSet(src, x, y));
+
+    // Every (pixel, move) pair appears at most once.
+    const size_t max_len = (size_t)8 * src.rows * src.cols;
+
+    dst.start_x = x;
+    dst.start_y = y;
+    dst.chain.clear();
+
+    int back = WEST;
+    int first = -1;
+
+    while (dst.chain.size() < max_len) {
+        int d = -1;
+
+        for (int k = 1; k <= 8; k++) {
+            int dd = (back + k) % 8;
+            if (isSet(src, x + chain_dx[dd], y + chain_dy[dd])) {
+                d = dd;
+                break;
+            }
+        }
+
+        if (d < 0) {
+            // Isolated pixel.
+            break;
+        }
+        if (x == dst.start_x && y == dst.start_y && d == first) {
+            break;
+        }
+        if (first < 0) {
+            first = d;
+        }
+
+        dst.chain.push_back(d);
+        x += chain_dx[d];
+        y += chain_dy[d];
+
+        // The last background pixel seen, as seen from the new pixel.
+        back = (d + 6 - (d & 1)) % 8;
+    }
+}
+
+/**
+ * Trace the outer boundary of the object of \p src that comes first in raster
+ * order.
+ *
+ * Rows are only read up to the first set pixel, which for the bounding box of
+ * an object is on its top row, and then only the boundary is visited.  Other
+ * objects in \p src, such as fragments in the box of a larger one, are not
+ * traced.
+ *
+ * @param src   Binary image.
+ * @param dst   Contour.
+ * @return 0, or -1 if no pixel is set.
+ */
+int traceObject(const Mat &src, struct contour &dst)
+{
+    assert(src.channels() == GRAY);
+
+    for (int i = 0; i < src.rows; i++) {
+        const uchar *p = src.ptr<uchar>(i);
+
+        for (int j = 0; j < src.cols; j++) {
+            if (p[j] > BLACK) {
+                traceContour(src, j, i, dst);
+                return 0;
+            }
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Pixels of a contour, from its chain code.
+ *
+ * @param src   Contour.
+ * @param dst   Boundary pixels, in order, without repeating the start.
+ */
+void contourPolygon(const struct contour &src, std::vector<Point> &dst)
+{
+    int x = src.start_x;
+    int y = src.start_y;
+
+    dst.clear();
+    dst.push_back(Point(x, y));
+
+    for (size_t k = 0; k + 1 < src.chain.size(); k++) {
+        x += chain_dx[src.chain[k]];
+        y += chain_dy[src.chain[k]];
+        dst.push_back(Point(x, y));
+    }
+}
+
+/**
+ * Add the moments of the polygon enclosed by a contour, by Green's theorem.
+ *
+ * Each edge of the polygon through the pixel centres adds a closed-form term,
+ * so the cost is one step per boundary pixel.  The sign of the sums depends
+ * on the direction of travel, and is fixed per contour.
+ */
+static void addContour(struct raw_moment &m, const struct contour &c)
+{
+    if (!m.set) {
+        m.x0 = c.start_x;
+        m.y0 = c.start_y;
+        m.set = true;
+    }
+
+    double a00 = 0, a10 = 0, a01 = 0, a20 = 0, a11 = 0, a02 = 0;
+    double a30 = 0, a21 = 0, a12 = 0, a03 = 0;
+
+    double x0 = c.start_x - m.x0;
+    double y0 = c.start_y - m.y0;
+
+    for (size_t k = 0; k < c.chain.size(); k++) {
+        const double x1 = x0 + chain_dx[c.chain[k]];
+        const double y1 = y0 + chain_dy[c.chain[k]];
+
+        const double a = x0 * y1 - x1 * y0;
+        const double xx = x0 * x0 + x0 * x1 + x1 * x1;
+        const double yy = y0 * y0 + y0 * y1 + y1 * y1;
+
+        a00 += a;
+        a10 += a * (x0 + x1);
+        a01 += a * (y0 + y1);
+        a20 += a * xx;
+        a02 += a * yy;
+        a11 += a * (x0 * (2 * y0 + y1) + x1 * (y0 + 2 * y1));
+        a30 += a * (x0 + x1) * (x0 * x0 + x1 * x1);
+        a03 += a * (y0 + y1) * (y0 * y0 + y1 * y1);
+        a21 += a * (x0 * x0 * (3 * y0 + y1) + 2 * x0 * x1 * (y0 + y1)
+                + x1 * x1 * (y0 + 3 * y1));
+        a12 += a * (y0 * y0 * (3 * x0 + x1) + 2 * y0 * y1 * (x0 + x1)
+                + y1 * y1 * (x0 + 3 * x1));
+
+        x0 = x1;
+        y0 = y1;
+    }
+
+    // Weigh the area as WHITE pixels, to match the pixel moments.
+    const double s = (a00 < 0) ? -WHITE : WHITE;
+
+    m.m00 += s * a00 / 2;
+    m.m10 += s * a10 / 6;
+    m.m01 += s * a01 / 6;
+    m.m20 += s * a20 / 12;
+    m.m11 += s * a11 / 24;
+    m.m02 += s * a02 / 12;
+    m.m30 += s * a30 / 20;
+    m.m21 += s * a21 / 60;
+    m.m12 += s * a12 / 60;
+    m.m03 += s * a03 / 20;
+}
+
+/**
+ * Moments of the region enclosed by a contour.
+ *
+ * The region is the polygon through the boundary pixel centres, holes
+ * included, so a closed outline has the moments of the filled shape.  An
+ * outline that does not close encloses nothing and has m00 = 0.
+ *
+ * @param src   Contour, from `traceObject`.
+ */
+struct _moment contourMoments(const struct contour &src)
+{
+    struct raw_moment raw;
+
+    memset(&raw, 0, sizeof(raw));
+    addContour(raw, src);
+
+    return momentsFromRaw(raw);
+}
+
+static bool rasterOrder(const Point &a, const Point &b)
+{
+    return a.y < b.y || (a.y == b.y && a.x < b.x);
+}
+
+/**
+ * Moments of the pixels of a contour, each counted once and weighed as WHITE.
+ *
+ * An object whose outline encloses no area is one pixel wide throughout, so
+ * every pixel of it is on the outline, and these are the moments of all its
+ * pixels, as `imageMoments` of the object alone.
+ *
+ * @param src       Contour, from `traceObject`.
+ * @param scratch   Points kept between calls, or NULL.
+ */
+struct _moment contourPixelMoments(const struct contour &src,
+        std::vector<Point> *scratch)
+{
+    std::vector<Point> local;
+    std::vector<Point> &pixels = scratch ? *scratch : local;
+    struct raw_moment m;
+
+    contourPolygon(src, pixels);
+    std::sort(pixels.begin(), pixels.end(), rasterOrder);
+    pixels.erase(std::unique(pixels.begin(), pixels.end()), pixels.end());
+
+    memset(&m, 0, sizeof(m));
+    m.x0 = src.start_x;
+    m.y0 = src.start_y;
+    m.set = true;
+
+    for (size_t k = 0; k < pixels.size(); k++) {
+        const double x = pixels[k].x - m.x0;
+        const double y = pixels[k].y - m.y0;
+
+        m.m00 += WHITE;
+        m.m10 += WHITE * x;
+        m.m01 += WHITE * y;
+        m.m20 += WHITE * x * x;
+        m.m11 += WHITE * x * y;
+        m.m02 += WHITE * y * y;
+        m.m30 += WHITE * x * x * x;
+        m.m21 += WHITE * x * x * y;
+        m.m12 += WHITE * x * y * y;
+        m.m03 += WHITE * y * y * y;
+    }
+
+    return momentsFromRaw(m);
+}
+
+/**
+ * Moments of the object of \p src that comes first in raster order, as
+ * objects are described both at run time and for the shape database: from
+ * the region its outline encloses, or from the outline pixels when it
+ * encloses nothing.
+ *
+ * @param src       Binary image, such as the bounding box of an object.
+ * @param dst       Moments.
+ * @param scratch   Outline and points kept between calls, or NULL.
+ * @return 0, 1 if the outline encloses nothing and its pixels were used, or
+ *         -1 if no pixel is set.
+ */
+int objectMoments(const Mat &src, struct _moment &dst,
+        struct moment_scratch *scratch)
+{
+    struct moment_scratch local;
+    struct moment_scratch &tmp = scratch ? *scratch : local;
+
+    if (traceObject(src, tmp.outline)) {
+        return -1;
+    }
+
+    dst = contourMoments(tmp.outline);
+    if (dst.m00 > 0) {
+        return 0;
+    }
+
+    dst = contourPixelMoments(tmp.outline, &tmp.pixels);
+    return 1;
+}
@@ -0,0 +1,53 @@
+/**
+ * Contour tracing of binary images.
+ *
+ * Each object is described by its outer boundary, as a start pixel and a
+ * chain of moves between 8-connected boundary pixels.  Tracing starts from
+ * the first pixel of the object and visits only the boundary, and moments
+ * follow from the boundary polygon by Green's theorem, or from the boundary
+ * pixels of an outline that encloses nothing.  Describing an object costs in
+ * proportion to its perimeter rather than to its area.
+ *
+ * @file contour.h
+ * @author Emily Ng
+ * @date Mar 26 2016
+ */
+
+#ifndef __CONTOUR_H
+#define __CONTOUR_H
+
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "debug.h"
+#include "img_proc.h"
+
+using namespace cv;
+
+// Moves of a chain code, clockwise from east with y pointing down.
+extern const int chain_dx[8];
+extern const int chain_dy[8];
+
+struct contour {
+    int start_x;                // topmost, then leftmost pixel of the object
+    int start_y;
+    std::vector<uchar> chain;   // moves around the boundary, back to start
+};
+
+// Scratch of `objectMoments`, kept by callers that describe object after
+// object.
+struct moment_scratch {
+    struct contour outline;
+    std::vector<Point> pixels;
+};
+
+void traceContour(const Mat &src, int x, int y, struct contour &dst);
+int traceObject(const Mat &src, struct contour &dst);
+void contourPolygon(const struct contour &src, std::vector<Point> &dst);
+struct _moment contourMoments(const struct contour &src);
+struct _moment contourPixelMoments(const struct contour &src,
+        std::vector<Point> *scratch = NULL);
+int objectMoments(const Mat &src, struct _moment &dst,
+        struct moment_scratch *scratch = NULL);
+
+#endif
@@ -0,0 +1,407 @@
+/**
+ * Detection server on a Unix domain socket.
+ *
+ * @file daemon.cpp
+ * @author Emily Ng
+ * @date Apr 14 2016
+ */
+
+#include <chrono>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <opencv2/imgcodecs.hpp>
+
+#include "alloc_stats.h"
+#include "daemon.h"
+#include "frame_io.h"
+
+typedef std::chrono::steady_clock daemon_clock;
+
+// Time between checks for `stop`, in milliseconds.
+#define DAEMON_POLL_MS 100
+
+/**
+ * Read exactly \p len bytes.
+ *
+ * @return 0 on success, -1 on end of file or error.
+ */
+static int readFull(int fd, void *buf, size_t len)
+{
+    uint8_t *p = (uint8_t *)buf;
+
+    while (len) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/**
+ * Write exactly \p len bytes.  A peer that went away is an error rather than
+ * a SIGPIPE.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int writeFull(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+
+    while (len) {
+        ssize_t n = ::send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+DetectDaemon::connection::~connection()
+{
+    close(fd);
+}
+
+/**
+ * @param pool      Runs the requests of a batch, and the work they submit.
+ * @param detect    Finds the objects of a frame.
+ * @param budget_ms Time allowed per request from when it is read, or 0 for
+ *                  no limit.
+ */
+DetectDaemon::DetectDaemon(ThreadPool &pool, const detect_fn &detect,
+        double budget_ms)
+    : pool(pool), detect(detect), budget_ms(budget_ms), stopping(false),
+      readers(0), num_requests(0), num_batches(0), num_errors(0),
+      num_late(0), busy_ms(0)
+{
+}
+
+DetectDaemon::~DetectDaemon()
+{
+    for (size_t i = 0; i < spare.size(); i++) {
+        delete spare[i];
+    }
+}
+
+/**
+ * Make `serve` return once the requests already read are answered.  Only sets
+ * a flag, so it may be called from a signal handler.
+ */
+void DetectDaemon::stop()
+{
+    stopping = true;
+}
+
+/**
+ * A request with buffers left from earlier requests, if there is one.
+ */
+struct DetectDaemon::request *DetectDaemon::getRequest()
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (spare.empty()) {
+        return new struct request;
+    }
+
+    struct request *r = spare.back();
+    spare.pop_back();
+    return r;
+}
+
+void DetectDaemon::putRequest(struct request *r)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    r->conn.reset();
+    spare.push_back(r);
+}
+
+/**
+ * Read the requests of one connection, until it closes or the server stops.
+ */
+void DetectDaemon::readLoop(std::shared_ptr<struct connection> conn)
+{
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+
+            replied.wait(guard, [this, &conn] {
+                return stopping || conn->in_flight < DAEMON_PIPELINE;
+            });
+        }
+        if (stopping) break;
+
+        struct daemon_request h;
+        if (readFull(conn->fd, &h, sizeof(h))) break;
+
+        if (memcmp(h.magic, DAEMON_REQ_MAGIC, 4)
+                || (h.kind != REQ_PATH && h.kind != REQ_FRAME)
+                || h.length > DAEMON_MAX_PAYLOAD) {
+            ELOG("bad request, closing connection");
+            break;
+        }
+
+        struct request *r = getRequest();
+        r->header = h;
+        r->payload.resize(h.length);
+
+        if (h.length && readFull(conn->fd, &r->payload[0], h.length)) {
+            putRequest(r);
+            break;
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        r->arrived = deadline_clock::now();
+        r->conn = conn;
+        conn->in_flight++;
+        queue.push_back(r);
+        queued.notify_one();
+    }
+
+    // Requests already read are still answered.  The socket closes once the
+    // last of them is.
+    std::lock_guard<std::mutex> guard(lock);
+    readers--;
+    queued.notify_one();
+}
+
+/**
+ * Find the objects of one request.  Runs as a task, so only writes \p r.
+ */
+void DetectDaemon::run(struct request &r)
+{
+    const struct daemon_request &h = r.header;
+    Mat src;
+
+    if (h.kind == REQ_PATH) {
+        std::string path(r.payload.begin(), r.payload.end());
+        path = path.c_str();    // drop a terminating NUL
+
+        src = imread(path, IMREAD_COLOR);
+    }
+    else if (h.length >= sizeof(struct frame_header)) {
+        const struct frame_header *f =
+            (const struct frame_header *)&r.payload[0];
+        const size_t len = (size_t)f->rows * f->cols * 3;
+
+        if (!memcmp(f->magic, FRAME_MAGIC, 4) && f->type == CV_8UC3
+                && f->rows && f->cols
+                && len <= h.length - sizeof(struct frame_header)) {
+            src = Mat(f->rows, f->cols, CV_8UC3, (void *)(f + 1));
+        }
+    }
+
+    memcpy(r.reply.magic, DAEMON_REP_MAGIC, 4);
+    r.reply.id = h.id;
+
+    r.reply.length = 0;
+    r.body.clear();
+
+    if (!src.data) {
+        r.reply.status = REPLY_UNREADABLE;
+        return;
+    }
+
+    // Time spent queued counts against the budget.
+    const Deadline deadline(budget_ms, r.arrived);
+
+    if (detect(src, h.id, deadline, r.objs)) {
+        r.reply.status = REPLY_LATE;
+        return;
+    }
+    packDetections(h.id, r.objs, r.body);
+
+    r.reply.status = REPLY_OK;
+    r.reply.length = r.body.size();
+}
+
+void DetectDaemon::sendReply(struct request &r)
+{
+    struct connection &c = *r.conn;
+
+    if (c.broken) return;
+
+    if (writeFull(c.fd, &r.reply, sizeof(r.reply))
+            || (r.body.size() && writeFull(c.fd, &r.body[0], r.body.size()))) {
+        WLOG("client went away");
+
+        // Wake the reader, which stops reading the connection.
+        c.broken = true;
+        shutdown(c.fd, SHUT_RDWR);
+    }
+}
+
+/**
+ * Run requests in batches: every request waiting when a batch starts is in
+ * it.  Replies go out in the order requests were read.
+ */
+void DetectDaemon::dispatchLoop()
+{
+    std::vector<struct request *> batch;
+
+    for (;;) {
+        batch.clear();
+        {
+            std::unique_lock<std::mutex> guard(lock);
+
+            queued.wait(guard, [this] {
+                return !queue.empty() || (stopping && readers == 0);
+            });
+            if (queue.empty()) return;
+
+            while (!queue.empty() && batch.size() < DAEMON_BATCH) {
+                batch.push_back(queue.front());
+                queue.pop_front();
+            }
+        }
+
+        // The requests of a batch run at once, so their allocations are
+        // counted together, as one frame.
+        daemon_clock::time_point start = daemon_clock::now();
+        allocFrameBegin();
+        {
+            TaskGroup group(pool);
+
+            for (size_t i = 0; i < batch.size(); i++) {
+                struct request *r = batch[i];
+                group.run([this, r] { run(*r); });
+            }
+        }
+        allocFrameEnd(num_batches);
+
+        int errors = 0;
+        int late = 0;
+        for (size_t i = 0; i < batch.size(); i++) {
+            sendReply(*batch[i]);
+            errors += batch[i]->reply.status == REPLY_UNREADABLE;
+            late += batch[i]->reply.status == REPLY_LATE;
+        }
+
+        std::chrono::duration<double, std::milli> d =
+            daemon_clock::now() - start;
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+
+            num_requests += batch.size();
+            num_batches++;
+            num_errors += errors;
+            num_late += late;
+            busy_ms += d.count();
+
+            for (size_t i = 0; i < batch.size(); i++) {
+                batch[i]->conn->in_flight--;
+            }
+        }
+        replied.notify_all();
+
+        for (size_t i = 0; i < batch.size(); i++) {
+            putRequest(batch[i]);
+        }
+    }
+}
+
+/**
+ * Accept connections on the socket at \p path and answer their requests,
+ * until `stop` is called.
+ *
+ * @return 0 after `stop`, -1 if the socket cannot be set up.
+ */
+int DetectDaemon::serve(const char *path)
+{
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        ELOG("socket path too long: %s", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        ELOG("cannot create socket");
+        return -1;
+    }
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr))
+            || listen(fd, SOMAXCONN)) {
+        ELOG("cannot listen on %s (%s)", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    ILOG("listening on %s", path);
+
+    std::thread dispatcher(&DetectDaemon::dispatchLoop, this);
+
+    while (!stopping) {
+        struct pollfd p = { fd, POLLIN, 0 };
+
+        if (poll(&p, 1, DAEMON_POLL_MS) <= 0) continue;
+
+        int c = accept(fd, NULL, NULL);
+        if (c < 0) continue;
+
+        std::shared_ptr<struct connection> conn(new struct connection(c));
+        {
+            std::lock_guard<std::mutex> guard(lock);
+
+            // Forget connections that are gone.
+            size_t n = 0;
+            for (size_t i = 0; i < conns.size(); i++) {
+                if (!conns[i].expired()) conns[n++] = conns[i];
+            }
+            conns.resize(n);
+
+            conns.push_back(conn);
+            readers++;
+        }
+        std::thread(&DetectDaemon::readLoop, this, conn).detach();
+    }
+
+    // Wake readers, whether they wait on a socket or for room.
+    {
+        std::unique_lock<std::mutex> guard(lock);
+
+        for (size_t i = 0; i < conns.size(); i++) {
+            std::shared_ptr<struct connection> conn = conns[i].lock();
+            if (conn) shutdown(conn->fd, SHUT_RD);
+        }
+        conns.clear();
+        replied.notify_all();
+        queued.notify_all();
+    }
+
+    dispatcher.join();
+
+    close(fd);
+    unlink(path);
+
+    return 0;
+}
+
+/**
+ * Log requests served, and how many ran together on average.
+ */
+void DetectDaemon::report()
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    ILOG("daemon: %lu requests in %lu batches (%.1f per batch), %lu failed, "
+            "%lu late, %.1f ms busy", num_requests, num_batches,
+            num_batches ? (double)num_requests / num_batches : 0,
+            num_errors, num_late, busy_ms);
+}
@@ -0,0 +1,152 @@
+/**
+ * Detection server on a Unix domain socket.
+ *
+ * Keeps the thread pool, the shape database and its own buffers warm between
+ * frames, so callers pay neither a process start nor first-touch allocations
+ * per frame.
+ *
+ * A request is a `daemon_request` header followed by its payload:
+ *
+ *  - REQ_PATH: path of an image file, which the server decodes.
+ *  - REQ_FRAME: a BGR frame as `writeFrame` writes it, header and pixels.
+ *
+ * A reply is a `daemon_reply` header followed, on success, by the detections
+ * of the frame as `writeDetections` writes them, with the request id as frame
+ * id.  Replies of a connection come in the order of its requests.
+ *
+ * Clients may send requests without waiting for replies, up to
+ * DAEMON_PIPELINE per connection before the server stops reading.  Requests
+ * that arrive on any connection while a batch runs are taken together as the
+ * next batch and run on the pool at once, so many small frames keep every
+ * worker busy without delaying a lone request.
+ *
+ * With a budget, each request has that long from when it was read.  Frames
+ * that run out of time are abandoned and answered with REPLY_LATE.
+ *
+ * @file daemon.h
+ * @author Emily Ng
+ * @date Apr 14 2016
+ */
+
+#ifndef __DAEMON_H
+#define __DAEMON_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "deadline.h"
+#include "debug.h"
+#include "detections.h"
+#include "thread_pool.h"
+
+using namespace cv;
+
+#define DAEMON_REQ_MAGIC "REQ0"
+#define DAEMON_REP_MAGIC "REP0"
+
+// kinds of request
+#define REQ_PATH 0
+#define REQ_FRAME 1
+
+// Requests of one connection read ahead of their replies at most.
+#define DAEMON_PIPELINE 16
+
+// Requests run together at most.
+#define DAEMON_BATCH 32
+
+// Largest payload accepted, in bytes.
+#define DAEMON_MAX_PAYLOAD (256u << 20)
+
+// status of a reply
+#define REPLY_OK 0
+#define REPLY_UNREADABLE -1
+#define REPLY_LATE -2
+
+struct daemon_request {
+    char magic[4];
+    uint32_t kind;
+    uint32_t id;                // echoed in the reply
+    uint32_t length;            // bytes of payload
+};
+
+struct daemon_reply {
+    char magic[4];
+    uint32_t id;
+    int32_t status;             // REPLY_*
+    uint32_t length;            // bytes of detections
+};
+
+// Detections of a BGR frame, request \p id, by \p deadline.  Called from
+// several threads at once.  Returns 0, or -1 if out of time.
+typedef std::function<int(const Mat &src, uint32_t id,
+        const Deadline &deadline,
+        std::vector<struct det_object> &dst)> detect_fn;
+
+class DetectDaemon {
+public:
+    DetectDaemon(ThreadPool &pool, const detect_fn &detect,
+            double budget_ms = 0);
+    ~DetectDaemon();
+
+    int serve(const char *path);
+    void stop();
+    void report();
+
+private:
+    struct connection {
+        int fd;
+        int in_flight;          // requests read and not yet replied to
+        bool broken;            // a reply could not be sent
+
+        connection(int fd) : fd(fd), in_flight(0), broken(false) {}
+        ~connection();
+    };
+
+    struct request {
+        std::shared_ptr<struct connection> conn;
+        struct daemon_request header;
+        std::vector<uint8_t> payload;
+        deadline_clock::time_point arrived;     // when it was read
+        struct daemon_reply reply;
+        std::vector<uint8_t> body;
+        std::vector<struct det_object> objs;
+    };
+
+    void readLoop(std::shared_ptr<struct connection> conn);
+    void dispatchLoop();
+    void run(struct request &r);
+    void sendReply(struct request &r);
+
+    struct request *getRequest();
+    void putRequest(struct request *r);
+
+    ThreadPool &pool;
+    detect_fn detect;
+    const double budget_ms;
+    std::atomic<bool> stopping;
+
+    std::mutex lock;
+    std::condition_variable queued;     // a request was read
+    std::condition_variable replied;    // a connection has room again
+    std::deque<struct request *> queue;
+    std::vector<struct request *> spare; // requests with warm buffers
+    std::vector<std::weak_ptr<struct connection> > conns;
+    int readers;
+
+    // statistics, under lock
+    unsigned long num_requests;
+    unsigned long num_batches;
+    unsigned long num_errors;
+    unsigned long num_late;
+    double busy_ms;
+};
+
+#endif
@@ -0,0 +1,195 @@
+/**
+ * Per-frame deadlines, cancellation and quality degradation.
+ *
+ * @file deadline.cpp
+ * @author Emily Ng
+ * @date Apr 22 2016
+ */
+
+#include <stdio.h>
+#include <string>
+
+#include "deadline.h"
+
+/**
+ * @param budget_ms     Time allowed from \p start, or 0 for no limit.
+ * @param start         When the work started, e.g. when a request arrived.
+ */
+Deadline::Deadline(double budget_ms, deadline_clock::time_point start)
+    : start(start), timed(budget_ms > 0), cancelled(false)
+{
+    end = start + std::chrono::duration_cast<deadline_clock::duration>(
+            std::chrono::duration<double, std::milli>(budget_ms));
+}
+
+double Deadline::elapsedMs() const
+{
+    std::chrono::duration<double, std::milli> d = deadline_clock::now() - start;
+    return d.count();
+}
+
+const char *qualityName(int quality)
+{
+    static const char *names[QUALITY_LEVELS] = { "full", "lean", "half" };
+
+    return (quality >= 0 && quality < QUALITY_LEVELS) ? names[quality] : "?";
+}
+
+/**
+ * @param budget_ms     Time allowed per frame, or 0 to always run at full
+ *                      quality.
+ */
+FrameGovernor::FrameGovernor(double budget_ms)
+    : budget_ms(budget_ms), since_probe(0), frames(0), late(0)
+{
+    for (int q = 0; q < QUALITY_LEVELS; q++) {
+        cost[q] = 0;
+        by_quality[q] = 0;
+    }
+}
+
+/**
+ * Quality for the next frame: the best one recent frames finished in time
+ * at, or have not tried yet.  Now and then a frame tries a level up, so
+ * that quality comes back once frames get cheaper.
+ */
+int FrameGovernor::plan()
+{
+    if (budget_ms <= 0) return QUALITY_FULL;
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    int q = QUALITY_FULL;
+    while (q < QUALITY_LEVELS - 1 && cost[q] > budget_ms) q++;
+
+    if (q > QUALITY_FULL && ++since_probe >= GOVERNOR_PROBE) {
+        since_probe = 0;
+        q--;
+    }
+
+    return q;
+}
+
+/**
+ * Account for a frame.
+ *
+ * @param frame_id  Frame, for the report.
+ * @param quality   Quality it ran at.
+ * @param ms        Time it took, until done or abandoned.
+ * @param late      Whether it ran out of time and was abandoned.
+ */
+void FrameGovernor::done(int frame_id, int quality, double ms, bool late)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    // Abandoned frames took at least this long, which is all plan needs.
+    cost[quality] = cost[quality] ? 0.75 * cost[quality] + 0.25 * ms : ms;
+
+    frames++;
+    by_quality[quality]++;
+    this->late += late;
+
+    if (quality != QUALITY_FULL || late) {
+        DLOG("frame %d: %s%s, %.1f ms", frame_id, qualityName(quality),
+                late ? ", late" : "", ms);
+
+        if (degraded.size() < GOVERNOR_LIST) degraded.push_back(frame_id);
+    }
+}
+
+/**
+ * Log frames at each quality, how many were late, and which were degraded.
+ */
+void FrameGovernor::report()
+{
+    if (budget_ms <= 0) return;
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    ILOG("deadline %g ms: %lu frames, %lu full, %lu lean, %lu half, "
+            "%lu late", budget_ms, frames, by_quality[QUALITY_FULL],
+            by_quality[QUALITY_LEAN], by_quality[QUALITY_HALF], late);
+
+    if (!degraded.empty()) {
+        std::string ids;
+        char buf[16];
+
+        for (size_t i = 0; i < degraded.size(); i++) {
+            snprintf(buf, sizeof(buf), " %d", degraded[i]);
+            ids += buf;
+        }
+        ILOG("degraded frames:%s%s", ids.c_str(),
+                (frames - by_quality[QUALITY_FULL] > degraded.size()
+                 || late > degraded.size()) ? " ..." : "");
+    }
+}
+
+LatestRunner::LatestRunner()
+    : has_pending(false), stopping(false), current(NULL), posted(0),
+      cancelled(0)
+{
+    worker = std::thread(&LatestRunner::runLoop, this);
+}
+
+/**
+ * Cancel the job running, drop the one waiting, and wait for the thread.
+ */
+LatestRunner::~LatestRunner()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        stopping = true;
+        has_pending = false;
+        if (current) current->cancel();
+    }
+    wake.notify_one();
+    worker.join();
+
+    DLOG("%lu jobs posted, %lu cancelled or skipped", posted, cancelled);
+}
+
+/**
+ * Run \p job once the thread is free, unless another job is posted first.
+ * The job running, if any, is cancelled.
+ */
+void LatestRunner::post(const job_fn &job)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        posted++;
+        if (has_pending) cancelled++;
+        if (current) {
+            current->cancel();
+            cancelled++;
+        }
+
+        pending = job;
+        has_pending = true;
+    }
+    wake.notify_one();
+}
+
+void LatestRunner::runLoop()
+{
+    std::unique_lock<std::mutex> guard(lock);
+
+    for (;;) {
+        wake.wait(guard, [this] { return has_pending || stopping; });
+        if (stopping) return;
+
+        job_fn job;
+        job.swap(pending);
+        has_pending = false;
+
+        Deadline deadline;
+        current = &deadline;
+        guard.unlock();
+
+        job(deadline);
+
+        guard.lock();
+        current = NULL;
+    }
+}
@@ -0,0 +1,139 @@
+/**
+ * Per-frame deadlines, cancellation and quality degradation.
+ *
+ * A `Deadline` goes with the work of one frame.  Long stages poll it at
+ * row-band boundaries, every DEADLINE_CHECK_ROWS rows, and stop once it is
+ * cancelled or its time is up.  Their partial results are then thrown away.
+ *
+ * A `FrameGovernor` picks how much of the pipeline each frame can afford
+ * within the budget, from the time recent frames took at each quality:
+ *
+ *  - QUALITY_FULL: every stage.
+ *  - QUALITY_LEAN: no checks against OpenCV, no annotation.
+ *  - QUALITY_HALF: as lean, with edges found at half resolution.
+ *
+ * Frames below full quality, or that ran out of time anyway, are reported.
+ *
+ * A `LatestRunner` runs only the latest of a stream of jobs, such as
+ * trackbar moves, on its own thread.  A new job cancels the one running, so
+ * stale work stops at its next check instead of delaying fresh work.
+ *
+ * @file deadline.h
+ * @author Emily Ng
+ * @date Apr 22 2016
+ */
+
+#ifndef __DEADLINE_H
+#define __DEADLINE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "debug.h"
+
+typedef std::chrono::steady_clock deadline_clock;
+
+// Rows between checks of a deadline.
+#define DEADLINE_CHECK_ROWS 16
+
+// quality of a frame, best first
+#define QUALITY_FULL 0
+#define QUALITY_LEAN 1
+#define QUALITY_HALF 2
+#define QUALITY_LEVELS 3
+
+// Frames run below full quality before one is tried a level up.
+#define GOVERNOR_PROBE 16
+
+// Degraded frames listed by `FrameGovernor::report`, at most.
+#define GOVERNOR_LIST 32
+
+class Deadline {
+public:
+    Deadline(double budget_ms = 0,
+            deadline_clock::time_point start = deadline_clock::now());
+
+    void cancel() { cancelled = true; }
+
+    /**
+     * True once cancelled or out of time.  One relaxed load, and a clock read
+     * if there is a budget.
+     */
+    bool expired() const
+    {
+        if (cancelled.load(std::memory_order_relaxed)) return true;
+        if (!timed || deadline_clock::now() < end) return false;
+
+        cancelled = true;
+        return true;
+    }
+
+    double elapsedMs() const;
+
+private:
+    deadline_clock::time_point start;
+    deadline_clock::time_point end;
+    bool timed;
+    mutable std::atomic<bool> cancelled;
+};
+
+/**
+ * Whether work checking \p deadline, which may be NULL, should stop.
+ */
+static inline bool pastDeadline(const Deadline *deadline)
+{
+    return deadline && deadline->expired();
+}
+
+class FrameGovernor {
+public:
+    FrameGovernor(double budget_ms);
+
+    double budget() const { return budget_ms; }
+    int plan();
+    void done(int frame_id, int quality, double ms, bool late);
+    void report();
+
+private:
+    const double budget_ms;
+
+    std::mutex lock;
+    double cost[QUALITY_LEVELS];    // running mean of frame times, 0 unknown
+    int since_probe;
+    unsigned long frames;
+    unsigned long by_quality[QUALITY_LEVELS];
+    unsigned long late;
+    std::vector<int> degraded;      // first GOVERNOR_LIST degraded frames
+};
+
+const char *qualityName(int quality);
+
+class LatestRunner {
+public:
+    typedef std::function<void(const Deadline &)> job_fn;
+
+    LatestRunner();
+    ~LatestRunner();
+
+    void post(const job_fn &job);
+
+private:
+    void runLoop();
+
+    std::mutex lock;
+    std::condition_variable wake;
+    job_fn pending;
+    bool has_pending;
+    bool stopping;
+    Deadline *current;              // of the job running, if any
+    unsigned long posted;
+    unsigned long cancelled;
+    std::thread worker;
+};
+
+#endif
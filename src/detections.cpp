@@ -0,0 +1,183 @@
+/**
+ * Binary detection records.
+ *
+ * @file detections.cpp
+ * @author Emily Ng
+ * @date Apr 04 2016
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "detections.h"
+
+/**
+ * Lay out the detections of one frame in \p buf, as they are stored in a
+ * file.
+ *
+ * @param frame     Frame id.
+ * @param objs      Objects found in the frame.
+ * @param buf       Frame header and records.  Its capacity is reused.
+ */
+void packDetections(uint32_t frame, const std::vector<struct det_object> &objs,
+        std::vector<uint8_t> &buf)
+{
+    struct det_frame h;
+
+    buf.resize(sizeof(struct det_frame)
+            + objs.size() * sizeof(struct det_object));
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, DET_MAGIC, 4);
+    h.version = DET_VERSION;
+    h.record_size = sizeof(struct det_object);
+    h.frame = frame;
+    h.num_objects = objs.size();
+
+    memcpy(&buf[0], &h, sizeof(h));
+    if (objs.size()) {
+        memcpy(&buf[sizeof(h)], &objs[0],
+                objs.size() * sizeof(struct det_object));
+    }
+}
+
+/**
+ * Append the detections of one frame.
+ *
+ * The frame is written with a single `fwrite` and flushed, so readers of the
+ * file see whole frames.
+ *
+ * @param fp        File opened for appending.
+ * @param frame     Frame id.
+ * @param objs      Objects found in the frame.
+ * @return 0 on success, -1 on a write error.
+ */
+int writeDetections(FILE *fp, uint32_t frame,
+        const std::vector<struct det_object> &objs)
+{
+    std::vector<uint8_t> buf;
+
+    packDetections(frame, objs, buf);
+
+    if (fwrite(&buf[0], buf.size(), 1, fp) != 1 || fflush(fp)) {
+        ELOG("cannot write detections of frame %u", frame);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Map a detection file and index its frames.
+ *
+ * A frame cut short at the end of the file, as by a writer that is still
+ * running or that crashed, is left out.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int openDetFile(const char *path, struct det_file *df)
+{
+    df->fd = -1;
+    df->base = NULL;
+    df->size = 0;
+    df->frames.clear();
+
+    df->fd = open(path, O_RDONLY);
+    if (df->fd < 0) {
+        ELOG("cannot open %s", path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(df->fd, &st)) {
+        ELOG("cannot stat %s", path);
+        closeDetFile(df);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        return 0;
+    }
+    df->size = st.st_size;
+
+    void *base = mmap(NULL, df->size, PROT_READ, MAP_PRIVATE, df->fd, 0);
+    if (base == MAP_FAILED) {
+        ELOG("cannot map %s", path);
+        df->size = 0;
+        closeDetFile(df);
+        return -1;
+    }
+    df->base = (const uint8_t *)base;
+
+    madvise((void *)df->base, df->size, MADV_SEQUENTIAL);
+
+    size_t pos = 0;
+    while (pos + sizeof(struct det_frame) <= df->size) {
+        const struct det_frame *h = (const struct det_frame *)(df->base + pos);
+
+        if (memcmp(h->magic, DET_MAGIC, 4)) {
+            ELOG("bad detection frame at offset %zu", pos);
+            closeDetFile(df);
+            return -1;
+        }
+        if (h->record_size < sizeof(struct det_object)) {
+            ELOG("%s: records of version %u, version %d or later needed",
+                    path, h->version, DET_VERSION);
+            closeDetFile(df);
+            return -1;
+        }
+
+        size_t len = sizeof(struct det_frame)
+            + (size_t)h->num_objects * h->record_size;
+        if (pos + len > df->size) {
+            WLOG("frame %u cut short, skipping", h->frame);
+            break;
+        }
+
+        df->frames.push_back(pos);
+        pos += len;
+    }
+
+    DLOG("%s: %zu frames", path, df->frames.size());
+
+    return 0;
+}
+
+/**
+ * Unmap a file opened by `openDetFile`.
+ *
+ * Invalidates every pointer returned by `detFrame` and `detObject`.
+ */
+void closeDetFile(struct det_file *df)
+{
+    if (df->base) munmap((void *)df->base, df->size);
+    if (df->fd >= 0) close(df->fd);
+
+    df->fd = -1;
+    df->base = NULL;
+    df->size = 0;
+    df->frames.clear();
+}
+
+/**
+ * Header of frame \p n, in place.
+ */
+const struct det_frame *detFrame(const struct det_file *df, size_t n)
+{
+    if (n >= df->frames.size()) return NULL;
+
+    return (const struct det_frame *)(df->base + df->frames[n]);
+}
+
+/**
+ * Object \p k of a frame, in place.
+ */
+const struct det_object *detObject(const struct det_frame *f, uint32_t k)
+{
+    if (k >= f->num_objects) return NULL;
+
+    const uint8_t *p = (const uint8_t *)(f + 1);
+    return (const struct det_object *)(p + (size_t)k * f->record_size);
+}
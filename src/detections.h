@@ -0,0 +1,81 @@
+/**
+ * Binary detection records.
+ *
+ * Results of each frame are appended to a file as one frame header followed
+ * by one fixed-size record per object.  Files are only ever appended to, so
+ * a run can be followed while it writes, and a record cut short by a crash
+ * only loses the frame being written.
+ *
+ * Readers map the file and return pointers to the records in place.  The
+ * header gives the size of a record, so readers skip fields added by later
+ * versions.  Records of earlier versions are too short to read in place, and
+ * are refused.
+ *
+ * @file detections.h
+ * @author Emily Ng
+ * @date Apr 04 2016
+ */
+
+#ifndef __DETECTIONS_H
+#define __DETECTIONS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "debug.h"
+
+// magic at the start of each frame
+#define DET_MAGIC "DET0"
+
+// format of the records written
+#define DET_VERSION 3
+
+// Bins of the orientation histogram of a record, ORIENT_BINS of orient.h.
+#define DET_ORIENT_BINS 16
+
+struct det_frame {
+    char magic[4];
+    uint16_t version;
+    uint16_t record_size;       // bytes per object record
+    uint32_t frame;
+    uint32_t num_objects;
+};
+
+struct det_object {
+    int32_t top;                // bounding box, bottom and right exclusive
+    int32_t left;
+    int32_t bottom;
+    int32_t right;
+    double area;                // pixels enclosed
+    double cx;                  // centroid, in frame coordinates
+    double cy;
+    double hu[7];
+    uint32_t score;             // `compareHu` against the matching reference
+                                // shape, or else the first object
+    uint32_t track_id;          // 0 if not tracked (version 3)
+    float orient[DET_ORIENT_BINS];  // edge orientation histogram, largest
+                                    // bin first (version 2)
+    float vx;                   // velocity of the track, pixels per frame
+    float vy;                   // (version 3)
+    uint32_t track_age;         // frames the track has been followed
+    uint32_t pad;
+};
+
+struct det_file {
+    int fd;
+    const uint8_t *base;
+    size_t size;
+    std::vector<size_t> frames;     // offset of each frame header
+};
+
+void packDetections(uint32_t frame, const std::vector<struct det_object> &objs,
+        std::vector<uint8_t> &buf);
+int writeDetections(FILE *fp, uint32_t frame,
+        const std::vector<struct det_object> &objs);
+int openDetFile(const char *path, struct det_file *df);
+void closeDetFile(struct det_file *df);
+const struct det_frame *detFrame(const struct det_file *df, size_t n);
+const struct det_object *detObject(const struct det_frame *f, uint32_t k);
+
+#endif
@@ -0,0 +1,250 @@
+/**
+ * Display of intermediate images, off the processing threads.
+ *
+ * @file display.cpp
+ * @author Emily Ng
+ * @date Apr 01 2016
+ */
+
+#include <chrono>
+#include <errno.h>
+#include <future>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <opencv2/highgui.hpp>
+
+#include "display.h"
+
+// How often the display thread lets HighGUI handle window events, in ms.
+#define DISP_EVENT_MS 30
+
+static std::string display_dir = DISP_DIR;
+
+/**
+ * Directory that DISP_FILES writes to.  Call before the first display.
+ */
+void setDisplayDir(const char *dir)
+{
+    display_dir = dir;
+}
+
+/**
+ * The display, started on first use in the mode DISP selects.
+ */
+DisplaySink &displaySink()
+{
+    static DisplaySink sink(DISP, display_dir.c_str());
+    return sink;
+}
+
+DisplaySink::DisplaySink(int mode, const char *dir)
+    : mode(mode), dir(dir), work(false), stop(false), posted(0),
+    dropped(0)
+{
+    if (mode == DISP_NONE) return;
+
+    if (mode == DISP_FILES && mkdir(dir, 0777) && errno != EEXIST) {
+        ELOG("cannot create %s, nothing will be written", dir);
+    }
+
+    thread = std::thread(&DisplaySink::displayLoop, this);
+}
+
+/**
+ * Render images still pending, then stop the display thread.
+ */
+DisplaySink::~DisplaySink()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+        work = true;
+    }
+    wake.notify_all();
+
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+/**
+ * Post an image to a window.  Returns without waiting for it to be shown.
+ *
+ * The image is copied, so the caller may modify it afterwards.  Copies reuse
+ * the buffers of earlier images of the same window.
+ *
+ * @param window    Window name.
+ * @param img       Image.
+ * @param pos       Position of the window on screen.
+ */
+void DisplaySink::post(const char *window, const Mat &img, Point pos)
+{
+    if (mode == DISP_NONE) return;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        window_slot &slot = windows[window];
+
+        posted++;
+        if (slot.fresh) {
+            dropped++;
+        }
+
+        img.copyTo(slot.pending);
+        slot.pos = pos;
+        slot.fresh = true;
+        work = true;
+    }
+    wake.notify_one();
+}
+
+/**
+ * Show an image now when called on the display thread, as from a trackbar
+ * callback, and post it otherwise.
+ */
+void DisplaySink::show(const char *window, const Mat &img)
+{
+    if (mode == DISP_NONE) return;
+
+    if (std::this_thread::get_id() == thread.get_id()) {
+        unsigned int seq;
+        Point pos;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            window_slot &slot = windows[window];
+            seq = slot.seq++;
+            pos = slot.pos;
+        }
+        render(window, img, pos, seq);
+        return;
+    }
+
+    Point pos;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        std::map<std::string, window_slot>::iterator it = windows.find(window);
+        pos = (it != windows.end()) ? it->second.pos : Point(0, 0);
+    }
+    post(window, img, pos);
+}
+
+/**
+ * Run \p fn on the display thread, and wait for it to return.
+ *
+ * For code that drives HighGUI itself, such as a trackbar with `waitKey`.
+ * Other windows are not updated while \p fn runs.
+ */
+void DisplaySink::interact(const std::function<void()> &fn)
+{
+    if (mode != DISP_WINDOWS) {
+        WLOG("no windows to interact with");
+        return;
+    }
+
+    std::packaged_task<void()> task(fn);
+    std::future<void> done = task.get_future();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        interactions.push_back([&task] { task(); });
+        work = true;
+    }
+    wake.notify_one();
+
+    done.wait();
+}
+
+/**
+ * Log how many images were posted, and how many were replaced before they
+ * were shown.
+ */
+void DisplaySink::report()
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (mode != DISP_NONE) {
+        ILOG("display: %u images posted, %u dropped", posted, dropped);
+    }
+}
+
+/**
+ * Show an image in its window, or write it to the next file of its sequence.
+ */
+void DisplaySink::render(const std::string &name, const Mat &img, Point pos,
+        unsigned int seq)
+{
+    if (mode == DISP_WINDOWS) {
+        namedWindow(name, WINDOW_AUTOSIZE);
+        imshow(name, img);
+        moveWindow(name, pos.x, pos.y);
+        return;
+    }
+
+    std::string file = name;
+    for (size_t i = 0; i < file.size(); i++) {
+        if (file[i] == ' ' || file[i] == '/') file[i] = '_';
+    }
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s_%05u.png", dir.c_str(),
+            file.c_str(), seq);
+
+    if (!imwrite(path, img)) {
+        WLOG("cannot write %s", path);
+    }
+}
+
+/**
+ * Render fresh images and run interactions until stopped.  In DISP_WINDOWS,
+ * wake up regularly so that HighGUI keeps the windows responsive.
+ */
+void DisplaySink::displayLoop()
+{
+    for (;;) {
+        std::vector<std::string> names;
+        std::vector<window_slot *> slots;
+        std::vector<Point> pos;
+        std::deque<std::function<void()> > todo;
+        bool stopping;
+
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            std::chrono::milliseconds period(DISP_EVENT_MS);
+
+            if (mode == DISP_WINDOWS) {
+                wake.wait_for(guard, period, [this] { return work; });
+            }
+            else {
+                wake.wait(guard, [this] { return work; });
+            }
+            work = false;
+
+            // The display thread owns `spare`; posts only write `pending`.
+            std::map<std::string, window_slot>::iterator it;
+            for (it = windows.begin(); it != windows.end(); it++) {
+                if (!it->second.fresh) continue;
+
+                std::swap(it->second.pending, it->second.spare);
+                it->second.fresh = false;
+                names.push_back(it->first);
+                slots.push_back(&it->second);
+                pos.push_back(it->second.pos);
+            }
+
+            todo.swap(interactions);
+            stopping = stop;
+        }
+
+        for (size_t i = 0; i < slots.size(); i++) {
+            render(names[i], slots[i]->spare, pos[i], slots[i]->seq++);
+        }
+        for (size_t i = 0; i < todo.size(); i++) {
+            todo[i]();
+        }
+
+        if (mode == DISP_WINDOWS) {
+            waitKey(1);
+        }
+
+        if (stopping) break;
+    }
+}
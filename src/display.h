@@ -0,0 +1,83 @@
+/**
+ * Display of intermediate images, off the processing threads.
+ *
+ * Processing threads post images and carry on.  A single display thread
+ * renders the latest image of each window; an image replaced before it was
+ * rendered is dropped.  Without a screen (DISP=2) the display thread writes
+ * each image to a numbered file instead.
+ *
+ * HighGUI is only called from the display thread.  Code that needs it
+ * directly, such as a trackbar, runs there through `interact`.
+ *
+ * @file display.h
+ * @author Emily Ng
+ * @date Apr 01 2016
+ */
+
+#ifndef __DISPLAY_H
+#define __DISPLAY_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <opencv2/core.hpp>
+
+#include "debug.h"
+
+using namespace cv;
+
+// Values of DISP, see CMakeLists.txt.
+#define DISP_NONE 0
+#define DISP_WINDOWS 1
+#define DISP_FILES 2
+
+// Default directory for DISP_FILES.
+#define DISP_DIR "display"
+
+class DisplaySink {
+public:
+    DisplaySink(int mode, const char *dir);
+    ~DisplaySink();
+
+    void post(const char *window, const Mat &img, Point pos);
+    void show(const char *window, const Mat &img);
+    void interact(const std::function<void()> &fn);
+    void report();
+
+private:
+    struct window_slot {
+        Mat pending;                // latest image, not yet rendered
+        Mat spare;                  // buffer to copy the next image into
+        Point pos;
+        bool fresh;
+        unsigned int seq;           // images rendered so far
+    };
+
+    void render(const std::string &name, const Mat &img, Point pos,
+            unsigned int seq);
+    void displayLoop();
+
+    int mode;
+    std::string dir;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::map<std::string, window_slot> windows;
+    std::deque<std::function<void()> > interactions;
+    bool work;                      // images, interactions or stop pending
+    bool stop;
+
+    unsigned int posted;
+    unsigned int dropped;
+
+    std::thread thread;
+};
+
+void setDisplayDir(const char *dir);
+DisplaySink &displaySink();
+
+#endif
@@ -0,0 +1,362 @@
+/**
+ * Memory-mapped input of uncompressed frames.
+ *
+ * @file frame_io.cpp
+ * @author Emily Ng
+ * @date Mar 02 2016
+ */
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <opencv2/imgproc.hpp>
+
+#include "frame_io.h"
+
+/**
+ * Round \p n up to a multiple of FRAME_ALIGN.
+ */
+static size_t frameAlign(size_t n)
+{
+    return (n + FRAME_ALIGN - 1) & ~(size_t)(FRAME_ALIGN - 1);
+}
+
+/**
+ * Check if \p path names a raw or y4m file, by extension.
+ *
+ * @param path  Path to file.
+ *
+ * @return 1 if the file should be opened with `openFrameFile`, else 0.
+ */
+int isFrameFile(const char *path)
+{
+    const char *ext = strrchr(path, '.');
+    if (!ext) return 0;
+
+    return !strcasecmp(ext, ".raw") || !strcasecmp(ext, ".y4m");
+}
+
+/**
+ * Index the frames of a raw file.
+ */
+static int indexRaw(struct frame_file *ff)
+{
+    size_t pos = 0;
+
+    while (pos + sizeof(struct frame_header) <= ff->size) {
+        const struct frame_header *h =
+            (const struct frame_header *)(ff->base + pos);
+
+        if (memcmp(h->magic, FRAME_MAGIC, 4)) {
+            ELOG("bad frame magic at offset %zu", pos);
+            return -1;
+        }
+
+        struct frame_info f;
+        f.offset = pos + sizeof(struct frame_header);
+        f.rows = h->rows;
+        f.cols = h->cols;
+        f.type = h->type;
+        f.layout = LAYOUT_MAT;
+
+        size_t len = (size_t)f.rows * f.cols * CV_ELEM_SIZE(f.type);
+        if (f.offset + len > ff->size) {
+            ELOG("truncated frame at offset %zu", pos);
+            return -1;
+        }
+
+        ff->frames.push_back(f);
+        pos = f.offset + frameAlign(len);
+    }
+
+    return 0;
+}
+
+/**
+ * Index the frames of a y4m stream.
+ *
+ * Only the stream header parameters needed to locate the planes are parsed:
+ * width, height and colorspace.  Per-frame parameters are skipped.
+ */
+static int indexY4M(struct frame_file *ff)
+{
+    const char *p = (const char *)ff->base;
+    const char *end = p + ff->size;
+
+    const char *eol = (const char *)memchr(p, '\n', ff->size);
+    if (!eol || strncmp(p, "YUV4MPEG2 ", 10)) {
+        ELOG("not a y4m stream");
+        return -1;
+    }
+
+    int width = 0, height = 0;
+    int layout = LAYOUT_I420;
+
+    for (const char *t = p + 9; t < eol; t++) {
+        if (*t != ' ') continue;
+
+        if (t[1] == 'W') {
+            width = atoi(t + 2);
+        }
+        else if (t[1] == 'H') {
+            height = atoi(t + 2);
+        }
+        else if (t[1] == 'C') {
+            if (!strncmp(t + 2, "mono", 4)) {
+                layout = LAYOUT_MONO;
+            }
+            else if (strncmp(t + 2, "420", 3)) {
+                ELOG("unsupported y4m colorspace %.*s",
+                        (int)strcspn(t + 2, " \n"), t + 2);
+                return -1;
+            }
+        }
+    }
+
+    if (width <= 0 || height <= 0) {
+        ELOG("bad y4m dimensions %d x %d", width, height);
+        return -1;
+    }
+    if (layout == LAYOUT_I420 && (width % 2 || height % 2)) {
+        ELOG("odd y4m dimensions %d x %d", width, height);
+        return -1;
+    }
+
+    const int plane_rows = (layout == LAYOUT_I420) ? height * 3 / 2 : height;
+    const size_t len = (size_t)plane_rows * width;
+
+    p = eol + 1;
+    while (p < end) {
+        eol = (const char *)memchr(p, '\n', end - p);
+        if (!eol || strncmp(p, "FRAME", 5)) {
+            ELOG("bad y4m frame header at offset %zu",
+                    (size_t)(p - (const char *)ff->base));
+            return -1;
+        }
+
+        struct frame_info f;
+        f.offset = eol + 1 - (const char *)ff->base;
+        f.rows = height;
+        f.cols = width;
+        f.type = CV_8UC1;
+        f.layout = layout;
+
+        if (f.offset + len > ff->size) {
+            ELOG("truncated y4m frame at offset %zu", f.offset);
+            return -1;
+        }
+
+        ff->frames.push_back(f);
+        p = eol + 1 + len;
+    }
+
+    return 0;
+}
+
+/**
+ * Map a raw or y4m file and index its frames.
+ *
+ * The mapping is private and writable, so callers may draw on returned frames
+ * without affecting the file.
+ *
+ * @param path  Path to file.
+ * @param ff    File to initialize.  Must be closed with `closeFrameFile`.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int openFrameFile(const char *path, struct frame_file *ff)
+{
+    const char *ext = strrchr(path, '.');
+
+    ff->fd = -1;
+    ff->base = NULL;
+    ff->size = 0;
+    ff->format = (ext && !strcasecmp(ext, ".y4m")) ? FRAME_Y4M : FRAME_RAW;
+    ff->frames.clear();
+
+    ff->fd = open(path, O_RDONLY);
+    if (ff->fd < 0) {
+        ELOG("cannot open %s", path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(ff->fd, &st) || st.st_size == 0) {
+        ELOG("cannot stat %s or file is empty", path);
+        closeFrameFile(ff);
+        return -1;
+    }
+    ff->size = st.st_size;
+
+    void *base = mmap(NULL, ff->size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+            ff->fd, 0);
+    if (base == MAP_FAILED) {
+        ELOG("cannot map %s", path);
+        ff->size = 0;
+        closeFrameFile(ff);
+        return -1;
+    }
+    ff->base = (uchar *)base;
+
+    // Frames are mostly read in order; let the kernel read ahead.
+    madvise(ff->base, ff->size, MADV_SEQUENTIAL);
+
+    int ret = (ff->format == FRAME_Y4M) ? indexY4M(ff) : indexRaw(ff);
+    if (ret) {
+        closeFrameFile(ff);
+        return -1;
+    }
+
+    ILOG("%s: %zu frames", path, ff->frames.size());
+
+    return 0;
+}
+
+/**
+ * Unmap a file opened by `openFrameFile`.
+ *
+ * Invalidates every Mat returned by `readFrame` for this file.
+ */
+void closeFrameFile(struct frame_file *ff)
+{
+    if (ff->base) munmap(ff->base, ff->size);
+    if (ff->fd >= 0) close(ff->fd);
+
+    ff->fd = -1;
+    ff->base = NULL;
+    ff->size = 0;
+    ff->frames.clear();
+}
+
+/**
+ * Get a frame as stored in the file, without copying.
+ *
+ * For raw files this is the stored Mat.  For y4m 4:2:0 streams it is the
+ * stacked I420 planes, and for mono streams the luma plane.  The next frame
+ * is prefetched.
+ *
+ * @param ff    Open file.
+ * @param n     Frame index.
+ * @param dst   Header pointing into the mapping.  Valid until the file is
+ *              closed.
+ *
+ * @return 0 on success, -1 if there is no such frame.
+ */
+int readFrame(const struct frame_file *ff, int n, Mat &dst)
+{
+    if (n < 0 || n >= (int)ff->frames.size()) {
+        return -1;
+    }
+
+    const struct frame_info &f = ff->frames[n];
+    const int rows = (f.layout == LAYOUT_I420) ? f.rows * 3 / 2 : f.rows;
+
+    dst = Mat(rows, f.cols, f.type, ff->base + f.offset);
+
+    assert(dst.isContinuous());
+
+    if (n + 1 < (int)ff->frames.size()) {
+        const struct frame_info &next = ff->frames[n + 1];
+
+        // madvise wants a page aligned address.
+        const size_t page = sysconf(_SC_PAGESIZE);
+        const size_t start = next.offset & ~(page - 1);
+        const size_t len = next.offset - start
+            + (size_t)next.rows * next.cols * CV_ELEM_SIZE(next.type)
+            * ((next.layout == LAYOUT_I420) ? 3 : 2) / 2;
+
+        madvise(ff->base + start, len, MADV_WILLNEED);
+    }
+
+    return 0;
+}
+
+/**
+ * Get a frame as a BGR image.
+ *
+ * BGR frames in raw files are returned without copying.  Other layouts are
+ * converted into \p dst, reusing its storage unless another image, such as
+ * a pending check, shares it.
+ *
+ * @param ff    Open file.
+ * @param n     Frame index.
+ * @param dst   BGR image.
+ *
+ * @return 0 on success, -1 if there is no such frame or it can not be
+ * converted.
+ */
+int readFrameBGR(const struct frame_file *ff, int n, Mat &dst)
+{
+    Mat frame;
+
+    if (readFrame(ff, n, frame)) {
+        return -1;
+    }
+
+    const struct frame_info &f = ff->frames[n];
+
+    if (dst.u && dst.u->refcount > 1) dst.release();
+
+    if (f.layout == LAYOUT_I420) {
+        cvtColor(frame, dst, CV_YUV2BGR_I420);
+    }
+    else if (frame.type() == CV_8UC3) {
+        dst = frame;
+    }
+    else if (frame.type() == CV_8UC1) {
+        cvtColor(frame, dst, CV_GRAY2BGR);
+    }
+    else {
+        ELOG("frame %d has no BGR conversion (type %d)", n, frame.type());
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Append a frame to a raw file.
+ *
+ * @param fp    File opened for writing.
+ * @param src   Image to write.  Any type.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int writeFrame(FILE *fp, const Mat &src)
+{
+    static const uchar zeros[FRAME_ALIGN] = {0};
+
+    struct frame_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, FRAME_MAGIC, 4);
+    h.rows = src.rows;
+    h.cols = src.cols;
+    h.type = src.type();
+
+    if (fwrite(&h, sizeof(h), 1, fp) != 1) {
+        ELOG("write failed");
+        return -1;
+    }
+
+    const size_t len_row = src.cols * src.elemSize();
+    for (int i = 0; i < src.rows; i++) {
+        if (fwrite(src.ptr(i), 1, len_row, fp) != len_row) {
+            ELOG("write failed");
+            return -1;
+        }
+    }
+
+    const size_t len = len_row * src.rows;
+    const size_t pad = frameAlign(len) - len;
+    if (pad && fwrite(zeros, 1, pad, fp) != pad) {
+        ELOG("write failed");
+        return -1;
+    }
+
+    return 0;
+}
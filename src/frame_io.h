@@ -0,0 +1,77 @@
+/**
+ * Memory-mapped input of uncompressed frames.
+ *
+ * Two containers are supported:
+ *
+ *  - raw: a sequence of frames as written by `writeFrame`.  Each frame is a
+ *    64 byte header followed by the pixel data, padded to 64 bytes.  Any Mat
+ *    type may be stored, so both BGR and grayscale corpora can be kept.
+ *  - y4m: YUV4MPEG2 streams with 4:2:0 or mono chroma.
+ *
+ * Frames are returned as Mat headers pointing into the mapping, so no pixel
+ * data is copied or decoded.
+ *
+ * @file frame_io.h
+ * @author Emily Ng
+ * @date Mar 02 2016
+ */
+
+#ifndef __FRAME_IO_H
+#define __FRAME_IO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "debug.h"
+
+using namespace cv;
+
+// alignment of frame headers and pixel data in raw files
+#define FRAME_ALIGN 64
+
+// magic at the start of each frame in a raw file
+#define FRAME_MAGIC "FRM0"
+
+// container format
+#define FRAME_RAW 0
+#define FRAME_Y4M 1
+
+// layout of the pixel data of a frame
+#define LAYOUT_MAT  0   // stored as-is, i.e. any Mat type
+#define LAYOUT_I420 1   // y4m 4:2:0, planes stacked into (3/2 rows) x cols
+#define LAYOUT_MONO 2   // y4m luma only
+
+struct frame_header {
+    char magic[4];
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t type;
+    uint8_t pad[FRAME_ALIGN - 16];
+};
+
+struct frame_info {
+    size_t offset;      // offset of pixel data in the mapping
+    int rows;           // rows of the image (not of the stored planes)
+    int cols;
+    int type;           // Mat type of the stored planes
+    int layout;
+};
+
+struct frame_file {
+    int fd;
+    uchar *base;
+    size_t size;
+    int format;
+    std::vector<struct frame_info> frames;
+};
+
+int isFrameFile(const char *path);
+int openFrameFile(const char *path, struct frame_file *ff);
+void closeFrameFile(struct frame_file *ff);
+int readFrame(const struct frame_file *ff, int n, Mat &dst);
+int readFrameBGR(const struct frame_file *ff, int n, Mat &dst);
+int writeFrame(FILE *fp, const Mat &src);
+
+#endif
@@ -0,0 +1,187 @@
+/**
+ * Histograms of 8-bit images, and thresholds picked from them.
+ *
+ * @file histogram.cpp
+ * @author Emily Ng
+ * @date Apr 18 2016
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "histogram.h"
+#include "img_proc.h"
+
+void clearHistogram(struct histogram &h)
+{
+    memset(&h, 0, sizeof(h));
+}
+
+void addHistogram(struct histogram &dst, const struct histogram &src)
+{
+    for (int i = 0; i < HIST_BINS; i++) {
+        dst.bins[i] += src.bins[i];
+    }
+    dst.total += src.total;
+}
+
+/**
+ * Count the pixels of one row into \p h.
+ */
+void histogramRow(const uchar *row, int cols, struct histogram &h)
+{
+    for (int j = 0; j < cols; j++) {
+        h.bins[row[j]]++;
+    }
+    h.total += cols;
+}
+
+/**
+ * Number of bands to cut \p rows rows into: a few per worker, so that bands
+ * that finish early leave room to steal, but none under HIST_BAND_ROWS.
+ */
+int numBands(int rows, ThreadPool *pool)
+{
+    int bands = pool ? 4 * pool->size() : 1;
+
+    if (bands > rows / HIST_BAND_ROWS) bands = rows / HIST_BAND_ROWS;
+    return (bands < 1) ? 1 : bands;
+}
+
+/**
+ * Histogram of an 8-bit image.
+ *
+ * @param src   Single channel image.
+ * @param dst   Histogram of \p src.
+ * @param pool  Counts bands in parallel, if not NULL.
+ */
+void histogramMat(const Mat &src, struct histogram &dst, ThreadPool *pool)
+{
+    PERF_SCOPE("histogramMat", src.total());
+    assert(src.type() == CV_8UC1);
+
+    const int bands = numBands(src.rows, pool);
+    std::vector<struct histogram> parts(bands);
+
+    std::function<void(int)> count = [&src, &parts, bands](int b) {
+        struct histogram &h = parts[b];
+
+        clearHistogram(h);
+        for (int i = src.rows * b / bands; i < src.rows * (b + 1) / bands;
+                i++) {
+            histogramRow(src.ptr<uchar>(i), src.cols, h);
+        }
+    };
+
+    if (pool) parallelFor(*pool, 0, bands, count);
+    else for (int b = 0; b < bands; b++) count(b);
+
+    clearHistogram(dst);
+    for (int b = 0; b < bands; b++) {
+        addHistogram(dst, parts[b]);
+    }
+}
+
+/**
+ * Otsu's threshold: the one that maximizes the variance between the pixels
+ * at or below it and those above it.
+ *
+ * @return Threshold, or the top bin if all pixels have one value.
+ */
+int otsuThreshold(const struct histogram &h)
+{
+    double sum = 0;
+    for (int i = 0; i < HIST_BINS; i++) {
+        sum += (double)i * h.bins[i];
+    }
+
+    double w0 = 0, sum0 = 0, best = -1;
+    int t = HIST_BINS - 1;
+
+    for (int i = 0; i < HIST_BINS; i++) {
+        w0 += h.bins[i];
+        sum0 += (double)i * h.bins[i];
+
+        const double w1 = (double)h.total - w0;
+        if (w0 == 0) continue;
+        if (w1 == 0) break;
+
+        const double d = sum0 / w0 - (sum - sum0) / w1;
+        const double between = w0 * w1 * d * d;
+
+        if (between > best) {
+            best = between;
+            t = i;
+        }
+    }
+
+    return t;
+}
+
+/**
+ * Threshold with at least \p pct percent of the pixels at or below it.
+ */
+int percentileThreshold(const struct histogram &h, double pct)
+{
+    const double target = h.total * pct / 100;
+    uint64_t below = 0;
+
+    for (int i = 0; i < HIST_BINS; i++) {
+        below += h.bins[i];
+        if (below >= target) return i;
+    }
+    return HIST_BINS - 1;
+}
+
+/**
+ * Parse a threshold rule: a value from 0 to 255, "otsu", or "p" and a
+ * percentile, e.g. "p95".
+ *
+ * @return 0 on success, -1 if \p s is not a rule.
+ */
+int parseThreshRule(const char *s, struct thresh_rule &rule)
+{
+    char *end;
+
+    if (!strcmp(s, "otsu")) {
+        rule.kind = THRESH_AUTO_OTSU;
+        rule.value = 0;
+        return 0;
+    }
+
+    if (s[0] == 'p') {
+        rule.kind = THRESH_PERCENTILE;
+        rule.value = strtod(s + 1, &end);
+        if (end != s + 1 && !*end && rule.value >= 0 && rule.value <= 100) {
+            return 0;
+        }
+    }
+    else {
+        rule.kind = THRESH_FIXED;
+        rule.value = strtol(s, &end, 10);
+        if (end != s && !*end && rule.value >= 0 && rule.value <= WHITE) {
+            return 0;
+        }
+    }
+
+    ELOG("bad threshold %s, expected 0-255, otsu or p<percentile>", s);
+    return -1;
+}
+
+/**
+ * Threshold given by \p rule for an image with histogram \p h.  Fixed
+ * thresholds do not look at \p h.
+ */
+int pickThreshold(const struct histogram &h, const struct thresh_rule &rule)
+{
+    switch (rule.kind) {
+        case THRESH_AUTO_OTSU:
+            return otsuThreshold(h);
+        case THRESH_PERCENTILE:
+            return percentileThreshold(h, rule.value);
+        default:
+            return (int)rule.value;
+    }
+}
@@ -0,0 +1,60 @@
+/**
+ * Histograms of 8-bit images, and thresholds picked from them.
+ *
+ * Images are cut into bands of rows, each counted into its own histogram on
+ * the pool, and the histograms are summed at the end, so threads never share
+ * a counter.
+ *
+ * A threshold rule is either a fixed value, Otsu's method, or a percentile:
+ * with "p90", the brightest 10% of pixels are above the threshold.  Pixels
+ * above the threshold are WHITE, as for `threshold` with THRESH_BINARY.
+ *
+ * @file histogram.h
+ * @author Emily Ng
+ * @date Apr 18 2016
+ */
+
+#ifndef __HISTOGRAM_H
+#define __HISTOGRAM_H
+
+#include <stdint.h>
+#include <opencv2/core.hpp>
+
+#include "debug.h"
+#include "thread_pool.h"
+
+using namespace cv;
+
+#define HIST_BINS 256
+
+// Rows per band counted by one task, at least.
+#define HIST_BAND_ROWS 32
+
+// kinds of threshold rule
+#define THRESH_FIXED 0
+#define THRESH_AUTO_OTSU 1
+#define THRESH_PERCENTILE 2
+
+struct histogram {
+    uint64_t bins[HIST_BINS];
+    uint64_t total;
+};
+
+struct thresh_rule {
+    int kind;
+    double value;               // threshold, or percentile if THRESH_PERCENTILE
+};
+
+void clearHistogram(struct histogram &h);
+void addHistogram(struct histogram &dst, const struct histogram &src);
+void histogramRow(const uchar *row, int cols, struct histogram &h);
+void histogramMat(const Mat &src, struct histogram &dst,
+        ThreadPool *pool = NULL);
+int numBands(int rows, ThreadPool *pool);
+
+int otsuThreshold(const struct histogram &h);
+int percentileThreshold(const struct histogram &h, double pct);
+int parseThreshRule(const char *s, struct thresh_rule &rule);
+int pickThreshold(const struct histogram &h, const struct thresh_rule &rule);
+
+#endif
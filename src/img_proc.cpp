@@ -11,6 +11,7 @@
 #include <stack>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <opencv2/imgproc.hpp>
 
 #include "img_proc.h"
@@ -58,6 +59,7 @@ unsigned int sumOfAbsoluteDifferences(Mat &A, Mat &B)
  */
 void rgb2g(const Mat &src, Mat &dst)
 {
+    PERF_SCOPE("rgb2g", src.total());
     // intensity = 0.2989*red + 0.5870*green + 0.1140*blue
     const int rows = src.rows;
     const int cols = src.cols;
@@ -86,6 +88,40 @@ void rgb2g(const Mat &src, Mat &dst)
 
 }
 
+/** @brief Halve an image in each direction.
+ *
+ * Each pixel of \p dst is the rounded mean of a 2 x 2 block of \p src.  An odd
+ * last row or column is dropped.
+ *
+ * @param src   8-bit image, any number of channels
+ * @param dst   dest image, of the type of \p src
+ */
+void halveImage(const Mat &src, Mat &dst)
+{
+    PERF_SCOPE("halveImage", src.total());
+    assert(src.depth() == CV_8U);
+
+    const int rows = src.rows / 2;
+    const int cols = src.cols / 2;
+    const int cn = src.channels();
+
+    dst.create(rows, cols, src.type());
+
+    for (int i = 0; i < rows; i++) {
+        const uchar *a = src.ptr<uchar>(2 * i);
+        const uchar *b = src.ptr<uchar>(2 * i + 1);
+        uchar *d = dst.ptr<uchar>(i);
+
+        for (int j = 0; j < cols; j++) {
+            for (int c = 0; c < cn; c++) {
+                const int k = 2 * j * cn + c;
+
+                d[j * cn + c] = (a[k] + a[k + cn] + b[k] + b[k + cn] + 2) >> 2;
+            }
+        }
+    }
+}
+
 /** Apply a kernel to source image.
  *
  * @param src       source image
@@ -94,6 +130,7 @@ void rgb2g(const Mat &src, Mat &dst)
  */
 void applyKernel(const Mat &src, Mat &dst, const Mat &kernel)
 {
+    PERF_SCOPE("applyKernel", src.total());
     ILOG("kernel %d x %d", kernel.size().width, kernel.size().height);
     ILOG("src    %d x %d", src.size().width, src.size().height);
     ILOG("dst    %d x %d", dst.size().width, dst.size().height);
@@ -159,6 +196,7 @@ void applyKernel(const Mat &src, Mat &dst, const Mat &kernel)
  */
 void combine(Mat &A, Mat &B, Mat &C, int (*fp)(int a, int b))
 {
+    PERF_SCOPE("combine", A.total());
     assert(A.depth() == B.depth());
     assert(A.channels() == B.channels());
     assert(A.rows == B.rows && A.cols == B.cols);
@@ -203,6 +241,7 @@ void combine(Mat &A, Mat &B, Mat &C, int (*fp)(int a, int b))
  */
 struct rect extractObject(Mat &src, Mat &dst)
 {
+    PERF_SCOPE("extractObject", src.total());
     const int rows = src.rows;
     const int cols = src.cols;
 
@@ -336,6 +375,77 @@ end:
     return r;
 }
 
+/**
+ * Calculate normalized moments and Hu's moment invariants.
+ *
+ * @param m     Moments with m00 and the central moments set.
+ */
+void huMoments(struct _moment &m)
+{
+    // n_ij = u_ij / (m_00 ^ (1 + (i + j) / 2))
+    m.n02 = m.u02 / pow(m.m00, 1 + (0 + 2) / 2.0);
+    m.n03 = m.u03 / pow(m.m00, 1 + (0 + 3) / 2.0);
+    m.n11 = m.u11 / pow(m.m00, 1 + (1 + 1) / 2.0);
+    m.n12 = m.u12 / pow(m.m00, 1 + (1 + 2) / 2.0);
+    m.n20 = m.u20 / pow(m.m00, 1 + (2 + 0) / 2.0);
+    m.n21 = m.u21 / pow(m.m00, 1 + (2 + 1) / 2.0);
+    m.n30 = m.u30 / pow(m.m00, 1 + (3 + 0) / 2.0);
+
+    m.hu[0] = m.n20 + m.n02;
+    m.hu[1] = pow(m.n20 - m.n02, 2) + 4 * pow(m.n11, 2);
+    m.hu[2] = pow(m.n30 - 3 * m.n12, 2) + pow(3 * m.n21 - m.n03, 2);
+    m.hu[3] = pow(m.n30 + m.n12, 2) + pow(m.n21 + m.n03, 2);
+    m.hu[4] = (m.n30 - 3 * m.n12) * (m.n30 + m.n12)
+        * (pow(m.n30 + m.n12, 2) - 3 * pow(m.n21 + m.n03, 2))
+        + (3 * m.n21 - m.n03) * (m.n21 + m.n03)
+        * (3 * pow(m.n30 + m.n12, 2) - pow(m.n21 + m.n03, 2));
+    m.hu[5] = (m.n20 - m.n02)
+        * (pow(m.n30 + m.n12, 2) - pow(m.n21 + m.n03, 2))
+        + 4 * m.n11 * (m.n30 + m.n12) * (m.n21 + m.n03);
+    m.hu[6] = (3 * m.n21 - m.n03) * (m.n30 + m.n12)
+        * (pow(m.n30 + m.n12, 2) - 3 * pow(m.n21 + m.n03, 2))
+        - (m.n30 - 3 * m.n12) * (m.n21 + m.n03)
+        * (3 * pow(m.n30 + m.n12, 2) - pow(m.n21 + m.n03, 2));
+}
+
+/**
+ * Central, normalized and Hu moments from raw moments.
+ *
+ * @param r     Raw moments about (x0, y0).  Only m00, m10 and m01 are moved
+ *              back to the origin.
+ */
+struct _moment momentsFromRaw(const struct raw_moment &r)
+{
+    struct _moment m;
+
+    memset(&m, 0, sizeof(m));
+
+    if (r.m00 == 0) {
+        return m;
+    }
+
+    const double x_bar = r.m10 / r.m00;
+    const double y_bar = r.m01 / r.m00;
+
+    m.m00 = r.m00;
+    m.m10 = r.m10 + r.x0 * r.m00;
+    m.m01 = r.m01 + r.y0 * r.m00;
+
+    m.u20 = r.m20 - x_bar * r.m10;
+    m.u02 = r.m02 - y_bar * r.m01;
+    m.u11 = r.m11 - x_bar * r.m01;
+    m.u30 = r.m30 - 3 * x_bar * r.m20 + 2 * x_bar * x_bar * r.m10;
+    m.u03 = r.m03 - 3 * y_bar * r.m02 + 2 * y_bar * y_bar * r.m01;
+    m.u21 = r.m21 - 2 * x_bar * r.m11 - y_bar * r.m20
+        + 2 * x_bar * x_bar * r.m01;
+    m.u12 = r.m12 - 2 * y_bar * r.m11 - x_bar * r.m02
+        + 2 * y_bar * y_bar * r.m10;
+
+    huMoments(m);
+
+    return m;
+}
+
 /**
  * Calculate moments of an image.
  *
@@ -346,6 +456,7 @@ end:
  */
 struct _moment imageMoments(const Mat &src)
 {
+    PERF_SCOPE("imageMoments", src.total());
     assert(src.channels() == GRAY);
 
     const int rows = src.rows;
@@ -404,30 +515,7 @@ struct _moment imageMoments(const Mat &src)
         }
     }
 
-    // n_ij = u_ij / (m_00 ^ (1 + (i + j) / 2))
-    m.n02 = m.u02 / pow(m.m00, 1 + (0 + 2) / 2.0);
-    m.n03 = m.u03 / pow(m.m00, 1 + (0 + 3) / 2.0);
-    m.n11 = m.u11 / pow(m.m00, 1 + (1 + 1) / 2.0);
-    m.n12 = m.u12 / pow(m.m00, 1 + (1 + 2) / 2.0);
-    m.n20 = m.u20 / pow(m.m00, 1 + (2 + 0) / 2.0);
-    m.n21 = m.u21 / pow(m.m00, 1 + (2 + 1) / 2.0);
-    m.n30 = m.u30 / pow(m.m00, 1 + (3 + 0) / 2.0);
-
-    m.hu[0] = m.n20 + m.n02;
-    m.hu[1] = pow(m.n20 - m.n02, 2) + 4 * pow(m.n11, 2);
-    m.hu[2] = pow(m.n30 - 3 * m.n12, 2) + pow(3 * m.n21 - m.n03, 2);
-    m.hu[3] = pow(m.n30 + m.n12, 2) + pow(m.n21 + m.n03, 2);
-    m.hu[4] = (m.n30 - 3 * m.n12) * (m.n30 + m.n12)
-        * (pow(m.n30 + m.n12, 2) - 3 * pow(m.n21 + m.n03, 2))
-        + (3 * m.n21 - m.n03) * (m.n21 + m.n03)
-        * (3 * pow(m.n30 + m.n12, 2) - pow(m.n21 + m.n03, 2));
-    m.hu[5] = (m.n20 - m.n02)
-        * (pow(m.n30 + m.n12, 2) - pow(m.n21 + m.n03, 2))
-        + 4 * m.n11 * (m.n30 + m.n12) * (m.n21 + m.n03);
-    m.hu[6] = (3 * m.n21 - m.n03) * (m.n30 + m.n12)
-        * (pow(m.n30 + m.n12, 2) - 3 * pow(m.n21 + m.n03, 2))
-        - (m.n30 - 3 * m.n12) * (m.n21 + m.n03)
-        * (3 * pow(m.n30 + m.n12, 2) - pow(m.n21 + m.n03, 2));
+    huMoments(m);
 
     return m;
 }
@@ -484,18 +572,13 @@ void isolateColor(const Mat &src, const int c, Mat &dst, uchar thresh)
 }
 
 /**
- * Compare two sets of Hu moments to see if we have a match.
- *
- * The two sets of moments are treated the same, i.e. the two arguments are
- * commutative.
+ * Difference between two sets of Hu moments, unrounded.  Ranks candidates
+ * that `compareHu` would score the same.
  *
  * @param hu1   Reference image's moments.
  * @param hu2   Sample image's moments.
- *
- * @return A number representing how different the two images are.  A value < 50
- * is a pretty good match.
  */
-unsigned int compareHu(double *hu1, double *hu2)
+double huDistance(const double *hu1, const double *hu2)
 {
     double r = 0;
 
@@ -505,12 +588,33 @@ unsigned int compareHu(double *hu1, double *hu2)
         double h1 = (hu1[i]);
         double h2 = (hu2[i]);
 
+        // Equal moments do not differ, even when both are 0 as for shapes
+        // with symmetry.
+        if (h1 == h2) continue;
+
         double sq_diff = pow(h2 - h1, 2) / (h1 * h2);
 
         r += pow(sq_diff, 2);
     }
 
-    return (unsigned int) r;
+    return r;
+}
+
+/**
+ * Compare two sets of Hu moments to see if we have a match.
+ *
+ * The two sets of moments are treated the same, i.e. the two arguments are
+ * commutative.
+ *
+ * @param hu1   Reference image's moments.
+ * @param hu2   Sample image's moments.
+ *
+ * @return A number representing how different the two images are.  A value < 50
+ * is a pretty good match.
+ */
+unsigned int compareHu(double *hu1, double *hu2)
+{
+    return (unsigned int) huDistance(hu1, hu2);
 }
 
 /**
@@ -522,6 +626,7 @@ unsigned int compareHu(double *hu1, double *hu2)
  */
 unsigned int connectedComponentsLabeling(const Mat &src, Mat &dst)
 {
+    PERF_SCOPE("connectedComponents", src.total());
     assert(src.isContinuous());
     assert(src.channels() == GRAY);
 
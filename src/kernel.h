@@ -11,6 +11,8 @@
 
 #include <opencv2/opencv.hpp>
 
+#include "img_proc.h"
+
 const cv::Mat kern_sharpen = (cv::Mat_<char>(3, 3) <<
      0, -1,  0,
     -1,  5, -1,
@@ -26,4 +28,20 @@ const cv::Mat kern_sobel_y = (cv::Mat_<char>(3, 3) <<
      0,  0,  0,
      1,  2,  1);
 
+// The same kernels for the specialized `applyKernel`.
+typedef taps3x3<
+     0, -1,  0,
+    -1,  5, -1,
+     0, -1,  0> taps_sharpen;
+
+typedef taps3x3<
+    -1,  0,  1,
+    -2,  0,  2,
+    -1,  0,  1> taps_sobel_x;
+
+typedef taps3x3<
+    -1, -2, -1,
+     0,  0,  0,
+     1,  2,  1> taps_sobel_y;
+
 #endif
@@ -6,79 +6,315 @@
  * @date Feb 11 2016
  */
 
+#include <algorithm>
 #include <assert.h>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <opencv2/core.hpp>
 
+#include "alloc_stats.h"
+#include "bitmask.h"
+#include "cache.h"
+#include "color_lut.h"
+#include "contour.h"
+#include "daemon.h"
+#include "deadline.h"
 #include "debug.h"
+#include "detections.h"
+#include "display.h"
+#include "frame_io.h"
+#include "histogram.h"
 #include "img_proc.h"
 #include "kernel.h"
+#include "morph.h"
+#include "objects.h"
+#include "orient.h"
+#include "pipeline.h"
+#include "prefetch.h"
+#include "profile.h"
+#include "rle.h"
+#include "shadow.h"
+#include "shape_db.h"
+#include "stream.h"
+#include "thread_pool.h"
+#include "tiles.h"
+#include "tracker.h"
 #include "utils.h"
 
+// Default budget of the intermediate result cache, in MB.
+#define CACHE_MB 64
+
+// Threshold applied to the Sobel magnitude, unless another rule is given.
+#define EDGE_THRESH 150
+
+// Default rate of checks against OpenCV, 1 in SHADOW_RATE frames.
+#define SHADOW_RATE 16
+
+// Threshold of `isolate_color` without a trackbar, or before it is moved.
+#define ISOLATE_THRESH 64
+
+// How often the trackbar window shows the latest result, in ms.
+#define ISOLATE_POLL_MS 30
+
+// Checks our kernels against OpenCV in the background.  Set up by main.
+static ShadowVerifier *shadow = NULL;
+
+// Detection records of each frame are appended here, if set (-r).
+static FILE *records = NULL;
+
+// Reference shapes objects are matched against, if mapped (-d).  Otherwise
+// objects are compared with the first object of the frame.
+static struct shape_db shapes = { -1, NULL, 0, 0, 0 };
+
+// How the Sobel magnitude is thresholded (-t): a fixed value, or one picked
+// per image from its histogram.
+static struct thresh_rule edge_rule = { THRESH_FIXED, EDGE_THRESH };
+
+// Objects enclosing fewer pixels are dropped before they are scored (-A).
+static double min_area = 0;
+
+// Rectangle the thresholded edges are closed by (-M), to join broken
+// outlines.  1 x 1 leaves them as they are.
+static int close_w = 1;
+static int close_h = 1;
+
+// Follows objects from frame to frame, in batches and across the `m` command.
+// Set up by main.
+static Tracker *tracker = NULL;
+
+// Picks the quality of each frame to keep within the time allowed per frame
+// (-D).  Without a budget every frame runs at full quality.  Set up by main.
+static FrameGovernor *governor = NULL;
+
 /**
- * Trackbar callback.  Invoked when value of trackbar is changed.
- *
- * Use the trackbar value to specify threshold to `isolateColor` (i.e. how red
- * does this pixel have to be to count as a RED pixel.
+ * How one frame is processed.
+ */
+struct frame_plan {
+    int quality;                // QUALITY_*
+    int scale;                  // edges are found at 1 / scale resolution
+    const Deadline *deadline;   // of the frame, or NULL for none
+    bool verify;                // checked against OpenCV
+};
+
+/**
+ * Plan of a command: every stage, at full resolution, however long it
+ * takes.  Checked against OpenCV if the verifier picks it.
+ */
+static struct frame_plan full_plan()
+{
+    struct frame_plan plan = { QUALITY_FULL, 1, NULL, false };
+
+    plan.verify = shadow->sampleFrame();
+    return plan;
+}
+
+/**
+ * Plan of a frame with \p deadline, at the quality the governor picks.  Only
+ * frames at full quality are checked against OpenCV, if the verifier picks
+ * them.
+ */
+static struct frame_plan plan_frame(const Deadline &deadline)
+{
+    struct frame_plan plan;
+
+    plan.quality = governor->plan();
+    plan.scale = (plan.quality == QUALITY_HALF) ? 2 : 1;
+    plan.deadline = &deadline;
+    plan.verify = plan.quality == QUALITY_FULL && shadow->sampleFrame();
+
+    return plan;
+}
+
+/**
+ * Tell the governor how frame \p frame_id went.
+ */
+static void frame_done(int frame_id, const struct frame_plan &plan,
+        bool late)
+{
+    governor->done(frame_id, plan.quality, plan.deadline->elapsedMs(), late);
+    if (late) WLOG("frame %d: out of time, abandoned", frame_id);
+}
+
+/*****      Isolate color     *******/
+/**
+ * Mark the centroid of the pixels of \p src at least \p x red, onto \p dst.
+ * Gives up between stages once \p deadline, if not NULL, expires.
  *
- * @param x     Value of trackbar
- * @param data  Void pointer to source image.
+ * @return 0, or -1 if given up or there are no red pixels.
  */
-void locate_point_cb(int x, void *data)
+static int locate_point(const Mat &src, int x, const Deadline *deadline,
+        Mat &dst)
 {
-    Mat red, bw, src;
+    Mat bw;
+
+    isolateColor(src, RED, dst, x);
+    if (pastDeadline(deadline)) return -1;
 
-    src = *(Mat *)data;
+    cvtColor(dst, bw, CV_BGR2GRAY, 0);
+    if (pastDeadline(deadline)) return -1;
 
-    isolateColor(src, RED, red, x);
-    cvtColor(red, bw, CV_BGR2GRAY, 0);
     _moment color_moment = imageMoments(bw);
+    if (pastDeadline(deadline)) return -1;
 
     // Avoid a divide-by-zero in the case that there are no red pixels.
     if (color_moment.m00 == 0) {
         WLOG("Unable to find centroid.");
-        return;
+        return -1;
     }
 
     int xbar = (int)color_moment.m10 / color_moment.m00;
     int ybar = (int)color_moment.m01 / color_moment.m00;
 
     // Draw a small blue circle at the centroid to visually identify it.
-    circle(red, Point(xbar, ybar), 3, Scalar(255, 0, 0), -1);
+    circle(dst, Point(xbar, ybar), 3, Scalar(255, 0, 0), -1);
 
     ILOG("Threshold %d\t Centroid (%d, %d)", x, xbar, ybar);
 
-    imshow("Extract red 0", red);
+    return 0;
+}
+
+// State of the trackbar of `isolate_color`.
+struct locate_state {
+    const Mat *src;
+    LatestRunner runner;        // recomputes as the trackbar moves
+    std::mutex lock;
+    Mat result;                 // latest finished, until shown
+};
+
+/**
+ * Trackbar callback.  Invoked when value of trackbar is changed.
+ *
+ * Use the trackbar value to specify threshold to `isolateColor` (i.e. how red
+ * does this pixel have to be to count as a RED pixel.
+ *
+ * Runs on the display thread, so only queues the work.  A result still being
+ * computed for an older value is stale, and is cancelled.
+ *
+ * @param x     Value of trackbar
+ * @param data  Pointer to `locate_state`.
+ */
+void locate_point_cb(int x, void *data)
+{
+    struct locate_state *state = (struct locate_state *)data;
+
+    state->runner.post([state, x](const Deadline &deadline) {
+        Mat red;
+
+        if (locate_point(*state->src, x, &deadline, red)) return;
+
+        std::lock_guard<std::mutex> guard(state->lock);
+        state->result = red;
+    });
 }
 
 using namespace cv;
 
-/*****      Isolate color     *******/
 void isolate_color(const Mat &src)
 {
-    int x;
+    if (DISP != DISP_WINDOWS) {
+        // No trackbar without windows.
+        Mat red;
+
+        if (!locate_point(src, ISOLATE_THRESH, NULL, red)) {
+            displaySink().show("Extract red 0", red);
+        }
+        return;
+    }
 
-    displayImageRow("Extract red", 1, &src);
-    createTrackbar("Trackbar", "Extract red 0", &x, 255, locate_point_cb,
-            (void *)&src);
+    // The trackbar needs HighGUI, which only the display thread may use.
+    displaySink().interact([&src] {
+        struct locate_state state;
+        int x = ISOLATE_THRESH;
+
+        state.src = &src;
+
+        namedWindow("Extract red 0", WINDOW_AUTOSIZE);
+        imshow("Extract red 0", src);
+        createTrackbar("Trackbar", "Extract red 0", &x, 255, locate_point_cb,
+                (void *)&state);
+
+        // Show results as they finish, until a key is pressed.
+        while (waitKey(ISOLATE_POLL_MS) < 0) {
+            Mat red;
+            {
+                std::lock_guard<std::mutex> guard(state.lock);
+                red = state.result;
+                state.result = Mat();
+            }
+            if (red.data) imshow("Extract red 0", red);
+        }
 
-    waitKey(0);
+        // The trackbar points at `x` and `state`, which go with this scope,
+        // and the display thread keeps pumping events after it.
+        destroyWindow("Extract red 0");
+    });
 }
 
-/*****      Convert to grayscale     *******/
-void convert_to_grayscale(const Mat &src, Mat &dst)
+/*****      Classify colors     *******/
+/**
+ * Label each pixel of \p src with a color class, from the rules in file \p
+ * path, and mark the centroid of each class.
+ */
+void classify_colors(const char *path, const Mat &src)
 {
-    Mat dst_opencv;
+    std::vector<struct color_rule> rules;
+    struct color_lut lut;
+    struct color_class classes[MAX_CLASSES];
+    Mat labels;
 
+    if (parseColorRules(path, rules)) {
+        ELOG("color rules %s failed", path);
+        return;
+    }
+    buildColorLut(rules, lut);
+    classifyColors(src, lut, labels, classes);
+
+    Mat dst = Mat::zeros(src.size(), src.type());
+    std::vector<Vec3b> colors(lut.num_classes);
+    for (int c = 0; c < lut.num_classes; c++) {
+        colors[c] = labelColor(c);
+    }
+
+    for (int i = 0; i < dst.rows; i++) {
+        const uchar *l = labels.ptr<uchar>(i);
+        Vec3b *p = dst.ptr<Vec3b>(i);
+
+        for (int j = 0; j < dst.cols; j++) {
+            p[j] = colors[l[j]];
+        }
+    }
+
+    for (int c = 1; c < lut.num_classes; c++) {
+        if (!classes[c].count) {
+            ILOG("%-12s not found", lut.names[c]);
+            continue;
+        }
+
+        int xbar = classes[c].sum_x / classes[c].count;
+        int ybar = classes[c].sum_y / classes[c].count;
+
+        circle(dst, Point(xbar, ybar), 3, Scalar::all(255), -1);
+        ILOG("%-12s %8lu px, centroid (%d, %d)", lut.names[c],
+                (unsigned long)classes[c].count, xbar, ybar);
+    }
+
+    displayImageRow("Color classes", 1, &dst);
+}
+
+/*****      Convert to grayscale     *******/
+void convert_to_grayscale(const Mat &src, Mat &dst, bool verify)
+{
     rgb2g(src, dst);                       // ours
-    cvtColor(src, dst_opencv, CV_BGR2GRAY, 0);    // OpencV
+    if (verify) {
+        shadow->verifyGray(src, dst);      // OpenCV, in the background
+    }
 
-    // Compare
-    unsigned int diff = sumOfAbsoluteDifferences(dst_opencv, dst);
-    ILOG("gray abs diff %u", diff);
-    displayImageRow("Color to gray", 2, &dst_opencv, &dst);
+    displayImageRow("Color to gray", 1, &dst);
 
 }
 
@@ -86,136 +322,519 @@ void convert_to_grayscale(const Mat &src, Mat &dst)
 /**
  * \p src should be a grayscale image
  */
-void sobel(const Mat &src, Mat &dst)
+void sobel(const Mat &src, Mat &dst, bool verify)
 {
-    Mat dst_opencv;
-    unsigned int diff;
-
     // Ours
     Mat dst_x, dst_y;
-    applyKernel(src, dst_x, kern_sobel_x);
-    applyKernel(src, dst_y, kern_sobel_y);
+    applyKernel(src, dst_x, taps_sobel_x());
+    applyKernel(src, dst_y, taps_sobel_y());
     combine(dst_x, dst_y, dst, &hypoteneuse);
 
-    // OpenCV
-    Mat tmp_x, tmp_y;
-    filter2D(src, tmp_x, CV_16S, kern_sobel_x);     // x derivative
-    filter2D(src, tmp_y, CV_16S, kern_sobel_y);     // y derivative
-    addWeighted(tmp_x, 0.5, tmp_y, 0.5, 0, dst_opencv); // combine
-    convertScaleAbs(dst_opencv, dst_opencv);        // back to CV_8U
+    // OpenCV, in the background
+    if (verify) shadow->verifySobel(src, dst);
+
+    displayImageRow("Sobel", 1, &dst);
+
+}
+
+/*****      Edge detection front end     *******/
+/**
+ * Close gaps in the outlines of \p binary, if asked to (-M).  At a reduced
+ * resolution the rectangle shrinks with the image.
+ *
+ * Unless \p spare is NULL, the closing goes into it, with the buffers of
+ * \p scratch, and the two images swap, so that callers closing image after
+ * image of the same size reuse both.
+ */
+static void close_edges(Mat &binary, const struct frame_plan &plan,
+        Mat *spare = NULL, struct morph_scratch *scratch = NULL)
+{
+    const int w = std::max(close_w / plan.scale, 1);
+    const int h = std::max(close_h / plan.scale, 1);
+
+    if (w == 1 && h == 1) return;
+
+    // Closed into an image of its own, as the edges are still checked.
+    Mat own;
+    Mat &closed = spare ? *spare : own;
+
+    morphRect(binary, closed, MORPH_OP_CLOSE, w, h, scratch);
+    if (plan.verify) {
+        shadow->verifyMorph(binary, closed, MORPH_OP_CLOSE, w, h);
+    }
+
+    Mat edges = binary;
+    binary = closed;
+    closed = edges;
+}
+
+/**
+ * Grayscale, Sobel and threshold of \p src.  The thresholded edges are closed
+ * as `close_edges` does.  Orientation bins of the gradient go to \p m_orient.
+ *
+ * Results of earlier commands on the same image are taken from \p cache, and
+ * stages before the latest cached result are skipped.  Pass NULL for outputs
+ * that are not needed, and for \p cache when images are not seen again.
+ *
+ * When only the binary image, and perhaps orientations, are needed and
+ * nothing is displayed, the stages are streamed row by row instead of
+ * producing intermediate images, in bands on \p pool.
+ *
+ * Below full quality \p plan skips the checks against OpenCV, and at half
+ * quality every output is at half resolution.  Stages stop once the deadline
+ * of \p plan expires, and nothing is cached.
+ *
+ * @return 0, or -1 if out of time.
+ */
+int front_end(StageCache *cache, ThreadPool &pool, const Mat &src,
+        Mat *m_gray, Mat *m_sobel, Mat *m_thresh, Mat *m_orient,
+        const struct thresh_rule &rule, const struct frame_plan &plan)
+{
+    PERF_SCOPE("front_end", src.total());
+    Mat in, gray, grad, binary, orient;
+    char params[48];
+
+    const bool verify = plan.verify;
+    const char *scaled = (plan.scale > 1) ? "/2" : "";
+    const uint64_t h = cache ? hashMat(src) : 0;
+    snprintf(params, sizeof(params), "%d:%g %dx%d%s", rule.kind, rule.value,
+            close_w, close_h, scaled);
+
+    if (plan.scale > 1) halveImage(src, in);
+    else in = src;
+
+    // Work backwards to find the stages that have to run.
+    const bool want_thresh = m_thresh != NULL;
+    const bool have_thresh = want_thresh
+        && cache && cache->get(h, "threshold", params, binary);
+    const bool want_orient = m_orient != NULL;
+    const bool have_orient = want_orient
+        && cache && cache->get(h, "orient", scaled, orient);
+
+    if (want_thresh && !have_thresh && !m_gray && !m_sobel && !DISP) {
+        Mat *bins = (want_orient && !have_orient) ? &orient : NULL;
+        const int thresh = streamEdges(in, binary, rule, &pool,
+                plan.deadline, bins);
+        if (thresh < 0) return -1;
+
+        DLOG("edge threshold %d", thresh);
+        close_edges(binary, plan);
+        if (pastDeadline(plan.deadline)) return -1;
+
+        if (cache) {
+            cache->put(h, "threshold", params, binary);
+            if (bins) cache->put(h, "orient", scaled, orient);
+        }
+
+        *m_thresh = binary;
+        if (m_orient) *m_orient = orient;
+        return 0;
+    }
+    const bool want_sobel = m_sobel || (want_thresh && !have_thresh);
+    const bool have_sobel = want_sobel && cache
+        && cache->get(h, "sobel", scaled, grad);
+    const bool want_gray = m_gray || (want_sobel && !have_sobel)
+        || (want_orient && !have_orient);
+
+    if (want_gray) {
+        if (cache && cache->get(h, "gray", scaled, gray)) {
+            if (m_gray) displayImageRow("Color to gray (cached)", 1, &gray);
+        }
+        else {
+            convert_to_grayscale(in, gray, verify);
+            if (cache) cache->put(h, "gray", scaled, gray);
+        }
+        resetDisplayPosition();
+    }
+    if (pastDeadline(plan.deadline)) return -1;
+
+    if (want_sobel) {
+        if (have_sobel) {
+            if (m_sobel) displayImageRow("Sobel (cached)", 1, &grad);
+        }
+        else {
+            sobel(gray, grad, verify);
+            if (cache) cache->put(h, "sobel", scaled, grad);
+        }
+        resetDisplayPosition();
+    }
+    if (pastDeadline(plan.deadline)) return -1;
+
+    if (want_thresh && !have_thresh) {
+        struct histogram hist;
 
-    // Compare
-    diff = sumOfAbsoluteDifferences(dst_opencv, dst);
-    ILOG("filter abs diff %u", diff);
-    displayImageRow("Sobel", 2, &dst_opencv, &dst);
+        clearHistogram(hist);
+        if (rule.kind != THRESH_FIXED) histogramMat(grad, hist, &pool);
 
+        const int thresh = pickThreshold(hist, rule);
+        DLOG("edge threshold %d", thresh);
+
+        threshold(grad, binary, thresh, 255, THRESH_BINARY);
+        close_edges(binary, plan);
+        if (pastDeadline(plan.deadline)) return -1;
+
+        if (cache) cache->put(h, "threshold", params, binary);
+    }
+
+    // The Sobel image above keeps only the magnitude, so the orientations
+    // need a pass of their own.
+    if (want_orient && !have_orient) {
+        orientationMat(gray, orient);
+        if (cache) cache->put(h, "orient", scaled, orient);
+    }
+
+    if (m_gray) *m_gray = gray;
+    if (m_sobel) *m_sobel = grad;
+    if (m_thresh) *m_thresh = binary;
+    if (m_orient) *m_orient = orient;
+    return 0;
+}
+
+/*****      Run pipeline description     *******/
+/**
+ * Run the pipeline described in file \p path on \p src and show its outputs.
+ */
+void run_pipeline(ThreadPool &pool, const char *path, const Mat &src)
+{
+    Pipeline pipeline;
+    std::map<std::string, Mat> outputs;
+
+    if (pipeline.parse(path) || pipeline.run(pool, src, outputs)) {
+        ELOG("pipeline %s failed", path);
+        return;
+    }
+
+    std::map<std::string, Mat>::iterator it;
+    for (it = outputs.begin(); it != outputs.end(); it++) {
+        Mat &out = it->second;
+
+        if (out.total() == 1 && out.type() == CV_32SC1) {
+            ILOG("%s: %d", it->first.c_str(), out.ptr<int>(0)[0]);
+        }
+        else if (out.rows == 1 && out.type() == CV_64FC1) {
+            ILOG("%s: m00 %.0f", it->first.c_str(), out.ptr<double>(0)[0]);
+        }
+        else {
+            displayImageRow(it->first.c_str(), 1, &out);
+        }
+    }
 }
 
 /*****      Isolate objects     *******/
 /**
- * Draw rectangles onto \p dst representing bounding boxes.
- * Return each isolated but unidentified object in an array of objs.
+ * Add each isolated but unidentified object to \p objs, which is cleared
+ * first.  Unless \p dst is NULL, it is set to a copy of \p src with
+ * rectangles representing bounding boxes drawn onto it, and shown.
+ *
+ * @return Number of objects.
  */
-int isolate_objects(const Mat &src, Mat &dst, Mat obj[99])
+int isolate_objects(const Mat &src, Mat *dst, ObjectTable &objs)
 {
-    dst = src.clone();
-    Mat tmp = src.clone();
+    PERF_SCOPE("isolate_objects", src.total());
+    if (dst) *dst = src.clone();
 
-    int num_objs = 0;
-    int i = 0;
-    struct rect r;
-    do {
-        r = extractObject(tmp, dst);        // extractObject  modifies tmp
-        obj[i] = src(Range(r.top, r.bottom), Range(r.left, r.right));
-        i++;
-    } while(r.top != r.bottom && r.left != r.bottom);
+    isolateObjects(src, dst, objs);
+    ILOG("Found %d objects.", objs.size());
 
-    ILOG("Found %d objects.", i);
-    num_objs = i;
+    if (!dst) return objs.size();
 
-    displayImageRow("obj", 5, &obj[0], &obj[1], &obj[2], &obj[3], &obj[4]);
-    displayImageRow("annotated src", 1, &dst);
+    if (DISP) {
+        Mat obj[5];
+        for (int i = 0; i < 5 && i < objs.size(); i++) {
+            obj[i] = src(Range(objs.top[i], objs.bottom[i]),
+                    Range(objs.left[i], objs.right[i]));
+        }
+        displayImageRow("obj", 5, &obj[0], &obj[1], &obj[2], &obj[3],
+                &obj[4]);
+    }
+    displayImageRow("annotated src", 1, dst);
+
+    return objs.size();
+}
+
+/*****      Tiled components     *******/
+/**
+ * Connected components of the edges of \p src, a tile at a time.  Frames of a
+ * raw file are read from the mapping tile by tile.
+ */
+void tiled_components(const struct frame_file *frames, int frame,
+        const Mat &src, int tile)
+{
+    PERF_SCOPE("tiled_components", src.total());
+    std::vector<struct tile_component> comps;
+    int thresh = (int)edge_rule.value;
+
+    // Tiles are thresholded as they are read, before the whole histogram is
+    // known.
+    if (edge_rule.kind != THRESH_FIXED) {
+        WLOG("tiles take a fixed threshold, using %d", EDGE_THRESH);
+        thresh = EDGE_THRESH;
+    }
 
-    return num_objs;
+    int ret = (frames->base && frames->format == FRAME_RAW)
+        ? tiledComponents(frames, frame, tile, thresh, comps)
+        : tiledComponents(src, tile, thresh, comps);
+    if (ret) return;
+
+    // The largest few are enough to tell what was found.
+    std::vector<size_t> order(comps.size());
+    for (size_t k = 0; k < order.size(); k++) order[k] = k;
+    std::sort(order.begin(), order.end(), [&comps](size_t a, size_t b) {
+        return comps[a].area > comps[b].area;
+    });
+
+    for (size_t k = 0; k < order.size() && k < 10; k++) {
+        const struct tile_component &c = comps[order[k]];
+        ILOG("%8lu px at (%d, %d) - (%d, %d), centroid (%.1f, %.1f)",
+                (unsigned long)c.area, c.left, c.top, c.right, c.bottom,
+                c.cx, c.cy);
+    }
 }
 
 /*****      Image moments     *******/
 /**
- * Array of objects in obj, number of object num_objs.
- * Annotate source with calculated moment invariants over each object.
+ * Give \p m data of its own if another image, such as a pending check,
+ * shares it, so that drawing on it leaves the other alone.
+ */
+static void detach(Mat &m)
+{
+    if (m.u && m.u->refcount > 1) m = m.clone();
+}
+
+/**
+ * Features of object \p i of \p objs, whose pixels are \p obj and their
+ * orientation bins \p orient, if any.  Runs as a task, so only writes row
+ * \p i and its own \p scratch.
+ */
+static void object_features(const Mat &obj, const Mat &orient,
+        ObjectTable &objs, int i, bool verify, struct moment_scratch *scratch)
+{
+    PERF_SCOPE("object_features", obj.total());
+    // Ours.  Objects are binary, so work on their boundaries rather than
+    // their pixels.
+    struct _moment _m;
+    const int open = objectMoments(obj, _m, scratch);
+
+    objs.valid[i] = open >= 0;
+    if (!objs.valid[i]) return;
+
+    // OpenCV, in the background.  Outlines that do not close enclose
+    // nothing, and their edge pixels were described instead.
+    if (verify) {
+        if (open) shadow->verifyHu(obj, _m.hu);
+        else shadow->verifyContourHu(obj, _m.hu);
+    }
+
+    objs.setHu(i, _m.hu);
+    objs.area[i] = _m.m00 / WHITE;
+    objs.cx[i] = objs.left[i] + _m.m10 / _m.m00;
+    objs.cy[i] = objs.top[i] + _m.m01 / _m.m00;
+
+    if (orient.data) {
+        float hist[ORIENT_BINS];
+
+        orientDescriptor(obj, orient, hist);
+        objs.setOrient(i, hist);
+    }
+}
+
+#if DET_ORIENT_BINS != ORIENT_BINS
+#error "detection records hold the orientation histogram as it is"
+#endif
+
+/**
+ * Detection records of the objects of a frame.
  */
-void moment_invariants(Mat &src, Mat obj[99], int num_objs)
+static void feature_records(const ObjectTable &objs,
+        std::vector<struct det_object> &dst)
 {
-    double *hu_g = (double *)malloc(sizeof(double) * 7 * num_objs);
+    dst.clear();
+
+    for (int i = 0; i < objs.size(); i++) {
+        if (!objs.valid[i]) continue;
+
+        struct det_object d;
+
+        memset(&d, 0, sizeof(d));
+        d.top = objs.top[i];
+        d.left = objs.left[i];
+        d.bottom = objs.bottom[i];
+        d.right = objs.right[i];
+        d.area = objs.area[i];
+        d.cx = objs.cx[i];
+        d.cy = objs.cy[i];
+        objs.getHu(i, d.hu);
+        d.score = objs.score[i];
+        objs.getOrient(i, d.orient);
+        d.track_id = objs.track[i];
+        d.vx = objs.vx[i];
+        d.vy = objs.vy[i];
+        d.track_age = objs.track_age[i];
+
+        dst.push_back(d);
+    }
+}
+
+/**
+ * Append the objects of a frame to \p fp as detection records.
+ */
+static void write_records(FILE *fp, int frame_id, const ObjectTable &objs)
+{
+    std::vector<struct det_object> dst;
+
+    feature_records(objs, dst);
+    writeDetections(fp, frame_id, dst);
+}
+
+// Scratch of `describe_objects`, kept by callers that describe frame after
+// frame.
+struct describe_scratch {
+    std::vector<int> order;     // objects, largest first
+    std::vector<struct moment_scratch> moments;     // one per task
+};
+
+/**
+ * Describe each object of \p objs, whose pixels are in \p binary and their
+ * orientation bins in \p orient, if not empty, and score it against the
+ * reference shapes, or else the first object.
+ *
+ * Objects are described in parallel on \p pool, largest first, so that one
+ * large object does not hold up the end of the frame.  Objects smaller than
+ * `min_area` are then dropped.
+ *
+ * \p binary is at the resolution of \p plan; the geometry of the objects is
+ * scaled back to the frame before filtering.  Tasks not started when the
+ * deadline expires are skipped.
+ *
+ * @param scratch Order of the objects and scratch of their tasks.
+ * @return 0, or -1 if out of time.
+ */
+static int describe_objects(ThreadPool &pool, const Mat &binary,
+        const Mat &orient, ObjectTable &objs, const struct frame_plan &plan,
+        struct describe_scratch &scratch)
+{
+    const int num_objs = objs.size();
+    std::vector<int> &order = scratch.order;
+
+    order.resize(num_objs);
+    // Never shrunk, so each task keeps the scratch of the last frame.
+    if ((int)scratch.moments.size() < num_objs) {
+        scratch.moments.resize(num_objs);
+    }
     for (int i = 0; i < num_objs; i++) {
-        // Ours
-        _moment _m = imageMoments(obj[i]);
-
-        if (_m.m00 == 0) break;
-
-        // OpenCV
-        double hu[7];
-        Moments m = moments(obj[i], false);
-        HuMoments(m, hu);
-
-        for (int j = 0; j < 7; j++) {
-            hu_g[i * 7 + j] = hu[j];
-        }
-
-        /*
-        double *_hu = (double *)&_m.hu;
-        ILOG("Image moments");
-        ILOG("%10s %12s %12s", "", "OpenCV", "custom");
-        ILOG("%10s %12.0f %12.0f", "m00", m.m00, _m.m00);
-        ILOG("%10s %12.3f %12.3f", "xbar", m.m01 / m.m00, _m.m01 / _m.m00);
-        ILOG("%10s %12.3f %12.3f", "ybar", m.m10 / m.m00, _m.m10 / _m.m00);
-        ILOG("");
-
-        ILOG("central moments");
-        ILOG("%10s %12e %12e", "u02", m.mu02, _m.u02);
-        ILOG("%10s %12e %12e", "u03", m.mu03, _m.u03);
-        ILOG("%10s %12e %12e", "u11", m.mu11, _m.u11);
-        ILOG("%10s %12e %12e", "u12", m.mu12, _m.u12);
-        ILOG("%10s %12e %12e", "u21", m.mu21, _m.u21);
-        ILOG("%10s %12e %12e", "u20", m.mu20, _m.u20);
-        ILOG("%10s %12e %12e", "u30", m.mu30, _m.u30);
-        ILOG("");
-        */
-
-        /*
-        ILOG("normalized central moments");
-        ILOG("%10s %12.8f %12.8f", "n02", m.nu02, _m.n02);
-        ILOG("%10s %12.8f %12.8f", "n03", m.nu03, _m.n03);
-        ILOG("%10s %12.8f %12.8f", "n11", m.nu11, _m.n11);
-        ILOG("%10s %12.8f %12.8f", "n12", m.nu12, _m.n12);
-        ILOG("%10s %12.8f %12.8f", "n21", m.nu21, _m.n21);
-        ILOG("%10s %12.8f %12.8f", "n20", m.nu20, _m.n20);
-        ILOG("%10s %12.8f %12.8f", "n30", m.nu30, _m.n30);
-        ILOG("");
-
-        ILOG("Hu moments");
-        ILOG("%10s %12s %12s", "", "OpenCV", "custom");
-        for (int i = 0; i < 7; i++) {
-            ILOG("hu[%d] %+33.32f %+33.32f", i, hu[i], _hu[i]);
-        }
-        ILOG("");
-        */
-
-        unsigned int r = compareHu(&hu_g[0], &hu_g[7 * i]);
-
-        // For debug, write the calculated difference onto the source image.
-        // Locate obj within src image.
-        Point ofs;
-        Size parent_size;
-        obj[i].locateROI(parent_size, ofs);
-
-        // Write the number to the image, at the object.
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&objs](int a, int b) {
+        return (objs.bottom[a] - objs.top[a]) * (objs.right[a] - objs.left[a])
+            > (objs.bottom[b] - objs.top[b]) * (objs.right[b] - objs.left[b]);
+    });
+
+    parallelFor(pool, 0, num_objs, [&](int k) {
+        const int i = order[k];
+        if (pastDeadline(plan.deadline)) return;
+
+        const Range rows(objs.top[i], objs.bottom[i]);
+        const Range cols(objs.left[i], objs.right[i]);
+
+        object_features(binary(rows, cols),
+                orient.data ? orient(rows, cols) : Mat(), objs, i,
+                plan.verify, &scratch.moments[k]);
+    });
+    if (pastDeadline(plan.deadline)) return -1;
+
+    if (plan.scale > 1) {
+        objs.scale(plan.scale);
+    }
+
+    if (min_area > 0) {
+        objs.filterByArea(min_area);
+    }
+
+    if (shapes.base) {
+        for (int i = 0; i < objs.size(); i++) {
+            if (!objs.valid[i]) continue;
+
+            double hu[7];
+            objs.getHu(i, hu);
+            objs.shape[i] = matchShape(&shapes, hu, &objs.score[i]);
+
+            const struct shape_record *ref = shapeRecord(&shapes,
+                    objs.shape[i]);
+            if (ref) {
+                DLOG("object %d: %s (%u)", i, ref->label, objs.score[i]);
+            }
+        }
+    }
+    else if (objs.size() && objs.valid[0]) {
+        // All at once, as `compareHu` against the first object.
+        double ref[7];
+        objs.getHu(0, ref);
+        objs.huDistances(ref, objs.distance);
+
+        for (int i = 0; i < objs.size(); i++) {
+            objs.score[i] = (unsigned int)objs.distance[i];
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Objects of \p binary, with orientation bins \p orient, are in \p objs,
+ * reused from frame to frame.
+ * Annotate source with calculated moment invariants over each object, at full
+ * quality only.
+ *
+ * Objects are matched to the tracks of earlier frames.  Results go to
+ * \p objs, and to \p records when set.  A frame out of time has no records,
+ * and the tracks skip it.
+ *
+ * @return 0, or -1 if out of time.
+ */
+int moment_invariants(ThreadPool &pool, Mat &src, const Mat &binary,
+        const Mat &orient, ObjectTable &objs, int frame_id,
+        const struct frame_plan &plan)
+{
+    PERF_SCOPE("moment_invariants", src.total());
+    struct describe_scratch scratch;
+
+    if (describe_objects(pool, binary, orient, objs, plan, scratch)) return -1;
+
+    tracker->update(objs);
+
+    if (records) {
+        write_records(records, frame_id, objs);
+    }
+
+    if (plan.quality != QUALITY_FULL) return 0;
+
+    // A check against OpenCV may still read the source.
+    if (DISP && plan.verify) detach(src);
+
+    for (int i = 0; i < objs.size() && DISP; i++) {
+        if (!objs.valid[i]) continue;
+
+        const struct shape_record *ref = shapeRecord(&shapes, objs.shape[i]);
+
+        // For debug, write the calculated difference onto the source image,
+        // at the object, with its track and the name of the matching shape,
+        // in the color of the track.
         char buf[256];
-        sprintf(buf, "%d", r);
-        putText(src, buf, ofs, FONT_HERSHEY_PLAIN, 1, Scalar::all(255), 1);
+        if (ref) {
+            sprintf(buf, "#%u %s %d", objs.track[i], ref->label,
+                    objs.score[i]);
+        }
+        else {
+            sprintf(buf, "#%u %d", objs.track[i], objs.score[i]);
+        }
+
+        const Vec3b c = labelColor(objs.track[i]);
+        putText(src, buf, Point(objs.left[i], objs.top[i]),
+                FONT_HERSHEY_PLAIN, 1, Scalar(c[0], c[1], c[2]), 1);
     }
 
     displayImageRow("Hu moments", 1, &src);
+    return 0;
 }
 
 /**
@@ -224,76 +843,341 @@ void moment_invariants(Mat &src, Mat obj[99], int num_objs)
  *
  * \p src should be a binary image.
  */
-void connected_components(const Mat &src, Mat &dst)
+void connected_components(const Mat &src, Mat &dst, bool verify)
 {
-    Mat m_labels, m_labels_opencv;
-    Mat dst_opencv;
+    PERF_SCOPE("connected_components", src.total());
+    Mat m_labels;
     unsigned int  num_labels;
+    struct bit_mask bits;
+
+    thresholdBits(src, bits, BLACK);
+    num_labels = connectedComponentsLabelingBits(bits, m_labels);
+    ILOG("my labels %d", num_labels);
 
-    unsigned int opencv_labels = connectedComponents(src, m_labels_opencv);
-    unsigned int labels = connectedComponentsLabeling(src, m_labels);
+    // OpenCV, in the background
+    if (verify) shadow->verifyLabels(src, m_labels);
 
-    num_labels = (opencv_labels > labels) ? opencv_labels : labels;
-    ILOG("my labels %d", labels);
-    ILOG("opencv_labels %d", opencv_labels);
-    ILOG("num labels %d", num_labels);
+    // Colors are only for display.
+    if (!DISP) return;
 
     // Connected components labels objects 1, 2, 3, ...
     // which basically looks like black.
     //
-    // Paint them in different colors.
-    std::vector<Vec3b> colors(num_labels);
-    colors[0] = Vec3b(0, 0, 0); //background
-    for(unsigned int i = 1; i < num_labels; i++){
-        colors[i] = Vec3b( (rand()&255), (rand()&255), (rand()&255) );
+    // Paint them in different colors, the same for a label on every run.
+    std::vector<Vec3b> colors(num_labels + 1);
+    for (unsigned int i = 0; i < colors.size(); i++) {
+        colors[i] = labelColor(i);      // 0, the background, is black
     }
-    ILOG("num colors %lu", colors.size());
 
-    dst_opencv = Mat(src.size(), CV_8UC3);
     dst = Mat(src.size(), CV_8UC3);
 
-    for(int r = 0; r < dst.rows; r++){
-        for(int c = 0; c < dst.cols; c++){
-            uchar label = m_labels_opencv.at<int>(r, c);
-            Vec3b &pixel = dst_opencv.at<Vec3b>(r, c);
-            pixel = colors[label];
-         }
-     }
+    for (int i = 0; i < m_labels.rows; i++) {
+        const int *label = m_labels.ptr<int>(i);
+        Vec3b *p = dst.ptr<Vec3b>(i);
 
-    const int rows = m_labels.rows;
-    const int cols = m_labels.cols;
-
-    for (int i = 0; i < rows; i++) {
-        for (int j = 0; j < cols; j++) {
-            int idx = i * cols + j;
-            int rgb_idx = i * cols * 3 + j * 3;
-            uchar label = m_labels.data[idx];
-            dst.data[rgb_idx + 0] = colors[label].val[2];
-            dst.data[rgb_idx + 1] = colors[label].val[1];
-            dst.data[rgb_idx + 2] = colors[label].val[0];
+        for (int j = 0; j < m_labels.cols; j++) {
+            p[j] = colors[label[j]];
         }
     }
 
     ILOG("found %d num_labels", num_labels);
-    displayImageRow("connected components", 2, &dst_opencv, &dst);
+    displayImageRow("connected components", 1, &dst);
 }
 
+/*****      Batch     *******/
+/**
+ * Calculate moment invariants of \p src, frame \p index of a batch, within
+ * the budget of the governor and at the quality it picks.
+ */
+static void batch_frame(ThreadPool &pool, Mat &src, int index, Mat &dst,
+        ObjectTable &objs)
+{
+    PERF_SCOPE("batch_frame", src.total());
+    Mat m_thresh, m_orient;
+    Deadline deadline(governor->budget());
+    const struct frame_plan plan = plan_frame(deadline);
+
+    // Each image of a batch is seen once, so caching it would only evict.
+    bool late = front_end(NULL, pool, src, NULL, NULL, &m_thresh,
+            &m_orient, edge_rule, plan) != 0;
+
+    if (!late) {
+        // Annotation is for display, and only at full quality.
+        const bool annotate = DISP && plan.quality == QUALITY_FULL;
+
+        isolate_objects(m_thresh, annotate ? &dst : NULL, objs);
+        resetDisplayPosition();
+
+        late = moment_invariants(pool, src, m_thresh, m_orient, objs,
+                index, plan) != 0;
+        resetDisplayPosition();
+    }
+
+    frame_done(index, plan, late);
+}
+
+/**
+ * Calculate moment invariants of every image in \p paths, as the `m` command
+ * does.  Images are decoded ahead on their own threads while the current one
+ * is processed.  The frame id of each image is its position in \p paths.
+ *
+ * Each frame has the budget of the governor, from when it is decoded, and
+ * runs at the quality the governor picks.  The allocations of each frame
+ * are counted, decoding aside.
+ */
+void batch_detect(ThreadPool &pool,
+        const std::vector<std::string> &paths, int decoders, int ahead,
+        ObjectTable &objs)
+{
+    Prefetcher loader(paths, decoders, ahead);
+    Mat src, dst;
+    int index;
+
+    while (loader.next(src, index)) {
+        if (!src.data) {
+            WLOG("skipping %s", paths[index].c_str());
+            continue;
+        }
+
+        allocFrameBegin();
+        batch_frame(pool, src, index, dst, objs);
+        allocFrameEnd(index);
+    }
+
+    loader.report();
+}
+
+/*****      Daemon     *******/
+/**
+ * Release \p m if another image, such as a pending check, shares its data,
+ * so that writing into it again leaves the other alone.
+ */
+static void unshare(Mat &m)
+{
+    if (m.u && m.u->refcount > 1) m.release();
+}
+
+// Images and object table of a request, kept for later requests once done.
+struct detect_buffers {
+    Mat half;
+    Mat thresh;
+    Mat closed;                 // edges before closing, once swapped
+    Mat orient;
+    struct morph_scratch morph;
+    std::vector<uchar> rows;    // gray rows of the edge bands
+    struct bit_mask bits;       // objects left to isolate
+    ObjectTable objs;           // one arena, however many objects
+    struct describe_scratch describe;
+};
+
+// Buffers of requests done, for the next ones.  Not per thread, as a thread
+// waiting on its tasks may run another request meanwhile.
+static std::mutex idle_buffers_lock;
+static std::vector<std::unique_ptr<struct detect_buffers> > idle_buffers;
+
+static std::unique_ptr<struct detect_buffers> take_buffers()
+{
+    std::lock_guard<std::mutex> guard(idle_buffers_lock);
+
+    if (idle_buffers.empty()) {
+        return std::unique_ptr<struct detect_buffers>(new detect_buffers);
+    }
+
+    std::unique_ptr<struct detect_buffers> b = std::move(idle_buffers.back());
+    idle_buffers.pop_back();
+    return b;
+}
+
+static void give_buffers(std::unique_ptr<struct detect_buffers> b)
+{
+    std::lock_guard<std::mutex> guard(idle_buffers_lock);
+
+    idle_buffers.push_back(std::move(b));
+}
+
+/**
+ * Detection records of \p src, as the `m` command finds them but without
+ * annotation, display, the cache or records.  Safe to call from several
+ * threads at once.
+ *
+ * The images, the scratch of the closing and the object table of a request
+ * are kept for later ones, so once warm a request of the same size
+ * allocates nothing for them.
+ *
+ * Runs at the quality the governor picks, until \p deadline.
+ *
+ * @param frame_id  Request id, for the governor.
+ * @return 0, or -1 if out of time.
+ */
+int detect_frame(ThreadPool &pool, const Mat &src, int frame_id,
+        const Deadline &deadline, std::vector<struct det_object> &dst)
+{
+    PERF_SCOPE("detect_frame", src.total());
+    std::unique_ptr<struct detect_buffers> buffers = take_buffers();
+    Mat &m_thresh = buffers->thresh;
+    Mat &m_orient = buffers->orient;
+    ObjectTable &objs = buffers->objs;
+    const struct frame_plan plan = plan_frame(deadline);
+    Mat in;
+
+    unshare(buffers->half);
+    unshare(m_thresh);
+    unshare(buffers->closed);
+    unshare(m_orient);
+
+    // Not halved into `in`, which may share the data of a previous request.
+    if (plan.scale > 1) {
+        halveImage(src, buffers->half);
+        in = buffers->half;
+    }
+    else in = src;
+
+    bool late = streamEdges(in, m_thresh, edge_rule, &pool, &deadline,
+            &m_orient, &buffers->rows) < 0;
+
+    if (!late) {
+        close_edges(m_thresh, plan, &buffers->closed, &buffers->morph);
+
+        isolateObjects(m_thresh, NULL, objs, &buffers->bits);
+        late = describe_objects(pool, m_thresh, m_orient, objs, plan,
+                buffers->describe) != 0;
+    }
+    frame_done(frame_id, plan, late);
+
+    if (!late) feature_records(objs, dst);
+    give_buffers(std::move(buffers));
+
+    return late ? -1 : 0;
+}
+
+// Server to stop on SIGINT or SIGTERM.
+static DetectDaemon *server = NULL;
+
+static void stop_server(int sig)
+{
+    if (server) server->stop();
+}
 
 int main(int argc, char** argv )
 {
     Mat src;                    // Load source image.
     Mat dst;
-    Mat objs[99];
+    ObjectTable objs;           // objects of the current frame
+    struct frame_file frames;   // Mapped frames, for raw and y4m input.
+    int frame = 0;
+    size_t cache_mb = CACHE_MB;
+    const char *spill_dir = NULL;
+    const char *records_path = NULL;
+    const char *shapes_path = NULL;
+    const char *socket_path = NULL;
+    int num_threads = 0;
+    int decoders = 0;
+    int ahead = PREFETCH_AHEAD;
+    int tile = TILE_SIZE;
+    int shadow_rate = SHADOW_RATE;
+    double budget_ms = 0;
+    int alloc_warmup = -1;
+    int opt;
 
     // Check args
-    if (argc != 2) {
-        ILOG("usage: DisplayImage.out <Image_Path>");
+    while ((opt = getopt(argc, argv,
+                    "a:A:c:C:d:D:j:J:L:M:o:Pr:S:t:T:v:")) != -1) {
+        switch (opt) {
+            case 'a': alloc_warmup = atoi(optarg); break;
+            case 'A': min_area = atof(optarg); break;
+            case 'c': cache_mb = atoi(optarg); break;
+            case 'C': spill_dir = optarg; break;
+            case 'd': shapes_path = optarg; break;
+            case 'D': budget_ms = atof(optarg); break;
+            case 'j': num_threads = atoi(optarg); break;
+            case 'J': decoders = atoi(optarg); break;
+            case 'L': ahead = atoi(optarg); break;
+            case 'M':
+                if (sscanf(optarg, "%dx%d", &close_w, &close_h) == 1) {
+                    close_h = close_w;
+                }
+                if (close_w < 1 || close_h < 1) optind = argc + 1;
+                break;
+            case 'o': setDisplayDir(optarg); break;
+            case 'P': setProfiling(true); break;
+            case 'r': records_path = optarg; break;
+            case 'S': socket_path = optarg; break;
+            case 't':
+                if (parseThreshRule(optarg, edge_rule)) optind = argc + 1;
+                break;
+            case 'T': tile = atoi(optarg); break;
+            case 'v': shadow_rate = atoi(optarg); break;
+            default: optind = argc + 1; break;
+        }
+    }
+    if (optind > argc || (argc - optind < 1 && !socket_path)) {
+        ILOG("usage: DisplayImage.out [-a warmup] [-A min_area] "
+                "[-c cache_mb] [-C spill_dir] [-d shapes] [-D budget_ms] "
+                "[-j threads] [-J decoders] [-L ahead] "
+                "[-M close_w[xclose_h]] [-o display_dir] [-P] [-r records] "
+                "[-S socket] [-t thresh|otsu|p<pct>] [-T tile] "
+                "[-v verify_rate] <Image_Path>...");
+        ILOG("       DisplayImage.out -S socket [options]");
+        return -1;
+    }
+    // Several images, or requests on a socket, are processed in turn rather
+    // than interactively.
+    const bool batch = argc - optind != 1 || socket_path;
+    const char *path = batch ? NULL : argv[optind];
+
+    startAllocTracking();
+    if (alloc_warmup >= 0) setAllocCheck(alloc_warmup);
+
+    StageCache cache(cache_mb << 20, spill_dir);
+    ThreadPool pool(num_threads);
+    ShadowVerifier verifier(shadow_rate);
+    shadow = &verifier;
+    FrameGovernor frame_governor(budget_ms);
+    governor = &frame_governor;
+    Tracker frame_tracker;
+    tracker = &frame_tracker;
+
+    if (records_path && !(records = fopen(records_path, "ab"))) {
+        ELOG("cannot open %s", records_path);
+        return -1;
+    }
+    if (shapes_path && openShapeDb(shapes_path, &shapes)) {
         return -1;
     }
 
-    // Load image
-    src = imread(argv[1], CV_LOAD_IMAGE_COLOR);
-    if (!src.data) {
+    frames.base = NULL;
+    if (socket_path) {
+        DetectDaemon daemon(pool, [&pool](const Mat &src, uint32_t id,
+                    const Deadline &deadline,
+                    std::vector<struct det_object> &dst) {
+                return detect_frame(pool, src, id, deadline, dst);
+            }, budget_ms);
+
+        server = &daemon;
+        signal(SIGINT, stop_server);
+        signal(SIGTERM, stop_server);
+
+        daemon.serve(socket_path);
+        daemon.report();
+        server = NULL;
+    }
+    else if (batch) {
+        std::vector<std::string> paths(argv + optind, argv + argc);
+
+        batch_detect(pool, paths, decoders, ahead, objs);
+    }
+    // Load image.  Pre-decoded frames are mapped rather than decoded.
+    else if (isFrameFile(path)) {
+        if (openFrameFile(path, &frames)
+                || readFrameBGR(&frames, frame, src)) {
+            ELOG("No image data.");
+            return -1;
+        }
+    }
+    else {
+        src = imread(path, CV_LOAD_IMAGE_COLOR);
+    }
+    if (!batch && !src.data) {
         ELOG("No image data.");
         return -1;
     }
@@ -301,62 +1185,79 @@ int main(int argc, char** argv )
 
     // Parse args and perform functions as requested.
     char buf[256];
-    for (;;) {
+    while (!batch) {
         printf("Enter command:\n");
         scanf("%256s", buf);
 
         if (buf[0] == 'c') {
-            Mat m_gray, m_sobel, m_thresh;
+            Mat m_thresh;
+            const struct frame_plan plan = full_plan();
 
-            convert_to_grayscale(src, m_gray);
-            resetDisplayPosition();
+            front_end(&cache, pool, src, NULL, NULL, &m_thresh, NULL,
+                    edge_rule, plan);
 
-            sobel(m_gray, m_sobel);
-            threshold(m_sobel, m_thresh, 150, 255, THRESH_BINARY);
-            resetDisplayPosition();
+            connected_components(m_thresh, dst, plan.verify);
+        }
+        else if (buf[0] == 'l') {
+            char path[256];
 
-            connected_components(m_thresh, dst);
+            printf("Color rules:\n");
+            if (scanf("%255s", path) == 1) {
+                classify_colors(path, src);
+            }
         }
         else if (buf[0] == 'i') {
             isolate_color(src);
         }
         else if (buf[0] == 'g') {
-            convert_to_grayscale(src, dst);
+            convert_to_grayscale(src, dst, shadow->sampleFrame());
         }
         else if (buf[0] == 'm') {
-            Mat m_gray, m_sobel, m_thresh;
+            Mat m_thresh, m_orient;
+            const struct frame_plan plan = full_plan();
 
-            convert_to_grayscale(src, m_gray);
-            resetDisplayPosition();
-
-            sobel(m_gray, m_sobel);
-            threshold(m_sobel, m_thresh, 150, 255, THRESH_BINARY);
-            resetDisplayPosition();
+            allocFrameBegin();
+            front_end(&cache, pool, src, NULL, NULL, &m_thresh, &m_orient,
+                    edge_rule, plan);
 
-            int num_objs = isolate_objects(m_thresh, dst, objs);
+            isolate_objects(m_thresh, &dst, objs);
             resetDisplayPosition();
 
-            moment_invariants(src, objs, num_objs);
+            moment_invariants(pool, src, m_thresh, m_orient, objs, frame,
+                    plan);
+            allocFrameEnd(frame);
         }
         else if (buf[0] == 'o') {
-            Mat m_gray, m_sobel, m_thresh;
+            Mat m_thresh;
 
-            convert_to_grayscale(src, m_gray);
-            resetDisplayPosition();
-
-            sobel(m_gray, m_sobel);
-            threshold(m_sobel, m_thresh, 150, 255, THRESH_BINARY);
-            resetDisplayPosition();
+            front_end(&cache, pool, src, NULL, NULL, &m_thresh, NULL,
+                    edge_rule, full_plan());
 
-            isolate_objects(m_thresh, dst, objs);
+            isolate_objects(m_thresh, &dst, objs);
         }
         else if (buf[0] == 's') {
-            Mat m_gray;
-
-            convert_to_grayscale(src, m_gray);
-            resetDisplayPosition();
+            front_end(&cache, pool, src, NULL, &dst, NULL, NULL, edge_rule,
+                    full_plan());
+        }
+        else if (buf[0] == 't') {
+            tiled_components(&frames, frame, src, tile);
+        }
+        else if (buf[0] == 'n') {
+            if (!frames.base || readFrameBGR(&frames, frame + 1, src)) {
+                WLOG("No next frame.");
+            }
+            else {
+                frame++;
+                ILOG("frame %d", frame);
+            }
+        }
+        else if (buf[0] == 'p') {
+            char path[256];
 
-            sobel(m_gray, dst);
+            printf("Pipeline description:\n");
+            if (scanf("%255s", path) == 1) {
+                run_pipeline(pool, path, src);
+            }
         }
         else if (buf[0] == 'q') {
             break;
@@ -366,12 +1267,28 @@ int main(int argc, char** argv )
                 ILOG("    c: Find connected components.");
                 ILOG("    i: Isolate color, with threshold trackbar.");
                 ILOG("    g: Convert color to grayscale.");
+                ILOG("    l: Classify colors, e.g. colors/markers.txt.");
                 ILOG("    m: Calculate moment invariants.  Annotates source.");
+                ILOG("    n: Next frame of a raw or y4m input.");
+                ILOG("    p: Run a pipeline description, "
+                        "e.g. pipelines/sobel.txt.");
                 ILOG("    o: Isolate objects.  Draws bounding boxes.");
                 ILOG("    s: Apply Sobel operator.");
+                ILOG("    t: Find connected components of edges, by tiles.");
         }
         resetDisplayPosition();
     }
 
-    return 0;
+    cache.report();
+    verifier.report();
+    frame_governor.report();
+    frame_tracker.report();
+    displaySink().report();
+    reportProfile();
+    reportAllocs();
+    if (records) fclose(records);
+    if (shapes.base) closeShapeDb(&shapes);
+    if (frames.base) closeFrameFile(&frames);
+
+    return allocCheckFailures() ? 1 : 0;
 }
@@ -0,0 +1,370 @@
+/**
+ * Morphology with rectangular structuring elements.
+ *
+ * @file morph.cpp
+ * @author Emily Ng
+ * @date Apr 16 2016
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <vector>
+
+#include "morph.h"
+
+#define WORD_BITS 64
+
+/**
+ * Operation named \p name: erode, dilate, open or close.
+ *
+ * @return One of MORPH_OP_*, or -1 if there is none by that name.
+ */
+int morphOpByName(const char *name)
+{
+    static const char *names[] = { "erode", "dilate", "open", "close" };
+
+    for (int op = 0; op < 4; op++) {
+        if (!strcmp(name, names[op])) return op;
+    }
+    return -1;
+}
+
+template<bool MAX>
+static inline uchar pick(uchar a, uchar b)
+{
+    return MAX ? ((a > b) ? a : b) : ((a < b) ? a : b);
+}
+
+/**
+ * d[j] = pick(a[j], b[j]).  The loop vectorizes to one min or max per 16
+ * pixels.
+ */
+template<bool MAX>
+static void pickRow(const uchar *a, const uchar *b, uchar *d, int n)
+{
+    for (int j = 0; j < n; j++) {
+        d[j] = pick<MAX>(a[j], b[j]);
+    }
+}
+
+/**
+ * Running minimum or maximum over a window of \p w pixels of one row.
+ *
+ * @param pad   Scratch, at least cols + 2 * w.
+ * @param g     Scratch, as \p pad.
+ * @param h     Scratch, as \p pad.
+ */
+template<bool MAX>
+static void windowRow(const uchar *src, uchar *dst, int cols, int w,
+        uchar *pad, uchar *g, uchar *h)
+{
+    const uchar neutral = MAX ? BLACK : WHITE;
+    const int a = w / 2;
+    const int len = (cols + w - 1 + w - 1) / w * w;
+
+    // Window at x covers pad[x .. x + w - 1], i.e. src[x - a .. x - a + w - 1].
+    memset(pad, neutral, len);
+    memcpy(pad + a, src, cols);
+
+    for (int b = 0; b < len; b += w) {
+        g[b] = pad[b];
+        for (int i = b + 1; i < b + w; i++) {
+            g[i] = pick<MAX>(g[i - 1], pad[i]);
+        }
+
+        h[b + w - 1] = pad[b + w - 1];
+        for (int i = b + w - 2; i >= b; i--) {
+            h[i] = pick<MAX>(h[i + 1], pad[i]);
+        }
+    }
+
+    pickRow<MAX>(h, g + w - 1, dst, cols);
+}
+
+/**
+ * Erosion (MAX false) or dilation (MAX true) of an 8-bit image.  \p dst is
+ * written in place when it already has the size, so it must not be \p src.
+ */
+template<bool MAX>
+static void minMaxRect(const Mat &src, Mat &dst, int w, int h,
+        struct morph_scratch &s)
+{
+    const int rows = src.rows;
+    const int cols = src.cols;
+    const uchar neutral = MAX ? BLACK : WHITE;
+
+    // Pass over rows, straight into dst when there is no pass over columns.
+    Mat &tmp = (h == 1) ? dst : s.rows;
+    tmp.create(rows, cols, CV_8U);
+    s.line.resize(3 * (cols + 2 * w));
+    uchar *pad = &s.line[0];
+    uchar *g = pad + cols + 2 * w;
+    uchar *hh = g + cols + 2 * w;
+
+    for (int i = 0; i < rows; i++) {
+        if (w == 1) {
+            memcpy(tmp.ptr(i), src.ptr(i), cols);
+        }
+        else {
+            windowRow<MAX>(src.ptr(i), tmp.ptr(i), cols, w, pad, g, hh);
+        }
+    }
+
+    if (h == 1) {
+        return;
+    }
+
+    // Pass over columns, a whole row at a time.  Padded row i is row i - b of
+    // the image.
+    const int b = h / 2;
+    const int len = (rows + h - 1 + h - 1) / h * h;
+    s.edge.assign(cols, neutral);
+    s.g.create(len, cols, CV_8U);
+    s.h.create(len, cols, CV_8U);
+    Mat &G = s.g;
+    Mat &H = s.h;
+
+    for (int i = 0; i < len; i++) {
+        const uchar *p = (i - b >= 0 && i - b < rows) ? tmp.ptr(i - b)
+            : &s.edge[0];
+
+        if (i % h == 0) memcpy(G.ptr(i), p, cols);
+        else pickRow<MAX>(G.ptr(i - 1), p, G.ptr(i), cols);
+    }
+    for (int i = len - 1; i >= 0; i--) {
+        const uchar *p = (i - b >= 0 && i - b < rows) ? tmp.ptr(i - b)
+            : &s.edge[0];
+
+        if (i % h == h - 1) memcpy(H.ptr(i), p, cols);
+        else pickRow<MAX>(H.ptr(i + 1), p, H.ptr(i), cols);
+    }
+
+    dst.create(rows, cols, CV_8U);
+    for (int i = 0; i < rows; i++) {
+        pickRow<MAX>(H.ptr(i), G.ptr(i + h - 1), dst.ptr(i), cols);
+    }
+}
+
+/**
+ * Erode, dilate, open or close an 8-bit image by a \p w x \p h rectangle.
+ *
+ * Without \p scratch, \p dst is always a new image, so \p src may be shared,
+ * e.g. with a cache.  With it, the buffers of \p scratch and \p dst are
+ * reused when the size allows, and \p dst must be neither \p src nor shared.
+ *
+ * @param src       Grayscale or binary image.
+ * @param dst       Result.
+ * @param op        One of MORPH_OP_*.
+ * @param w         Width of the rectangle, at least 1.
+ * @param h         Height of the rectangle, at least 1.
+ * @param scratch   Buffers kept between calls, or NULL.
+ */
+void morphRect(const Mat &src, Mat &dst, int op, int w, int h,
+        struct morph_scratch *scratch)
+{
+    PERF_SCOPE("morphRect", src.total());
+    assert(src.type() == CV_8UC1);
+    assert(w >= 1 && h >= 1);
+
+    struct morph_scratch local;
+    struct morph_scratch &s = scratch ? *scratch : local;
+    Mat out;
+    Mat &res = scratch ? dst : out;
+
+    switch (op) {
+        case MORPH_OP_ERODE:
+            minMaxRect<false>(src, res, w, h, s);
+            break;
+        case MORPH_OP_DILATE:
+            minMaxRect<true>(src, res, w, h, s);
+            break;
+        case MORPH_OP_OPEN:
+            minMaxRect<false>(src, s.between, w, h, s);
+            minMaxRect<true>(s.between, res, w, h, s);
+            break;
+        case MORPH_OP_CLOSE:
+            minMaxRect<true>(src, s.between, w, h, s);
+            minMaxRect<false>(s.between, res, w, h, s);
+            break;
+        default:
+            assert(0);
+    }
+
+    if (!scratch) dst = out;
+}
+
+/**
+ * dst[x] = src[x + s] over the columns of a row of \p words words, with
+ * zeros shifted in.
+ */
+static void shiftCols(const uint64_t *src, uint64_t *dst, int words, int s)
+{
+    const int q = (s >= 0 ? s : -s) / WORD_BITS;
+    const int r = (s >= 0 ? s : -s) % WORD_BITS;
+
+    for (int k = 0; k < words; k++) {
+        uint64_t x = 0;
+
+        if (s >= 0) {
+            if (k + q < words) x = src[k + q] >> r;
+            if (r && k + q + 1 < words) x |= src[k + q + 1] << (WORD_BITS - r);
+        }
+        else {
+            if (k - q >= 0) x = src[k - q] << r;
+            if (r && k - q - 1 >= 0) x |= src[k - q - 1] >> (WORD_BITS - r);
+        }
+        dst[k] = x;
+    }
+}
+
+/**
+ * Clear the bits past the last column, which shifts may have set.
+ */
+static void clearPadding(struct bit_mask &mask)
+{
+    const int r = mask.cols % WORD_BITS;
+    if (!r) return;
+
+    const uint64_t keep = ((uint64_t)1 << r) - 1;
+    for (int i = 0; i < mask.rows; i++) {
+        mask.row(i)[mask.words - 1] &= keep;
+    }
+}
+
+/**
+ * Dilation of a bit-packed mask.  Erosion is dilation of the complement.
+ */
+static void dilateBits(const struct bit_mask &src, struct bit_mask &dst,
+        int w, int h)
+{
+    const int rows = src.rows;
+    const int words = src.words;
+    struct bit_mask tmp;
+
+    createBitMask(tmp, rows, src.cols);
+
+    // Pass over rows: move the window to start at x, then OR over windows of
+    // doubling width, k pixels wide after each step, and once more to make up
+    // w.  The row is widened so that nothing moved right is lost.
+    const int a = w / 2;
+    const int wide = words + (w + WORD_BITS - 1) / WORD_BITS;
+    std::vector<uint64_t> cur(wide), shifted(wide);
+
+    for (int i = 0; i < rows; i++) {
+        memcpy(&shifted[0], src.row(i), words * sizeof(uint64_t));
+        memset(&shifted[words], 0, (wide - words) * sizeof(uint64_t));
+        shiftCols(&shifted[0], &cur[0], wide, -a);
+
+        int k = 1;
+        for (; 2 * k <= w; k *= 2) {
+            shiftCols(&cur[0], &shifted[0], wide, k);
+            for (int j = 0; j < wide; j++) cur[j] |= shifted[j];
+        }
+        if (k < w) {
+            shiftCols(&cur[0], &shifted[0], wide, w - k);
+            for (int j = 0; j < wide; j++) cur[j] |= shifted[j];
+        }
+
+        memcpy(tmp.row(i), &cur[0], words * sizeof(uint64_t));
+    }
+    clearPadding(tmp);
+
+    if (h == 1) {
+        dst = tmp;
+        return;
+    }
+
+    // Pass over columns, as for 8-bit images, 64 pixels per operation.
+    const int b = h / 2;
+    const int len = (rows + h - 1 + h - 1) / h * h;
+    std::vector<uint64_t> edge(words, 0);
+    std::vector<uint64_t> G((size_t)len * words), H((size_t)len * words);
+
+    for (int i = 0; i < len; i++) {
+        const uint64_t *p = (i - b >= 0 && i - b < rows) ? tmp.row(i - b)
+            : &edge[0];
+        uint64_t *g = &G[(size_t)i * words];
+
+        for (int j = 0; j < words; j++) {
+            g[j] = (i % h == 0) ? p[j] : (g[j - words] | p[j]);
+        }
+    }
+    for (int i = len - 1; i >= 0; i--) {
+        const uint64_t *p = (i - b >= 0 && i - b < rows) ? tmp.row(i - b)
+            : &edge[0];
+        uint64_t *hh = &H[(size_t)i * words];
+
+        for (int j = 0; j < words; j++) {
+            hh[j] = (i % h == h - 1) ? p[j] : (hh[j + words] | p[j]);
+        }
+    }
+
+    createBitMask(dst, rows, src.cols);
+    for (int i = 0; i < rows; i++) {
+        const uint64_t *hh = &H[(size_t)i * words];
+        const uint64_t *g = &G[(size_t)(i + h - 1) * words];
+        uint64_t *d = dst.row(i);
+
+        for (int j = 0; j < words; j++) {
+            d[j] = hh[j] | g[j];
+        }
+    }
+}
+
+static void invertBits(struct bit_mask &mask)
+{
+    for (size_t k = 0; k < mask.bits.size(); k++) {
+        mask.bits[k] = ~mask.bits[k];
+    }
+    clearPadding(mask);
+}
+
+static void erodeBits(const struct bit_mask &src, struct bit_mask &dst,
+        int w, int h)
+{
+    struct bit_mask inv = src;
+
+    // Outside the image counts as set, so its complement stays clear.
+    invertBits(inv);
+    dilateBits(inv, dst, w, h);
+    invertBits(dst);
+}
+
+/**
+ * `morphRect` on a bit-packed mask.
+ *
+ * @param src   Mask.
+ * @param dst   Result.  May be \p src.
+ */
+void morphRectBits(const struct bit_mask &src, struct bit_mask &dst, int op,
+        int w, int h)
+{
+    PERF_SCOPE("morphRectBits", (double)src.rows * src.cols);
+    assert(w >= 1 && h >= 1);
+
+    struct bit_mask tmp;
+
+    switch (op) {
+        case MORPH_OP_ERODE:
+            erodeBits(src, tmp, w, h);
+            break;
+        case MORPH_OP_DILATE:
+            dilateBits(src, tmp, w, h);
+            break;
+        case MORPH_OP_OPEN:
+            erodeBits(src, tmp, w, h);
+            dilateBits(tmp, tmp, w, h);
+            break;
+        case MORPH_OP_CLOSE:
+            dilateBits(src, tmp, w, h);
+            erodeBits(tmp, tmp, w, h);
+            break;
+        default:
+            assert(0);
+    }
+
+    dst.rows = tmp.rows;
+    dst.cols = tmp.cols;
+    dst.words = tmp.words;
+    dst.bits.swap(tmp.bits);
+}
@@ -0,0 +1,58 @@
+/**
+ * Morphology with rectangular structuring elements.
+ *
+ * Erosion and dilation by a w x h rectangle are separable into a pass over
+ * rows and a pass over columns, each a running minimum or maximum over a
+ * window.  Both use the van Herk/Gil-Werman algorithm: the line is cut into
+ * blocks of the window length, and the window at x is the maximum of a
+ * suffix of one block and a prefix of the next, both computed once.  That is
+ * three comparisons per pixel per pass whatever the size of the window.
+ *
+ * The pass over columns works on whole rows at a time, so the compiler
+ * vectorizes it.  On bit-packed masks it works on 64 pixels per word.  The
+ * pass over rows of a bit-packed mask uses shifted words instead, which is
+ * log2(w) word operations per 64 pixels.
+ *
+ * The anchor is the centre of the element, and pixels outside the image
+ * never win, as for OpenCV's `morphologyEx`.
+ *
+ * @file morph.h
+ * @author Emily Ng
+ * @date Apr 16 2016
+ */
+
+#ifndef __MORPH_H
+#define __MORPH_H
+
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "bitmask.h"
+#include "debug.h"
+
+using namespace cv;
+
+// Operations, numbered as OpenCV's MORPH_ERODE ... MORPH_CLOSE.
+#define MORPH_OP_ERODE 0
+#define MORPH_OP_DILATE 1
+#define MORPH_OP_OPEN 2
+#define MORPH_OP_CLOSE 3
+
+// Scratch of `morphRect`, kept by callers that close image after image of
+// the same size, so that the buffers are reused.
+struct morph_scratch {
+    Mat between;                // between the passes of an open or close
+    Mat rows;                   // after the pass over rows
+    Mat g;                      // prefixes of the pass over columns
+    Mat h;                      // suffixes
+    std::vector<uchar> line;    // padded row, and its prefixes and suffixes
+    std::vector<uchar> edge;    // row outside the image
+};
+
+int morphOpByName(const char *name);
+void morphRect(const Mat &src, Mat &dst, int op, int w, int h,
+        struct morph_scratch *scratch = NULL);
+void morphRectBits(const struct bit_mask &src, struct bit_mask &dst, int op,
+        int w, int h);
+
+#endif
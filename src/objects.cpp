@@ -0,0 +1,316 @@
+/**
+ * Table of the objects found in a frame.
+ *
+ * @file objects.cpp
+ * @author Emily Ng
+ * @date Apr 20 2016
+ */
+
+#include <assert.h>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitmask.h"
+#include "objects.h"
+
+// Columns of the table.
+#define OBJ_COLUMNS (22 + ORIENT_BINS)
+
+// Alignment of each column, a cache line.
+#define OBJ_ALIGN 64
+
+static size_t alignUp(size_t n)
+{
+    return (n + OBJ_ALIGN - 1) & ~(size_t)(OBJ_ALIGN - 1);
+}
+
+/**
+ * @param capacity  Objects held before the arena first grows.
+ */
+ObjectTable::ObjectTable(int capacity)
+    : arena(NULL), n(0), cap(0)
+{
+    struct column cols[OBJ_COLUMNS];
+    const int num = columns(cols);
+
+    for (int c = 0; c < num; c++) {
+        *cols[c].ptr = NULL;
+    }
+    grow((capacity > 0) ? capacity : 1);
+}
+
+ObjectTable::~ObjectTable()
+{
+    free(arena);
+}
+
+/**
+ * Every column, and the size of its entries.
+ */
+int ObjectTable::columns(struct column *dst)
+{
+    int c = 0;
+
+    dst[c].ptr = (void **)&top;         dst[c++].size = sizeof(*top);
+    dst[c].ptr = (void **)&left;        dst[c++].size = sizeof(*left);
+    dst[c].ptr = (void **)&bottom;      dst[c++].size = sizeof(*bottom);
+    dst[c].ptr = (void **)&right;       dst[c++].size = sizeof(*right);
+    dst[c].ptr = (void **)&valid;       dst[c++].size = sizeof(*valid);
+    dst[c].ptr = (void **)&area;        dst[c++].size = sizeof(*area);
+    dst[c].ptr = (void **)&cx;          dst[c++].size = sizeof(*cx);
+    dst[c].ptr = (void **)&cy;          dst[c++].size = sizeof(*cy);
+    for (int k = 0; k < 7; k++) {
+        dst[c].ptr = (void **)&hu[k];   dst[c++].size = sizeof(*hu[k]);
+    }
+    for (int k = 0; k < ORIENT_BINS; k++) {
+        dst[c].ptr = (void **)&orient[k];
+        dst[c++].size = sizeof(*orient[k]);
+    }
+    dst[c].ptr = (void **)&distance;    dst[c++].size = sizeof(*distance);
+    dst[c].ptr = (void **)&score;       dst[c++].size = sizeof(*score);
+    dst[c].ptr = (void **)&shape;       dst[c++].size = sizeof(*shape);
+    dst[c].ptr = (void **)&track;       dst[c++].size = sizeof(*track);
+    dst[c].ptr = (void **)&vx;          dst[c++].size = sizeof(*vx);
+    dst[c].ptr = (void **)&vy;          dst[c++].size = sizeof(*vy);
+    dst[c].ptr = (void **)&track_age;   dst[c++].size = sizeof(*track_age);
+
+    assert(c == OBJ_COLUMNS);
+    return c;
+}
+
+/**
+ * Move the columns to a new arena with room for \p capacity objects.
+ */
+void ObjectTable::grow(int capacity)
+{
+    struct column cols[OBJ_COLUMNS];
+    const int num = columns(cols);
+
+    size_t total = 0;
+    for (int c = 0; c < num; c++) {
+        total += alignUp(cols[c].size * capacity);
+    }
+
+    void *p;
+    if (posix_memalign(&p, OBJ_ALIGN, total)) {
+        throw std::bad_alloc();
+    }
+
+    uint8_t *next = (uint8_t *)p;
+    for (int c = 0; c < num; c++) {
+        if (n) memcpy(next, *cols[c].ptr, cols[c].size * n);
+        *cols[c].ptr = next;
+        next += alignUp(cols[c].size * capacity);
+    }
+
+    free(arena);
+    arena = (uint8_t *)p;
+    cap = capacity;
+}
+
+/**
+ * Add an object with bounding box \p top, \p left, \p bottom, \p right and
+ * nothing else known about it yet.
+ *
+ * @return Index of the object.
+ */
+int ObjectTable::add(int top, int left, int bottom, int right)
+{
+    if (n == cap) grow(2 * cap);
+
+    const int i = n++;
+
+    this->top[i] = top;
+    this->left[i] = left;
+    this->bottom[i] = bottom;
+    this->right[i] = right;
+    valid[i] = 0;
+    area[i] = 0;
+    cx[i] = 0;
+    cy[i] = 0;
+    for (int k = 0; k < 7; k++) {
+        hu[k][i] = 0;
+    }
+    for (int k = 0; k < ORIENT_BINS; k++) {
+        orient[k][i] = 0;
+    }
+    distance[i] = 0;
+    score[i] = 0;
+    shape[i] = -1;
+    track[i] = 0;
+    vx[i] = 0;
+    vy[i] = 0;
+    track_age[i] = 0;
+
+    return i;
+}
+
+/**
+ * Gather the Hu moments of object \p i.
+ */
+void ObjectTable::getHu(int i, double dst[7]) const
+{
+    for (int k = 0; k < 7; k++) {
+        dst[k] = hu[k][i];
+    }
+}
+
+void ObjectTable::setHu(int i, const double src[7])
+{
+    for (int k = 0; k < 7; k++) {
+        hu[k][i] = src[k];
+    }
+}
+
+/**
+ * Gather the orientation histogram of object \p i.
+ */
+void ObjectTable::getOrient(int i, float dst[ORIENT_BINS]) const
+{
+    for (int k = 0; k < ORIENT_BINS; k++) {
+        dst[k] = orient[k][i];
+    }
+}
+
+void ObjectTable::setOrient(int i, const float src[ORIENT_BINS])
+{
+    for (int k = 0; k < ORIENT_BINS; k++) {
+        orient[k][i] = src[k];
+    }
+}
+
+/**
+ * Move entries of \p col whose object has at least \p min_area down over
+ * those that do not, keeping their order.  Without branches, so the loop
+ * costs the same whatever the objects.  \p col may be \p area itself, as
+ * entries are only written at or below the one being read.
+ */
+template<typename T>
+static int compact(T *col, const double *area, double min_area, int n)
+{
+    int j = 0;
+
+    for (int i = 0; i < n; i++) {
+        const bool keep = area[i] >= min_area;
+
+        col[j] = col[i];
+        j += keep;
+    }
+
+    return j;
+}
+
+/**
+ * Drop objects enclosing fewer than \p min_area pixels, keeping the order of
+ * the rest.  Done column by column, so each pass streams through one array.
+ *
+ * @return Objects left.
+ */
+int ObjectTable::filterByArea(double min_area)
+{
+    struct column cols[OBJ_COLUMNS];
+    const int num = columns(cols);
+    int kept = n;
+
+    // The area column decides, so it goes last.
+    for (int c = num - 1; c >= 0; c--) {
+        if (cols[c].ptr == (void **)&area) continue;
+
+        switch (cols[c].size) {
+            case 1:
+                kept = compact((uint8_t *)*cols[c].ptr, area, min_area, n);
+                break;
+            case 4:
+                kept = compact((uint32_t *)*cols[c].ptr, area, min_area, n);
+                break;
+            case 8:
+                kept = compact((uint64_t *)*cols[c].ptr, area, min_area, n);
+                break;
+            default:
+                assert(0);
+        }
+    }
+    kept = compact(area, area, min_area, n);
+
+    n = kept;
+    return n;
+}
+
+/**
+ * `huDistance` from \p ref to every object, into \p dst.
+ *
+ * The loop over objects is innermost and reads one column of moments, so it
+ * vectorizes.  Terms are summed in the order `huDistance` sums them, so the
+ * results are the same.
+ *
+ * @param ref   Reference moments.
+ * @param dst   `size` distances.
+ */
+void ObjectTable::huDistances(const double ref[7], double *dst) const
+{
+    for (int i = 0; i < n; i++) {
+        dst[i] = 0;
+    }
+
+    // As `huDistance`, the 7th moment is left out.
+    for (int k = 0; k < 6; k++) {
+        const double h1 = ref[k];
+        const double *h2 = hu[k];
+
+        for (int i = 0; i < n; i++) {
+            const double d = h2[i] - h1;
+            const double sq_diff = d * d / (h1 * h2[i]);
+
+            // Equal moments do not differ, even when both are 0.
+            dst[i] += (h1 == h2[i]) ? 0 : sq_diff * sq_diff;
+        }
+    }
+}
+
+/**
+ * Scale the geometry of every object by \p f, for objects found in an image
+ * \p f times smaller than the frame.  Bounding boxes and centroids scale by
+ * \p f, areas by \p f squared.  Hu moments do not change with scale.
+ */
+void ObjectTable::scale(int f)
+{
+    for (int i = 0; i < n; i++) {
+        top[i] *= f;
+        left[i] *= f;
+        bottom[i] *= f;
+        right[i] *= f;
+        area[i] *= f * f;
+        cx[i] *= f;
+        cy[i] *= f;
+    }
+}
+
+/**
+ * Add the bounding box of each object of \p src to \p objs, which is cleared
+ * first, in the order `extractObjectBits` finds them.
+ *
+ * @param src   Binary image.
+ * @param dst   Bounding corners drawn, or NULL.
+ * @param objs  Objects found.
+ * @param bits  Scratch kept between calls, or NULL.
+ * @return Number of objects.
+ */
+int isolateObjects(const Mat &src, Mat *dst, ObjectTable &objs,
+        struct bit_mask *bits)
+{
+    struct bit_mask local;
+    struct bit_mask &tmp = bits ? *bits : local;
+
+    thresholdBits(src, tmp, BLACK);
+
+    objs.clear();
+    for (;;) {
+        struct rect r = extractObjectBits(tmp, dst);    // modifies tmp
+        if (r.top == r.bottom) break;
+
+        objs.add(r.top, r.left, r.bottom, r.right);
+    }
+
+    return objs.size();
+}
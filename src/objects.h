@@ -0,0 +1,94 @@
+/**
+ * Table of the objects found in a frame.
+ *
+ * Objects are stored as a structure of arrays: one column per property, each
+ * aligned to a cache line.  Passes that look at one property of every object,
+ * such as filtering by area or comparing Hu moments with a reference, read
+ * only that column, and their loops vectorize.
+ *
+ * All columns live in one arena.  When the table is full the arena doubles
+ * and the columns are copied over, so adding an object never allocates on
+ * its own, and `clear` keeps the arena for the next frame.
+ *
+ * @file objects.h
+ * @author Emily Ng
+ * @date Apr 20 2016
+ */
+
+#ifndef __OBJECTS_H
+#define __OBJECTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <opencv2/core.hpp>
+
+#include "debug.h"
+#include "orient.h"
+
+using namespace cv;
+
+// Objects a table holds before its arena first grows.
+#define OBJ_TABLE_CAPACITY 64
+
+class ObjectTable {
+public:
+    ObjectTable(int capacity = OBJ_TABLE_CAPACITY);
+    ~ObjectTable();
+
+    int size() const { return n; }
+    int capacity() const { return cap; }
+    void clear() { n = 0; }
+
+    int add(int top, int left, int bottom, int right);
+    void getHu(int i, double dst[7]) const;
+    void setHu(int i, const double src[7]);
+    void getOrient(int i, float dst[ORIENT_BINS]) const;
+    void setOrient(int i, const float src[ORIENT_BINS]);
+
+    int filterByArea(double min_area);
+    void scale(int f);
+    void huDistances(const double ref[7], double *dst) const;
+
+    // Columns, `size` entries long.  `add` may move them.
+    int *top;                   // bounding box, bottom and right exclusive
+    int *left;
+    int *bottom;
+    int *right;
+    uint8_t *valid;             // 0 for an object with no outline
+    double *area;               // pixels enclosed
+    double *cx;                 // centroid, within the frame
+    double *cy;
+    double *hu[7];              // hu[k][i] is moment k of object i
+    float *orient[ORIENT_BINS]; // orientation histogram, see orient.h
+    double *distance;           // from the reference, unrounded
+    unsigned int *score;        // `compareHu` against the reference
+    int *shape;                 // matching reference shape, or -1
+    uint32_t *track;            // track id, or 0 if not tracked
+    double *vx;                 // velocity of the track, pixels per frame
+    double *vy;
+    uint32_t *track_age;        // frames the track has been followed
+
+private:
+    struct column {
+        void **ptr;
+        size_t size;            // bytes per entry
+    };
+
+    // Not copyable: the columns point into the arena.
+    ObjectTable(const ObjectTable &);
+    ObjectTable &operator=(const ObjectTable &);
+
+    int columns(struct column *dst);
+    void grow(int capacity);
+
+    uint8_t *arena;
+    int n;
+    int cap;
+};
+
+struct bit_mask;
+
+int isolateObjects(const Mat &src, Mat *dst, ObjectTable &objs,
+        struct bit_mask *bits = NULL);
+
+#endif
@@ -0,0 +1,94 @@
+/**
+ * Quantized gradient orientation, and histograms of it per object.
+ *
+ * @file orient.cpp
+ * @author Emily Ng
+ * @date Apr 24 2016
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "img_proc.h"
+#include "orient.h"
+#include "profile.h"
+
+/**
+ * Orientation bins of the Sobel gradient of \p gray, as the edge pass
+ * computes them.  Border pixels are 0.
+ *
+ * For when the gradient was found by `applyKernel`, which keeps only its
+ * absolute value.
+ *
+ * @param gray  Grayscale image.
+ * @param dst   Bin of each pixel, CV_8UC1.
+ */
+void orientationMat(const Mat &gray, Mat &dst)
+{
+    PERF_SCOPE("orientationMat", gray.total());
+    assert(gray.type() == CV_8UC1);
+
+    const int rows = gray.rows;
+    const int cols = gray.cols;
+
+    dst = Mat::zeros(rows, cols, CV_8UC1);
+
+    for (int i = 1; i < rows - 1; i++) {
+        const uchar *above = gray.ptr<uchar>(i - 1);
+        const uchar *row = gray.ptr<uchar>(i);
+        const uchar *below = gray.ptr<uchar>(i + 1);
+        uchar *d = dst.ptr<uchar>(i);
+
+        for (int j = 1; j < cols - 1; j++) {
+            const int x = (above[j + 1] - above[j - 1])
+                + 2 * (row[j + 1] - row[j - 1])
+                + (below[j + 1] - below[j - 1]);
+            const int y = (below[j - 1] - above[j - 1])
+                + 2 * (below[j] - above[j])
+                + (below[j + 1] - above[j + 1]);
+
+            d[j] = orientBin(x, y);
+        }
+    }
+}
+
+/**
+ * Orientation histogram of the edge pixels of an object.
+ *
+ * @param binary    Pixels of the object, nonzero at edges.
+ * @param orient    Orientation bins of the same pixels.
+ * @param dst       Fraction of edge pixels in each bin, rotated so that the
+ *                  largest bin is first.  All 0 without edge pixels.
+ * @return Edge pixels counted.
+ */
+int orientDescriptor(const Mat &binary, const Mat &orient,
+        float dst[ORIENT_BINS])
+{
+    assert(binary.rows == orient.rows && binary.cols == orient.cols);
+
+    int counts[ORIENT_BINS];
+    int total = 0;
+
+    memset(counts, 0, sizeof(counts));
+
+    for (int i = 0; i < binary.rows; i++) {
+        const uchar *b = binary.ptr<uchar>(i);
+        const uchar *o = orient.ptr<uchar>(i);
+
+        for (int j = 0; j < binary.cols; j++) {
+            counts[o[j]] += b[j] != 0;
+        }
+    }
+
+    int peak = 0;
+    for (int k = 0; k < ORIENT_BINS; k++) {
+        total += counts[k];
+        if (counts[k] > counts[peak]) peak = k;
+    }
+
+    for (int k = 0; k < ORIENT_BINS; k++) {
+        dst[k] = total ? (float)counts[(peak + k) % ORIENT_BINS] / total : 0;
+    }
+
+    return total;
+}
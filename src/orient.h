@@ -0,0 +1,80 @@
+/**
+ * Quantized gradient orientation, and histograms of it per object.
+ *
+ * The orientation of the Sobel gradient (gx, gy) of a pixel, y pointing down,
+ * is cut into ORIENT_BINS bins of equal angle, bin 0 starting along +x.  The
+ * bin is found from the signs of gx and gy and a few compares of their
+ * ratio against fixed-point tangents, without a division or `atan2`, so the
+ * edge pass emits it alongside the magnitude at little cost.
+ *
+ * The histogram of the orientations of the edge pixels of an object
+ * describes its outline, much as a single HOG cell does.  It is normalized,
+ * and rotated so that its largest bin comes first: rotating the object
+ * shifts the histogram round, so after the rotation the descriptor barely
+ * changes.
+ *
+ * @file orient.h
+ * @author Emily Ng
+ * @date Apr 24 2016
+ */
+
+#ifndef __ORIENT_H
+#define __ORIENT_H
+
+#include <stdlib.h>
+#include <opencv2/core.hpp>
+
+#include "debug.h"
+
+using namespace cv;
+
+// Bins of orientation over the full circle, 22.5 degrees each.
+#define ORIENT_BINS 16
+
+// Bins per quadrant.
+#define ORIENT_QUADRANT (ORIENT_BINS / 4)
+
+// Fixed-point scale of `orient_tan`.
+#define ORIENT_ONE 4096
+
+#if ORIENT_BINS != 16
+#error "orient_tan holds the bin boundaries of 16 bins"
+#endif
+
+// Tangents of the boundaries between the bins of a quadrant, 22.5, 45 and
+// 67.5 degrees, times ORIENT_ONE.
+static const int orient_tan[ORIENT_QUADRANT - 1] = { 1697, 4096, 9889 };
+
+/**
+ * Orientation bin of gradient (\p gx, \p gy).  Within each quadrant the
+ * angle is measured from the axis it starts at, so odd quadrants compare
+ * |gx| / |gy| rather than |gy| / |gx|.  A zero gradient, which is never an
+ * edge, lands in the last bin.
+ */
+static inline uchar orientBin(int gx, int gy)
+{
+    int q;
+
+    if (gx > 0 && gy >= 0) q = 0;
+    else if (gx <= 0 && gy > 0) q = 1;
+    else if (gx < 0 && gy <= 0) q = 2;
+    else q = 3;
+
+    const int ax = abs(gx);
+    const int ay = abs(gy);
+    const int num = ((q & 1) ? ax : ay) * ORIENT_ONE;
+    const int den = (q & 1) ? ay : ax;
+
+    int bin = q * ORIENT_QUADRANT;
+    for (int k = 0; k < ORIENT_QUADRANT - 1; k++) {
+        bin += num >= den * orient_tan[k];
+    }
+
+    return bin;
+}
+
+void orientationMat(const Mat &gray, Mat &dst);
+int orientDescriptor(const Mat &binary, const Mat &orient,
+        float dst[ORIENT_BINS]);
+
+#endif
@@ -0,0 +1,559 @@
+/**
+ * Stage graph for image processing pipelines.
+ *
+ * @file pipeline.cpp
+ * @author Emily Ng
+ * @date Mar 09 2016
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <opencv2/imgproc.hpp>
+
+#include "bitmask.h"
+#include "img_proc.h"
+#include "kernel.h"
+#include "morph.h"
+#include "pipeline.h"
+#include "rle.h"
+#include "stream.h"
+#include "utils.h"
+
+/*****      Operations     *******/
+
+static const Mat *kernelByName(const std::string &name)
+{
+    if (name == "sobel_x") return &kern_sobel_x;
+    if (name == "sobel_y") return &kern_sobel_y;
+    if (name == "sharpen") return &kern_sharpen;
+
+    ELOG("unknown kernel %s", name.c_str());
+    return NULL;
+}
+
+static int opRgb2g(const std::vector<Mat> &in,
+        const std::vector<std::string> &params, Mat &out)
+{
+    rgb2g(in[0], out);
+    return 0;
+}
+
+static int opCvRgb2g(const std::vector<Mat> &in,
+        const std::vector<std::string> &params, Mat &out)
+{
+    cvtColor(in[0], out, CV_BGR2GRAY, 0);
+    return 0;
+}
+
+static int opKernel(const std::vector<Mat> &in,
+        const std::vector<std::string> &params, Mat &out)
+{
+    const Mat *kernel = params.size() ? kernelByName(params[0]) : NULL;
+    if (!kernel) return -1;
+
+    // Kernels known at compile time have their own loops.
+    if (kernel == &kern_sobel_x) applyKernel(in[0], out, taps_sobel_x());
+    else if (kernel == &kern_sobel_y) applyKernel(in[0], out, taps_sobel_y());
+    else if (kernel == &kern_sharpen) applyKernel(in[0], out, taps_sharpen());
+    else applyKernel(in[0], out, *kernel);
+    return 0;
+}
+
+static int opCvKernel(const std::vector<Mat> &in,
+        const std::vector<std::string> &params, Mat &out)
+{
+    const Mat *kernel = params.size() ? kernelByName(params[0]) : NULL;
+    if (!kernel) return -1;
+
+    filter2D(in[0], out, CV_16S, *kernel);
+    return 0;
+}
+
+static int opCombine(const std::vector<Mat> &in,
+        const std::vector<std::string> &params, Mat &out)
+{
+    const std::string fn = params.size() ? params[0] : "hypot";
+    Mat a = in[0];
+    Mat b = in[1];
+
+    if (fn == "hypot") {
+        combine(a, b, out, &hypoteneuse);
+    }
+    else if (fn == "average") {
+        combine(a, b, out, &average);
+    }
+    else {
+        ELOG("unknown combining function %s", fn.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+static int opCvCombine(const std::vector<Mat> &in,
+        const std::vector<std::string> &params, Mat &out)
+{
+    addWeighted(in[0], 0.5, in[1], 0.5, 0, out);
+    convertScaleAbs(out, out);
+    return 0;
+}
+
+static int opThreshold(const std::vector<Mat> &in,
+        const std::vector<std::string> &params, Mat &out)
+{
+    struct thresh_rule rule = { THRESH_FIXED, 150 };
+    struct histogram hist;
+
+    if (params.size() && parseThreshRule(params[0].c_str(), rule)) return -1;
+
+    clearHistogram(hist);
+    if (rule.kind != THRESH_FIXED) histogramMat(in[0], hist);
+
+    threshold(in[0], out, pickThreshold(hist, rule), 255, THRESH_BINARY);
+    return 0;
+}
+
+static int opEdges(const std::vector<Mat> &in,
+        const std::vector<std::string> &params, Mat &out)
+{
+    struct thresh_rule rule = { THRESH_FIXED, 150 };
+
+    if (params.size() && parseThreshRule(params[0].c_str(), rule)) return -1;
+
+    streamEdges(in[0], out, rule);
+    return 0;
+}
+
+static int opLabel(const std::vector<Mat> &in,
+        const std::vector<std::string> &params, Mat &out)
+{
+    connectedComponentsLabeling(in[0], out);
+    return 0;
+}
+
+static int opLabelBits(const std::vector<Mat> &in,
+        const std::vector<std::string> &params, Mat &out)
+{
+    struct bit_mask bits;
+
+    thresholdBits(in[0], bits, BLACK);
+    connectedComponentsLabelingBits(bits, out);
+    return 0;
+}
+
+/**
+ * Morphology parameters: operation, then width and height of the rectangle,
+ * the height defaulting to the width.
+ */
+static int morphParams(const std::vector<std::string> &params, int &op,
+        int &w, int &h)
+{
+    op = params.size() ? morphOpByName(params[0].c_str()) : -1;
+    if (op < 0) {
+        ELOG("expected erode, dilate, open or close");
+        return -1;
+    }
+
+    w = (params.size() > 1) ? atoi(params[1].c_str()) : 3;
+    h = (params.size() > 2) ? atoi(params[2].c_str()) : w;
+    if (w < 1 || h < 1) {
+        ELOG("bad rectangle %d x %d", w, h);
+        return -1;
+    }
+    return 0;
+}
+
+static int opMorph(const std::vector<Mat> &in,
+        const std::vector<std::string> &params, Mat &out)
+{
+    int op, w, h;
+    if (morphParams(params, op, w, h)) return -1;
+
+    morphRect(in[0], out, op, w, h);
+    return 0;
+}
+
+static int opMorphBits(const std::vector<Mat> &in,
+        const std::vector<std::string> &params, Mat &out)
+{
+    int op, w, h;
+    if (morphParams(params, op, w, h)) return -1;
+
+    struct bit_mask bits;
+    thresholdBits(in[0], bits, BLACK);
+    morphRectBits(bits, bits, op, w, h);
+    unpackBits(bits, out);
+    return 0;
+}
+
+static int opCvMorph(const std::vector<Mat> &in,
+        const std::vector<std::string> &params, Mat &out)
+{
+    int op, w, h;
+    if (morphParams(params, op, w, h)) return -1;
+
+    morphologyEx(in[0], out, op, getStructuringElement(MORPH_RECT, Size(w, h)));
+    return 0;
+}
+
+/**
+ * Pack moments into a 1 x 10 row: m00, m10, m01 and the seven Hu moments.
+ */
+static void momentsToMat(const struct _moment &m, Mat &out)
+{
+    out = Mat::zeros(1, 10, CV_64FC1);
+    double *p = out.ptr<double>(0);
+    p[0] = m.m00;
+    p[1] = m.m10;
+    p[2] = m.m01;
+
+    if (m.m00 != 0) {
+        for (int i = 0; i < 7; i++) {
+            p[3 + i] = m.hu[i];
+        }
+    }
+}
+
+static int opMoments(const std::vector<Mat> &in,
+        const std::vector<std::string> &params, Mat &out)
+{
+    struct _moment m = imageMoments(in[0]);
+
+    momentsToMat(m, out);
+    return 0;
+}
+
+static int opRunMoments(const std::vector<Mat> &in,
+        const std::vector<std::string> &params, Mat &out)
+{
+    struct rle_mask runs;
+
+    runLengthEncode(in[0], runs);
+    momentsToMat(runMoments(runs), out);
+    return 0;
+}
+
+static int opSad(const std::vector<Mat> &in,
+        const std::vector<std::string> &params, Mat &out)
+{
+    Mat a = in[0];
+    Mat b = in[1];
+
+    // Types are checked when the stage is added, sizes only now.
+    if (a.rows != b.rows || a.cols != b.cols) {
+        ELOG("sad of %d x %d and %d x %d images", a.cols, a.rows, b.cols,
+                b.rows);
+        return -1;
+    }
+    if (a.depth() != CV_8U) {
+        ELOG("sad compares 8-bit images, got type %d", a.type());
+        return -1;
+    }
+
+    out = Mat::zeros(1, 1, CV_32SC1);
+    out.ptr<int>(0)[0] = sumOfAbsoluteDifferences(a, b);
+    return 0;
+}
+
+static const struct stage_op stage_ops[] = {
+    { "rgb2g",       1, { CV_8UC3 },            CV_8UC1,  opRgb2g },
+    { "cv_rgb2g",    1, { CV_8UC3 },            CV_8UC1,  opCvRgb2g },
+    { "kernel",      1, { CV_8UC1 },            CV_8UC1,  opKernel },
+    { "cv_kernel",   1, { CV_8UC1 },            CV_16SC1, opCvKernel },
+    { "combine",     2, { CV_8UC1, CV_8UC1 },   CV_8UC1,  opCombine },
+    { "cv_combine",  2, { CV_16SC1, CV_16SC1 }, CV_8UC1,  opCvCombine },
+    { "threshold",   1, { CV_8UC1 },            CV_8UC1,  opThreshold },
+    { "edges",       1, { CV_8UC3 },            CV_8UC1,  opEdges },
+    { "morph",       1, { CV_8UC1 },            CV_8UC1,  opMorph },
+    { "morph_bits",  1, { CV_8UC1 },            CV_8UC1,  opMorphBits },
+    { "cv_morph",    1, { CV_8UC1 },            CV_8UC1,  opCvMorph },
+    { "label",       1, { CV_8UC1 },            CV_8UC1,  opLabel },
+    { "label_bits",  1, { CV_8UC1 },            CV_32SC1, opLabelBits },
+    { "moments",     1, { CV_8UC1 },            CV_64FC1, opMoments },
+    { "run_moments", 1, { CV_8UC1 },            CV_64FC1, opRunMoments },
+    { "sad",         2, { ANY_TYPE, SAME_TYPE }, CV_32SC1, opSad },
+};
+
+/**
+ * Look up an operation by name.
+ *
+ * @return The operation, or NULL if there is none by that name.
+ */
+const struct stage_op *findStageOp(const char *name)
+{
+    for (size_t i = 0; i < sizeof(stage_ops) / sizeof(stage_ops[0]); i++) {
+        if (!strcmp(stage_ops[i].name, name)) {
+            return &stage_ops[i];
+        }
+    }
+    return NULL;
+}
+
+/*****      Graph     *******/
+
+Pipeline::Pipeline() : failed(0)
+{
+    struct stage_node *src = new stage_node;
+    src->name = PIPELINE_SRC;
+    src->op = NULL;
+    src->out_type = CV_8UC3;
+    src->output = false;
+    nodes.push_back(src);
+}
+
+Pipeline::~Pipeline()
+{
+    for (size_t i = 0; i < nodes.size(); i++) {
+        delete nodes[i];
+    }
+}
+
+int Pipeline::find(const std::string &name) const
+{
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i]->name == name) return i;
+    }
+    return -1;
+}
+
+/**
+ * Append a stage.  Its inputs must already be in the pipeline.
+ *
+ * @param name      Name of the stage, and of its output.
+ * @param op        Name of the operation, see `stage_ops`.
+ * @param inputs    Names of the stages whose outputs are consumed.
+ * @param params    Parameters passed to the operation.
+ *
+ * @return 0 on success, -1 if the stage does not fit the pipeline.
+ */
+int Pipeline::addStage(const char *name, const char *op,
+        const std::vector<std::string> &inputs,
+        const std::vector<std::string> &params)
+{
+    if (find(name) >= 0) {
+        ELOG("duplicate stage %s", name);
+        return -1;
+    }
+
+    const struct stage_op *o = findStageOp(op);
+    if (!o) {
+        ELOG("unknown operation %s", op);
+        return -1;
+    }
+    if ((int)inputs.size() != o->num_inputs) {
+        ELOG("%s: %s takes %d inputs, got %zu", name, op, o->num_inputs,
+                inputs.size());
+        return -1;
+    }
+
+    struct stage_node *node = new stage_node;
+    node->name = name;
+    node->op = o;
+    node->params = params;
+    node->out_type = o->out_type;
+    node->output = false;
+
+    for (size_t i = 0; i < inputs.size(); i++) {
+        int in = find(inputs[i]);
+
+        if (in < 0) {
+            ELOG("%s: no stage %s", name, inputs[i].c_str());
+            delete node;
+            return -1;
+        }
+        int want = o->in_types[i];
+        if (want == SAME_TYPE) {
+            want = i ? nodes[node->inputs[0]]->out_type : ANY_TYPE;
+        }
+        if (want != ANY_TYPE && want != nodes[in]->out_type) {
+            ELOG("%s: input %s has type %d, %s wants %d", name,
+                    inputs[i].c_str(), nodes[in]->out_type, op, want);
+            delete node;
+            return -1;
+        }
+
+        node->inputs.push_back(in);
+    }
+
+    const int n = nodes.size();
+    for (size_t i = 0; i < node->inputs.size(); i++) {
+        nodes[node->inputs[i]]->consumers.push_back(n);
+    }
+    nodes.push_back(node);
+
+    return 0;
+}
+
+/**
+ * Keep the output of a stage that has consumers.
+ */
+int Pipeline::markOutput(const char *name)
+{
+    int n = find(name);
+
+    if (n <= 0) {
+        ELOG("no stage %s", name);
+        return -1;
+    }
+
+    nodes[n]->output = true;
+    return 0;
+}
+
+/**
+ * Read stages from a description file.  See pipeline.h for the format.
+ *
+ * @param path  Path to description.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int Pipeline::parse(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        ELOG("cannot open %s", path);
+        return -1;
+    }
+
+    char line[512];
+    int line_no = 0;
+    int ret = 0;
+
+    while (!ret && fgets(line, sizeof(line), fp)) {
+        line_no++;
+
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        const char *sep = " \t\r\n";
+        std::vector<std::string> tok;
+        for (char *t = strtok(line, sep); t; t = strtok(NULL, sep)) {
+            tok.push_back(t);
+        }
+
+        if (tok.empty()) {
+            continue;
+        }
+
+        if (tok[0] == "output" && tok.size() == 2) {
+            ret = markOutput(tok[1].c_str());
+            continue;
+        }
+
+        if (tok.size() < 3 || tok[1] != "=") {
+            ELOG("%s:%d: expected 'name = op input ... [: param ...]'",
+                    path, line_no);
+            ret = -1;
+            break;
+        }
+
+        std::vector<std::string> inputs, params;
+        size_t i = 3;
+        for (; i < tok.size() && tok[i] != ":"; i++) {
+            inputs.push_back(tok[i]);
+        }
+        for (i++; i < tok.size(); i++) {
+            params.push_back(tok[i]);
+        }
+
+        ret = addStage(tok[0].c_str(), tok[2].c_str(), inputs, params);
+        if (ret) {
+            ELOG("%s:%d: bad stage", path, line_no);
+        }
+    }
+
+    fclose(fp);
+    return ret;
+}
+
+/**
+ * Compute stage \p n, whose inputs are ready, then release inputs that are no
+ * longer needed and start consumers whose inputs are now all ready.
+ */
+void Pipeline::runStage(TaskGroup &group, int n)
+{
+    struct stage_node *node = nodes[n];
+
+    if (node->op && !failed) {
+        std::vector<Mat> in;
+        for (size_t i = 0; i < node->inputs.size(); i++) {
+            in.push_back(nodes[node->inputs[i]]->out);
+        }
+
+        DLOG("run %s", node->name.c_str());
+        int err;
+        {
+            PERF_SCOPE(node->name.c_str(), in.size() ? in[0].total() : 0);
+            err = node->op->fn(in, node->params, node->out);
+        }
+        if (err) {
+            ELOG("stage %s failed", node->name.c_str());
+            failed = 1;
+        }
+        else if (node->out.type() != node->out_type) {
+            ELOG("stage %s produced type %d, expected %d",
+                    node->name.c_str(), node->out.type(), node->out_type);
+            failed = 1;
+        }
+
+        for (size_t i = 0; i < node->inputs.size(); i++) {
+            struct stage_node *producer = nodes[node->inputs[i]];
+
+            if (--producer->readers == 0 && !producer->output) {
+                producer->out.release();
+            }
+        }
+    }
+
+    for (size_t i = 0; i < node->consumers.size(); i++) {
+        int c = node->consumers[i];
+
+        if (--nodes[c]->deps == 0) {
+            group.run([this, &group, c] { runStage(group, c); });
+        }
+    }
+}
+
+/**
+ * Run the pipeline on an image.
+ *
+ * @param pool      Pool to run stages on.
+ * @param src       Input image (BGR).
+ * @param outputs   Outputs, by stage name.
+ *
+ * @return 0 on success, -1 if a stage failed.
+ */
+int Pipeline::run(ThreadPool &pool, const Mat &src,
+        std::map<std::string, Mat> &outputs)
+{
+    if (src.type() != nodes[0]->out_type) {
+        ELOG("input has type %d, expected %d", src.type(), nodes[0]->out_type);
+        return -1;
+    }
+
+    failed = 0;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        nodes[i]->deps = nodes[i]->inputs.size();
+        nodes[i]->readers = nodes[i]->consumers.size();
+        nodes[i]->out.release();
+    }
+    nodes[0]->out = src;
+
+    {
+        TaskGroup group(pool);
+        runStage(group, 0);
+        group.wait();
+    }
+
+    for (size_t i = 1; i < nodes.size(); i++) {
+        struct stage_node *node = nodes[i];
+
+        if (node->output || node->consumers.empty()) {
+            outputs[node->name] = node->out;
+        }
+        node->out.release();
+    }
+    nodes[0]->out.release();
+
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,108 @@
+/**
+ * Stage graph for image processing pipelines.
+ *
+ * A pipeline is a DAG of stages connected by Mat edges.  Each stage applies
+ * one operation (e.g. `rgb2g`, `applyKernel`) to the outputs of earlier
+ * stages.  Operations declare the Mat types they accept and produce, so a
+ * badly connected pipeline is rejected when it is built rather than when it
+ * runs.
+ *
+ * Independent stages run in parallel on a `ThreadPool`.  The output of a
+ * stage is released as soon as its last consumer has finished, unless it is
+ * a pipeline output.
+ *
+ * Pipelines are described in text, one stage per line:
+ *
+ *     # name = op input [input ...] [: param ...]
+ *     gray   = rgb2g src
+ *     gx     = kernel gray : sobel_x
+ *     gy     = kernel gray : sobel_y
+ *     grad   = combine gx gy : hypot
+ *     binary = threshold grad : 150
+ *     output grad
+ *
+ * `src` is the input image.  Stages that nothing consumes are outputs, as are
+ * stages named by an `output` line.
+ *
+ * @file pipeline.h
+ * @author Emily Ng
+ * @date Mar 09 2016
+ */
+
+#ifndef __PIPELINE_H
+#define __PIPELINE_H
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "debug.h"
+#include "thread_pool.h"
+
+using namespace cv;
+
+// Edge type that matches any Mat.
+#define ANY_TYPE (-1)
+
+// Edge type that matches the type of the first input, whatever it is.
+#define SAME_TYPE (-2)
+
+// Maximum number of inputs of a stage.
+#define MAX_STAGE_INPUTS 4
+
+// Name of the pipeline input.
+#define PIPELINE_SRC "src"
+
+typedef int (*stage_fn)(const std::vector<Mat> &in,
+        const std::vector<std::string> &params, Mat &out);
+
+struct stage_op {
+    const char *name;
+    int num_inputs;
+    int in_types[MAX_STAGE_INPUTS];
+    int out_type;
+    stage_fn fn;
+};
+
+struct stage_node {
+    std::string name;
+    const struct stage_op *op;
+    std::vector<int> inputs;
+    std::vector<std::string> params;
+    std::vector<int> consumers;
+    int out_type;
+    bool output;
+
+    // state while running
+    Mat out;
+    std::atomic<int> deps;          // inputs not yet computed
+    std::atomic<int> readers;       // consumers not yet finished
+};
+
+class Pipeline {
+public:
+    Pipeline();
+    ~Pipeline();
+
+    int addStage(const char *name, const char *op,
+            const std::vector<std::string> &inputs,
+            const std::vector<std::string> &params);
+    int markOutput(const char *name);
+    int parse(const char *path);
+
+    int run(ThreadPool &pool, const Mat &src,
+            std::map<std::string, Mat> &outputs);
+
+private:
+    int find(const std::string &name) const;
+    void runStage(TaskGroup &group, int n);
+
+    std::vector<struct stage_node *> nodes;     // nodes[0] is the input
+    std::atomic<int> failed;
+};
+
+const struct stage_op *findStageOp(const char *name);
+
+#endif
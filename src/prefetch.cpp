@@ -0,0 +1,191 @@
+/**
+ * Prefetching image loader.
+ *
+ * @file prefetch.cpp
+ * @author Emily Ng
+ * @date Apr 10 2016
+ */
+
+#include <chrono>
+#include <stdio.h>
+#include <opencv2/imgcodecs.hpp>
+
+#include "prefetch.h"
+
+typedef std::chrono::steady_clock prefetch_clock;
+
+static double elapsedMs(prefetch_clock::time_point start)
+{
+    std::chrono::duration<double, std::milli> d = prefetch_clock::now() - start;
+    return d.count();
+}
+
+/**
+ * Start decoding \p paths.
+ *
+ * @param paths         Images, in the order they are handed out.
+ * @param num_threads   Decode threads, by default one per core.
+ * @param ahead         Images decoded ahead of the consumer at most.
+ */
+Prefetcher::Prefetcher(const std::vector<std::string> &paths,
+        int num_threads, int ahead)
+    : paths(paths), held(-1), next_load(0), next_out(0), stop(false),
+      decode_ms(0), wait_ms(0), failed(0)
+{
+    if (num_threads <= 0) {
+        num_threads = std::thread::hardware_concurrency();
+    }
+    if (num_threads <= 0) {
+        num_threads = 1;
+    }
+    if (ahead < 1) {
+        ahead = 1;
+    }
+
+    // One more slot than the lookahead, for the image being processed.
+    slots.resize(ahead + 1);
+    for (int s = ahead; s >= 0; s--) {
+        free_slots.push_back(s);
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        threads.push_back(std::thread(&Prefetcher::decodeLoop, this));
+    }
+}
+
+Prefetcher::~Prefetcher()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+    }
+    slot_freed.notify_all();
+
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+}
+
+/**
+ * Read and decode one image into \p s.  Runs without the lock.
+ */
+void Prefetcher::load(const std::string &path, struct slot &s)
+{
+    FILE *fp = fopen(path.c_str(), "rb");
+    long len = -1;
+
+    s.ok = false;
+
+    if (fp && !fseek(fp, 0, SEEK_END)) {
+        len = ftell(fp);
+        rewind(fp);
+    }
+    if (len <= 0) {
+        ELOG("cannot read %s", path.c_str());
+        if (fp) fclose(fp);
+        return;
+    }
+
+    s.bytes.resize(len);
+    const bool ok = fread(&s.bytes[0], len, 1, fp) == 1;
+    fclose(fp);
+
+    // Decoding into the slot's image reuses its buffer when the size and
+    // type match those of the last image decoded there, unless a pending
+    // check still holds the last image.
+    if (s.image.u && s.image.u->refcount > 1) s.image.release();
+    s.ok = ok && imdecode(Mat(s.bytes), IMREAD_COLOR, &s.image).data;
+    if (!s.ok) {
+        ELOG("cannot decode %s", path.c_str());
+    }
+}
+
+/**
+ * Decode thread.  Takes the next image in order, so images finish roughly in
+ * order and the consumer rarely waits behind a late one.
+ */
+void Prefetcher::decodeLoop()
+{
+    for (;;) {
+        int index, s;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+
+            slot_freed.wait(guard, [this] {
+                return stop || (!free_slots.empty()
+                        && next_load < (int)paths.size());
+            });
+            if (stop) return;
+
+            index = next_load++;
+            s = free_slots.back();
+            free_slots.pop_back();
+        }
+
+        prefetch_clock::time_point start = prefetch_clock::now();
+        load(paths[index], slots[s]);
+        const double ms = elapsedMs(start);
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+
+            ready[index] = s;
+            decode_ms += ms;
+            failed += !slots[s].ok;
+        }
+        image_ready.notify_all();
+    }
+}
+
+/**
+ * Next image, in list order.
+ *
+ * \p dst stays valid until the following call, which hands its buffer back to
+ * the decode threads.  Images that cannot be read are returned empty.
+ *
+ * @param dst       Decoded BGR image.
+ * @param index     Position of the image in the list.
+ * @return false once every image has been handed out.
+ */
+bool Prefetcher::next(Mat &dst, int &index)
+{
+    dst = Mat();
+
+    std::unique_lock<std::mutex> guard(lock);
+
+    if (held >= 0) {
+        free_slots.push_back(held);
+        held = -1;
+        slot_freed.notify_one();
+    }
+
+    if (next_out >= (int)paths.size()) {
+        return false;
+    }
+
+    prefetch_clock::time_point start = prefetch_clock::now();
+    image_ready.wait(guard, [this] { return ready.count(next_out) > 0; });
+    wait_ms += elapsedMs(start);
+
+    held = ready[next_out];
+    ready.erase(next_out);
+    index = next_out++;
+    if (slots[held].ok) {
+        dst = slots[held].image;
+    }
+
+    return true;
+}
+
+/**
+ * Log time spent decoding and time the consumer waited for images.  When
+ * decoding keeps ahead, the wait is close to zero.
+ */
+void Prefetcher::report()
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    ILOG("prefetch: %d of %zu images, %d failed, decode %.1f ms on %zu "
+            "threads, waited %.1f ms", next_out, paths.size(), failed,
+            decode_ms, threads.size(), wait_ms);
+}
@@ -0,0 +1,75 @@
+/**
+ * Prefetching image loader.
+ *
+ * Reads and decodes a list of images on its own threads, up to a fixed number
+ * of images ahead of the consumer, so that decoding the next images overlaps
+ * with processing the current one.  Images are handed out in list order
+ * whatever order they finish decoding in.
+ *
+ * File contents and decoded images are kept in a fixed set of slots and
+ * reused, so once every slot has been used for an image of a given size no
+ * more memory is allocated.
+ *
+ * @file prefetch.h
+ * @author Emily Ng
+ * @date Apr 10 2016
+ */
+
+#ifndef __PREFETCH_H
+#define __PREFETCH_H
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "debug.h"
+
+using namespace cv;
+
+// Default images decoded ahead of the consumer.
+#define PREFETCH_AHEAD 4
+
+class Prefetcher {
+public:
+    Prefetcher(const std::vector<std::string> &paths, int num_threads = 0,
+            int ahead = PREFETCH_AHEAD);
+    ~Prefetcher();
+
+    bool next(Mat &dst, int &index);
+    void report();
+
+private:
+    struct slot {
+        std::vector<uchar> bytes;   // file contents
+        Mat image;                  // decoded image
+        bool ok;                    // false if the image could not be read
+    };
+
+    void decodeLoop();
+    void load(const std::string &path, struct slot &s);
+
+    std::vector<std::string> paths;
+    std::vector<struct slot> slots;
+    std::vector<int> free_slots;
+    std::map<int, int> ready;       // index of image -> slot
+    int held;                       // slot handed out by `next`, or -1
+    int next_load;                  // next image to start decoding
+    int next_out;                   // next image to hand out
+    bool stop;
+
+    std::mutex lock;
+    std::condition_variable slot_freed;
+    std::condition_variable image_ready;
+    std::vector<std::thread> threads;
+
+    // statistics, under lock
+    double decode_ms;
+    double wait_ms;
+    int failed;
+};
+
+#endif
@@ -0,0 +1,266 @@
+/**
+ * Profiling of stages with hardware performance counters.
+ *
+ * @file profile.cpp
+ * @author Emily Ng
+ * @date Apr 08 2016
+ */
+
+#include <atomic>
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <map>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "profile.h"
+
+static const struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} events[PERF_EVENTS] = {
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "L1d misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+        | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    { "LLC misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { "branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+struct profile_stats {
+    unsigned long calls;
+    double pixels;
+    double ns;
+    double count[PERF_EVENTS];
+    bool valid[PERF_EVENTS];
+};
+
+static std::atomic<bool> enabled(false);
+
+static std::mutex stats_lock;
+static std::map<std::string, struct profile_stats> stats;
+
+// Innermost scope of each thread.
+static thread_local const char *current_stage = NULL;
+
+/**
+ * Counters of one thread.  Events are opened as one group, so they are read
+ * together with a single system call.  Events the machine does not have are
+ * left out of the group.
+ */
+class PerfGroup {
+public:
+    PerfGroup();
+    ~PerfGroup();
+
+    void read(struct perf_sample &s);
+
+private:
+    int leader;
+    int fds[PERF_EVENTS];
+    int slot[PERF_EVENTS];          // position in the group, or -1
+    int size;
+};
+
+static long perfEventOpen(struct perf_event_attr *attr, int group_fd)
+{
+    return syscall(__NR_perf_event_open, attr, 0, -1, group_fd, 0);
+}
+
+PerfGroup::PerfGroup() : leader(-1), size(0)
+{
+    static std::atomic<bool> warned(false);
+
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[e].type;
+        attr.config = events[e].config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP
+            | PERF_FORMAT_TOTAL_TIME_ENABLED
+            | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        fds[e] = perfEventOpen(&attr, leader);
+        slot[e] = (fds[e] >= 0) ? size++ : -1;
+
+        if (fds[e] >= 0 && leader < 0) {
+            leader = fds[e];
+        }
+        else if (fds[e] < 0 && !warned.exchange(true)) {
+            WLOG("cannot count %s (%s), counters will be missing",
+                    events[e].name, strerror(errno));
+        }
+    }
+}
+
+PerfGroup::~PerfGroup()
+{
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        if (fds[e] >= 0) close(fds[e]);
+    }
+}
+
+/**
+ * Read time and counters.  Counters are scaled up when the kernel had to
+ * share the hardware between more events than it has counters.
+ */
+void PerfGroup::read(struct perf_sample &s)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    s.ns = ts.tv_sec * 1e9 + ts.tv_nsec;
+
+    uint64_t buf[3 + PERF_EVENTS];
+    bool ok = leader >= 0
+        && ::read(leader, buf, sizeof(buf)) >= (ssize_t)(3 * sizeof(uint64_t))
+        && buf[0] == (uint64_t)size;
+
+    const double scale = (ok && buf[2]) ? (double)buf[1] / buf[2] : 1;
+
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        s.valid[e] = ok && slot[e] >= 0;
+        s.count[e] = s.valid[e] ? buf[3 + slot[e]] * scale : 0;
+    }
+}
+
+static PerfGroup &threadCounters()
+{
+    static thread_local PerfGroup group;
+    return group;
+}
+
+/**
+ * Turn profiling on or off.  Scopes already running are not affected.
+ */
+void setProfiling(bool on)
+{
+    enabled = on;
+}
+
+bool profiling()
+{
+    return enabled;
+}
+
+/**
+ * Name of the innermost scope of the calling thread, or NULL outside any.
+ */
+const char *currentStage()
+{
+    return current_stage;
+}
+
+/**
+ * Attribute what the calling thread does from now on to stage \p name, for
+ * tasks that carry on a stage begun on another thread.
+ */
+void setCurrentStage(const char *name)
+{
+    current_stage = name;
+}
+
+/**
+ * Start measuring.
+ *
+ * @param name      Stage or kernel.  Scopes of the same name add up.
+ * @param pixels    Pixels processed, for rates per pixel.
+ */
+StageScope::StageScope(const char *name, double pixels)
+    : name(name), outer(current_stage), pixels(pixels), active(enabled)
+{
+    current_stage = name;
+
+    if (active) {
+        threadCounters().read(start);
+    }
+}
+
+StageScope::~StageScope()
+{
+    current_stage = outer;
+
+    if (!active) return;
+
+    struct perf_sample end;
+    threadCounters().read(end);
+
+    std::lock_guard<std::mutex> guard(stats_lock);
+    struct profile_stats &p = stats[name];
+
+    if (!p.calls) {
+        for (int e = 0; e < PERF_EVENTS; e++) {
+            p.valid[e] = true;
+        }
+    }
+
+    p.calls++;
+    p.pixels += pixels;
+    p.ns += end.ns - start.ns;
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        p.valid[e] = p.valid[e] && start.valid[e] && end.valid[e];
+        p.count[e] += (double)end.count[e] - (double)start.count[e];
+    }
+}
+
+/**
+ * Format \p x into \p buf, or '-' when the counters behind it are missing.
+ */
+static const char *field(char *buf, size_t len, bool valid, double x)
+{
+    if (valid) snprintf(buf, len, "%.2f", x);
+    else snprintf(buf, len, "-");
+    return buf;
+}
+
+/**
+ * Log time and derived counter rates of every scope name.
+ *
+ * IPC is instructions per cycle.  Bytes per pixel estimates memory traffic
+ * from last level cache misses.  Miss rates are per thousand instructions.
+ */
+void reportProfile()
+{
+    if (!enabled) return;
+
+    std::lock_guard<std::mutex> guard(stats_lock);
+
+    ILOG("%-20s %7s %10s %8s %6s %8s %8s %8s %8s", "stage", "calls", "ms",
+            "ns/px", "IPC", "B/px", "L1d/ki", "LLC/ki", "br/ki");
+
+    std::map<std::string, struct profile_stats>::iterator it;
+    for (it = stats.begin(); it != stats.end(); it++) {
+        const struct profile_stats &p = it->second;
+        const double *c = p.count;
+        const double ki = c[PERF_INSTRUCTIONS] / 1000;
+        const bool have_ins = p.valid[PERF_INSTRUCTIONS] && ki > 0;
+        char ipc[16], bpp[16], l1[16], llc[16], br[16];
+
+        ILOG("%-20s %7lu %10.3f %8.2f %6s %8s %8s %8s %8s",
+                it->first.c_str(), p.calls, p.ns / 1e6,
+                p.pixels ? p.ns / p.pixels : 0,
+                field(ipc, sizeof(ipc), p.valid[PERF_CYCLES] && have_ins
+                    && c[PERF_CYCLES] > 0,
+                    c[PERF_INSTRUCTIONS] / c[PERF_CYCLES]),
+                field(bpp, sizeof(bpp), p.valid[PERF_LLC_MISSES] && p.pixels,
+                    c[PERF_LLC_MISSES] * CACHE_LINE / p.pixels),
+                field(l1, sizeof(l1), p.valid[PERF_L1D_MISSES] && have_ins,
+                    c[PERF_L1D_MISSES] / ki),
+                field(llc, sizeof(llc), p.valid[PERF_LLC_MISSES] && have_ins,
+                    c[PERF_LLC_MISSES] / ki),
+                field(br, sizeof(br), p.valid[PERF_BRANCH_MISSES] && have_ins,
+                    c[PERF_BRANCH_MISSES] / ki));
+    }
+}
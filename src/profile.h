@@ -0,0 +1,72 @@
+/**
+ * Profiling of stages with hardware performance counters.
+ *
+ * A `StageScope` measures the code between its construction and destruction
+ * with the Linux `perf_event_open` counters of the calling thread: cycles,
+ * instructions, L1 data and last level cache misses, and branch misses.  Each
+ * thread opens its counters once and scopes only read them, so scopes are
+ * cheap enough to put around every kernel.
+ *
+ * Profiling is off unless enabled with `setProfiling`.  Where the counters
+ * cannot be opened, as in most containers, scopes still measure time and the
+ * report shows '-' for the counters.
+ *
+ * Nested scopes each count the whole of their code, so the time of a pipeline
+ * stage includes that of the kernels it calls.
+ *
+ * Whether or not profiling is on, each thread knows the innermost scope it is
+ * in, so that other instrumentation, such as allocation counts, can be
+ * attributed to stages.  Tasks run in the stage that submitted them.
+ *
+ * @file profile.h
+ * @author Emily Ng
+ * @date Apr 08 2016
+ */
+
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include <stdint.h>
+
+#include "debug.h"
+
+// Counters, in order.
+#define PERF_CYCLES 0
+#define PERF_INSTRUCTIONS 1
+#define PERF_L1D_MISSES 2
+#define PERF_LLC_MISSES 3
+#define PERF_BRANCH_MISSES 4
+#define PERF_EVENTS 5
+
+// Bytes moved per last level cache miss.
+#define CACHE_LINE 64
+
+struct perf_sample {
+    double ns;
+    uint64_t count[PERF_EVENTS];
+    bool valid[PERF_EVENTS];
+};
+
+class StageScope {
+public:
+    StageScope(const char *name, double pixels);
+    ~StageScope();
+
+private:
+    const char *name;
+    const char *outer;          // stage of the thread before this one
+    double pixels;
+    bool active;
+    struct perf_sample start;
+};
+
+#define PERF_SCOPE(name, pixels) StageScope perf_scope_(name, pixels)
+
+void setProfiling(bool on);
+bool profiling();
+void reportProfile();
+
+const char *currentStage();
+void setCurrentStage(const char *name);
+
+#endif
@@ -0,0 +1,322 @@
+/**
+ * Run-length encoded binary images.
+ *
+ * @file rle.cpp
+ * @author Emily Ng
+ * @date Mar 23 2016
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "rle.h"
+
+#define WORD_BITS 64
+
+/**
+ * Encode the pixels of an image above a threshold, in one pass.
+ *
+ * Eight pixels at a time are skipped while they are all zero.
+ *
+ * @param src       Grayscale image.
+ * @param dst       Runs of pixels above \p thresh.
+ * @param thresh    Threshold, by default anything that is not BLACK.
+ */
+void runLengthEncode(const Mat &src, struct rle_mask &dst, uchar thresh)
+{
+    assert(src.channels() == GRAY);
+
+    dst.rows = src.rows;
+    dst.cols = src.cols;
+    dst.runs.clear();
+    dst.row_start.resize(src.rows + 1);
+
+    for (int i = 0; i < src.rows; i++) {
+        const uchar *p = src.ptr<uchar>(i);
+        int j = 0;
+
+        dst.row_start[i] = dst.runs.size();
+
+        while (j < src.cols) {
+            // Skip background.
+            while (j + 8 <= src.cols) {
+                uint64_t w;
+                memcpy(&w, p + j, 8);
+                if (w) break;
+                j += 8;
+            }
+            while (j < src.cols && p[j] <= thresh) {
+                j++;
+            }
+            if (j == src.cols) {
+                break;
+            }
+
+            struct run r;
+            r.row = i;
+            r.start = j;
+            while (j < src.cols && p[j] > thresh) {
+                j++;
+            }
+            r.end = j - 1;
+
+            dst.runs.push_back(r);
+        }
+    }
+
+    dst.row_start[src.rows] = dst.runs.size();
+}
+
+/**
+ * Encode a bit-packed image.
+ *
+ * Runs are found with count-trailing-zeros on each word and on its
+ * complement, so cost depends on the number of runs rather than the width.
+ */
+void runLengthEncode(const struct bit_mask &src, struct rle_mask &dst)
+{
+    dst.rows = src.rows;
+    dst.cols = src.cols;
+    dst.runs.clear();
+    dst.row_start.resize(src.rows + 1);
+
+    for (int i = 0; i < src.rows; i++) {
+        const uint64_t *row = src.row(i);
+        bool in_run = false;
+
+        dst.row_start[i] = dst.runs.size();
+
+        for (int w = 0; w < src.words; w++) {
+            uint64_t x = row[w];
+
+            if (in_run) {
+                if (x == ~0ULL) continue;
+
+                // Close the run carried over from the previous word.
+                int b = __builtin_ctzll(~x);
+                dst.runs.back().end = w * WORD_BITS + b - 1;
+                in_run = false;
+                x &= ~0ULL << b;
+            }
+
+            while (x) {
+                int b = __builtin_ctzll(x);
+                uint64_t gaps = ~x & (~0ULL << b);
+
+                struct run r = { i, w * WORD_BITS + b, 0 };
+                dst.runs.push_back(r);
+
+                if (!gaps) {
+                    in_run = true;
+                    break;
+                }
+
+                int e = __builtin_ctzll(gaps);
+                dst.runs.back().end = w * WORD_BITS + e - 1;
+                x &= ~0ULL << e;
+            }
+        }
+
+        if (in_run) {
+            dst.runs.back().end = src.cols - 1;
+        }
+    }
+
+    dst.row_start[src.rows] = dst.runs.size();
+}
+
+static int findRoot(std::vector<int> &parent, int x)
+{
+    while (parent[x] != x) {
+        parent[x] = parent[parent[x]];
+        x = parent[x];
+    }
+    return x;
+}
+
+static void unite(std::vector<int> &parent, int a, int b)
+{
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+
+    // Keep the older label, as `connectedComponentsLabeling` does.
+    if (a < b) parent[b] = a;
+    else if (b < a) parent[a] = b;
+}
+
+/**
+ * Connected components labeling of runs.
+ *
+ * 8-connected, like `connectedComponentsLabeling`.  Each run is merged with
+ * the runs of the previous row that it touches, through a union-find.
+ *
+ * @param src       Runs.
+ * @param labels    Label of each run, numbered 1..N in order of first
+ *                  appearance.
+ * @return Number of components found.
+ */
+unsigned int labelRuns(const struct rle_mask &src, std::vector<int> &labels)
+{
+    std::vector<int> parent(1, 0);      // label 0 is background
+
+    labels.assign(src.runs.size(), 0);
+
+    for (int i = 1; i <= src.rows; i++) {
+        const int prev_begin = (i > 1) ? src.row_start[i - 2] : 0;
+        const int prev_end = (i > 1) ? src.row_start[i - 1] : 0;
+        const int cur_end = src.row_start[i];
+
+        int p = prev_begin;
+        for (int c = src.row_start[i - 1]; c < cur_end; c++) {
+            const struct run &r = src.runs[c];
+
+            // Skip runs of the previous row that end left of this one.
+            while (p < prev_end && src.runs[p].end + 1 < r.start) {
+                p++;
+            }
+
+            for (int q = p; q < prev_end && src.runs[q].start <= r.end + 1;
+                    q++) {
+                if (!labels[c]) {
+                    labels[c] = labels[q];
+                }
+                else {
+                    unite(parent, labels[c], labels[q]);
+                }
+            }
+
+            if (!labels[c]) {
+                labels[c] = parent.size();
+                parent.push_back(labels[c]);
+            }
+        }
+    }
+
+    // Number the components 1..N in order of first appearance.
+    std::vector<int> final_label(parent.size(), 0);
+    unsigned int num_labels = 0;
+
+    for (size_t l = 1; l < parent.size(); l++) {
+        int root = findRoot(parent, l);
+
+        if (!final_label[root]) {
+            final_label[root] = ++num_labels;
+        }
+        final_label[l] = final_label[root];
+    }
+
+    for (size_t r = 0; r < labels.size(); r++) {
+        labels[r] = final_label[labels[r]];
+    }
+
+    return num_labels;
+}
+
+/**
+ * Draw labeled runs into a label image.
+ *
+ * @param src       Runs.
+ * @param labels    Label of each run.
+ * @param dst       Label image (CV_32S), 0 for background.
+ */
+void paintRuns(const struct rle_mask &src, const std::vector<int> &labels,
+        Mat &dst)
+{
+    dst = Mat::zeros(src.rows, src.cols, CV_32S);
+
+    for (size_t r = 0; r < src.runs.size(); r++) {
+        int *p = dst.ptr<int>(src.runs[r].row);
+
+        for (int j = src.runs[r].start; j <= src.runs[r].end; j++) {
+            p[j] = labels[r];
+        }
+    }
+}
+
+/*****      Moments     *******/
+
+/**
+ * Sum of x^k for x = 0..n, as a polynomial in n.  The polynomial is valid for
+ * negative n as well, so sum(b) - sum(a - 1) is the sum over [a, b] for any
+ * integers a <= b.
+ */
+static double powerSum1(double n) { return n * (n + 1) / 2; }
+static double powerSum2(double n) { return n * (n + 1) * (2 * n + 1) / 6; }
+static double powerSum3(double n) { return powerSum1(n) * powerSum1(n); }
+
+/**
+ * Add a run to raw moments, in closed form.
+ *
+ * Every pixel weighs WHITE, so the moments equal those `imageMoments`
+ * computes over the WHITE / BLACK image.
+ */
+static void addRun(struct raw_moment &m, const struct run &r)
+{
+    if (!m.set) {
+        m.x0 = r.start;
+        m.y0 = r.row;
+        m.set = true;
+    }
+
+    const double a = r.start - m.x0;
+    const double b = r.end - m.x0;
+    const double y = r.row - m.y0;
+
+    const double s0 = (b - a + 1) * WHITE;
+    const double s1 = (powerSum1(b) - powerSum1(a - 1)) * WHITE;
+    const double s2 = (powerSum2(b) - powerSum2(a - 1)) * WHITE;
+    const double s3 = (powerSum3(b) - powerSum3(a - 1)) * WHITE;
+
+    m.m00 += s0;
+    m.m10 += s1;
+    m.m01 += y * s0;
+    m.m20 += s2;
+    m.m11 += y * s1;
+    m.m02 += y * y * s0;
+    m.m30 += s3;
+    m.m21 += y * s2;
+    m.m12 += y * y * s1;
+    m.m03 += y * y * y * s0;
+}
+
+/**
+ * Moments of all runs together, as `imageMoments` of the decoded image.
+ *
+ * @param src   Runs.
+ */
+struct _moment runMoments(const struct rle_mask &src)
+{
+    struct raw_moment raw;
+
+    memset(&raw, 0, sizeof(raw));
+
+    for (size_t r = 0; r < src.runs.size(); r++) {
+        addRun(raw, src.runs[r]);
+    }
+
+    return momentsFromRaw(raw);
+}
+
+/**
+ * Moments of each connected component.
+ *
+ * @param src           Runs.
+ * @param labels        Label of each run, from `labelRuns`.
+ * @param num_labels    Number of components.
+ * @param moments       Moments of component l at index l - 1.
+ */
+void componentMoments(const struct rle_mask &src,
+        const std::vector<int> &labels, unsigned int num_labels,
+        std::vector<struct _moment> &moments)
+{
+    std::vector<struct raw_moment> raw(num_labels);
+
+    for (size_t r = 0; r < src.runs.size(); r++) {
+        addRun(raw[labels[r] - 1], src.runs[r]);
+    }
+
+    moments.resize(num_labels);
+    for (unsigned int l = 0; l < num_labels; l++) {
+        moments[l] = momentsFromRaw(raw[l]);
+    }
+}
@@ -0,0 +1,50 @@
+/**
+ * Run-length encoded binary images.
+ *
+ * A binary image is stored as its runs of set pixels, row by row and left to
+ * right.  Edge images are sparse, so labeling and moments over runs cost in
+ * proportion to the number of edges rather than to the image area.
+ *
+ * @file rle.h
+ * @author Emily Ng
+ * @date Mar 23 2016
+ */
+
+#ifndef __RLE_H
+#define __RLE_H
+
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "bitmask.h"
+#include "debug.h"
+#include "img_proc.h"
+
+using namespace cv;
+
+struct run {
+    int row;
+    int start;          // first column
+    int end;            // last column
+};
+
+struct rle_mask {
+    int rows;
+    int cols;
+    std::vector<struct run> runs;
+    std::vector<int> row_start;     // first run of each row, and one past
+                                    // the last run at row_start[rows]
+};
+
+void runLengthEncode(const Mat &src, struct rle_mask &dst,
+        uchar thresh = BLACK);
+void runLengthEncode(const struct bit_mask &src, struct rle_mask &dst);
+unsigned int labelRuns(const struct rle_mask &src, std::vector<int> &labels);
+void paintRuns(const struct rle_mask &src, const std::vector<int> &labels,
+        Mat &dst);
+struct _moment runMoments(const struct rle_mask &src);
+void componentMoments(const struct rle_mask &src,
+        const std::vector<int> &labels, unsigned int num_labels,
+        std::vector<struct _moment> &moments);
+
+#endif
@@ -0,0 +1,391 @@
+/**
+ * Shadow verification of our kernels against OpenCV.
+ *
+ * @file shadow.cpp
+ * @author Emily Ng
+ * @date Mar 12 2016
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <opencv2/imgproc.hpp>
+
+#include "img_proc.h"
+#include "kernel.h"
+#include "shadow.h"
+
+static const char *kind_names[SHADOW_KINDS] = {
+    "gray", "sobel", "labels", "hu", "morph"
+};
+
+/**
+ * Mean absolute difference of two images, ignoring border pixels where our
+ * kernels leave zeros.
+ */
+static double meanAbsDiff(const Mat &A, const Mat &B)
+{
+    if (A.rows < 3 || A.cols < 3) {
+        return 0;
+    }
+
+    Rect interior(1, 1, A.cols - 2, A.rows - 2);
+    Mat diff;
+
+    absdiff(A(interior), B(interior), diff);
+    return sum(diff).val[0] / interior.area();
+}
+
+/**
+ * @param rate  Check one in \p rate frames.  0 disables checks.
+ */
+ShadowVerifier::ShadowVerifier(int rate) : rate(rate), frames(0), stop(false)
+{
+    for (int i = 0; i < SHADOW_KINDS; i++) {
+        counters[i] = (struct shadow_stats) {0, 0, 0, 0, 0};
+    }
+
+    if (rate > 0) {
+        worker = std::thread(&ShadowVerifier::workerLoop, this);
+    }
+}
+
+ShadowVerifier::~ShadowVerifier()
+{
+    if (!worker.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(jobs_lock);
+        stop = true;
+    }
+    jobs_ready.notify_one();
+    worker.join();
+}
+
+/**
+ * Whether to check the frame about to start, one in `rate`.  Called once per
+ * frame; every stage of a frame picked is then checked.
+ */
+bool ShadowVerifier::sampleFrame()
+{
+    return rate > 0 && frames++ % rate == 0;
+}
+
+/**
+ * Queue a check, or drop it if the worker is behind.
+ *
+ * @param kind      Kind of check, for counters.
+ * @param check     Computes the reference and returns the difference.
+ * @param tol       Differences above \p tol are divergences.
+ */
+void ShadowVerifier::queue(int kind, const std::function<double()> &check,
+        double tol)
+{
+    if (rate <= 0) return;
+
+    {
+        std::lock_guard<std::mutex> guard(counters_lock);
+        counters[kind].sampled++;
+    }
+
+    std::unique_lock<std::mutex> guard(jobs_lock);
+    if (jobs.size() >= SHADOW_QUEUE) {
+        guard.unlock();
+
+        std::lock_guard<std::mutex> c_guard(counters_lock);
+        counters[kind].dropped++;
+        return;
+    }
+
+    jobs.push_back([this, kind, check, tol] {
+        double d = check();
+
+        std::lock_guard<std::mutex> c_guard(counters_lock);
+        counters[kind].checked++;
+        counters[kind].diff += d;
+        if (d > tol) {
+            counters[kind].diverged++;
+            WLOG("%s diverges from OpenCV by %g", kind_names[kind], d);
+        }
+    });
+    guard.unlock();
+
+    jobs_ready.notify_one();
+}
+
+void ShadowVerifier::workerLoop()
+{
+    // Only run when nothing else wants the CPU.
+#ifdef SCHED_IDLE
+    struct sched_param param;
+    param.sched_priority = 0;
+    if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param))
+#endif
+    {
+        setpriority(PRIO_PROCESS, 0, 19);
+    }
+
+    for (;;) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> guard(jobs_lock);
+            jobs_ready.wait(guard, [this] { return stop || !jobs.empty(); });
+            if (jobs.empty()) {
+                return;
+            }
+            job = jobs.front();
+            jobs.pop_front();
+        }
+        job();
+    }
+}
+
+/**
+ * Check `rgb2g` against `cvtColor`.
+ *
+ * @param src   Color image.
+ * @param ours  Our grayscale image.
+ */
+void ShadowVerifier::verifyGray(const Mat &src, const Mat &ours)
+{
+    Mat color = src;
+    Mat gray = ours;
+
+    queue(SHADOW_GRAY, [color, gray] {
+        Mat ref;
+        cvtColor(color, ref, CV_BGR2GRAY, 0);
+        return meanAbsDiff(ref, gray);
+    }, SHADOW_GRAY_TOL);
+}
+
+/**
+ * Check Sobel magnitude against `filter2D`.
+ *
+ * The reference combines derivatives the same way we do, i.e. the magnitude
+ * of the saturated absolute derivatives.
+ *
+ * @param src   Grayscale image.
+ * @param ours  Our Sobel magnitude.
+ */
+void ShadowVerifier::verifySobel(const Mat &src, const Mat &ours)
+{
+    Mat gray = src;
+    Mat grad = ours;
+
+    queue(SHADOW_SOBEL, [gray, grad] {
+        Mat tmp_x, tmp_y, ref;
+
+        filter2D(gray, tmp_x, CV_16S, kern_sobel_x);
+        filter2D(gray, tmp_y, CV_16S, kern_sobel_y);
+        convertScaleAbs(tmp_x, tmp_x);
+        convertScaleAbs(tmp_y, tmp_y);
+        tmp_x.convertTo(tmp_x, CV_32F);
+        tmp_y.convertTo(tmp_y, CV_32F);
+        magnitude(tmp_x, tmp_y, ref);
+        ref.convertTo(ref, CV_8U);
+
+        return meanAbsDiff(ref, grad);
+    }, SHADOW_SOBEL_TOL);
+}
+
+/**
+ * Check the number of distinct labels against `connectedComponents`.
+ *
+ * @param src   Binary image.
+ * @param ours  Our label image, 8 or 32-bit.
+ */
+void ShadowVerifier::verifyLabels(const Mat &src, const Mat &ours)
+{
+    Mat binary = src;
+    Mat labels = ours;
+
+    queue(SHADOW_LABELS, [binary, labels] {
+        Mat ref;
+        int ref_labels = connectedComponents(binary, ref) - 1;
+
+        // 8-bit labels may have gaps, 32-bit labels are numbered 1..N.
+        int our_labels = 0;
+        if (labels.depth() == CV_32S) {
+            for (int i = 0; i < labels.rows; i++) {
+                const int *p = labels.ptr<int>(i);
+                for (int j = 0; j < labels.cols; j++) {
+                    our_labels = (p[j] > our_labels) ? p[j] : our_labels;
+                }
+            }
+        }
+        else {
+            bool seen[256] = {false};
+            for (int i = 0; i < labels.rows; i++) {
+                const uchar *p = labels.ptr<uchar>(i);
+                for (int j = 0; j < labels.cols; j++) {
+                    if (p[j] && !seen[p[j]]) {
+                        seen[p[j]] = true;
+                        our_labels++;
+                    }
+                }
+            }
+        }
+
+        return (double)abs(our_labels - ref_labels);
+    }, 0);
+}
+
+/**
+ * The 8-connected component of \p src that comes first in raster order, the
+ * one `traceObject` traces, alone on a background of BLACK.
+ */
+static Mat firstComponent(const Mat &src)
+{
+    Mat labels;
+    Mat dst = Mat::zeros(src.rows, src.cols, CV_8UC1);
+    int first = 0;
+
+    connectedComponents(src, labels, 8, CV_32S);
+
+    for (int i = 0; i < labels.rows; i++) {
+        const int *l = labels.ptr<int>(i);
+        uchar *d = dst.ptr<uchar>(i);
+
+        for (int j = 0; j < labels.cols; j++) {
+            if (!first) first = l[j];
+            d[j] = (first && l[j] == first) ? WHITE : BLACK;
+        }
+    }
+
+    return dst;
+}
+
+/**
+ * Check Hu moments against `HuMoments` of the first object of \p src.  The
+ * 7th moment is not compared, as in `compareHu`.
+ *
+ * @param src   Object image.
+ * @param ours  Our Hu moments.
+ */
+void ShadowVerifier::verifyHu(const Mat &src, const double ours[7])
+{
+    Mat obj = src;
+    std::vector<double> hu(ours, ours + 7);
+
+    queue(SHADOW_HU, [obj, hu] {
+        double ref[7];
+        HuMoments(moments(firstComponent(obj), false), ref);
+
+        double worst = 0;
+        for (int i = 0; i < 6; i++) {
+            double d = fabs(hu[i] - ref[i]) / fmax(fabs(ref[i]), 1e-300);
+            worst = fmax(worst, d);
+        }
+        return worst;
+    }, SHADOW_HU_TOL);
+}
+
+/**
+ * Check Hu moments of the region enclosed by the outer contour of the first
+ * object of \p src against `findContours` and the contour form of `moments`.
+ * Raw moments are weighed as WHITE pixels, as `contourMoments` does.
+ *
+ * @param src   Object image.
+ * @param ours  Our Hu moments.
+ */
+void ShadowVerifier::verifyContourHu(const Mat &src, const double ours[7])
+{
+    Mat obj = src;
+    std::vector<double> hu(ours, ours + 7);
+
+    queue(SHADOW_HU, [obj, hu] {
+        std::vector<std::vector<Point> > contours;
+        std::vector<Vec4i> hierarchy;
+        Mat tmp;
+
+        // findContours modifies its input and skips the image border, so
+        // work on a copy with a border of background.
+        copyMakeBorder(firstComponent(obj), tmp, 1, 1, 1, 1, BORDER_CONSTANT,
+                Scalar(BLACK));
+
+        // Two levels: the outer boundary at the top.
+        findContours(tmp, contours, hierarchy, RETR_CCOMP, CHAIN_APPROX_NONE);
+
+        double m[10] = { 0 };
+        for (size_t c = 0; c < contours.size(); c++) {
+            if (hierarchy[c][3] >= 0) continue;
+
+            Moments cm = moments(contours[c]);
+            double raw[10] = { cm.m00, cm.m10, cm.m01, cm.m20, cm.m11,
+                cm.m02, cm.m30, cm.m21, cm.m12, cm.m03 };
+            for (int k = 0; k < 10; k++) {
+                m[k] += raw[k] * WHITE;
+            }
+        }
+
+        double ref[7];
+        HuMoments(Moments(m[0], m[1], m[2], m[3], m[4], m[5], m[6], m[7],
+                    m[8], m[9]), ref);
+
+        double worst = 0;
+        for (int i = 0; i < 6; i++) {
+            double d = fabs(hu[i] - ref[i]) / fmax(fabs(ref[i]), 1e-300);
+            worst = fmax(worst, d);
+        }
+        return worst;
+    }, SHADOW_HU_TOL);
+}
+
+/**
+ * Check morphology by a rectangle against `morphologyEx`, which is exact, so
+ * a single differing pixel diverges.
+ *
+ * @param src   8-bit image.
+ * @param ours  Our result.
+ * @param op    One of MORPH_OP_*, which are OpenCV's MORPH_* values.
+ * @param w     Width of the rectangle.
+ * @param h     Height of the rectangle.
+ */
+void ShadowVerifier::verifyMorph(const Mat &src, const Mat &ours, int op,
+        int w, int h)
+{
+    Mat img = src;
+    Mat result = ours;
+
+    queue(SHADOW_MORPH, [img, result, op, w, h] {
+        Mat ref;
+        morphologyEx(img, ref, op,
+                getStructuringElement(MORPH_RECT, Size(w, h)));
+
+        unsigned long diff = 0;
+        for (int i = 0; i < ref.rows; i++) {
+            const uchar *a = ref.ptr<uchar>(i);
+            const uchar *b = result.ptr<uchar>(i);
+            for (int j = 0; j < ref.cols; j++) {
+                diff += a[j] != b[j];
+            }
+        }
+        return (double)diff;
+    }, 0);
+}
+
+/**
+ * Snapshot of the counters of one kind of check.
+ */
+struct shadow_stats ShadowVerifier::stats(int kind)
+{
+    std::lock_guard<std::mutex> guard(counters_lock);
+    return counters[kind];
+}
+
+/**
+ * Log counters of every kind of check.
+ */
+void ShadowVerifier::report()
+{
+    for (int i = 0; i < SHADOW_KINDS; i++) {
+        struct shadow_stats s = stats(i);
+
+        ILOG("shadow %-6s: %u sampled, %u dropped, %u checked, %u diverged, "
+                "mean diff %g", kind_names[i], s.sampled, s.dropped, s.checked,
+                s.diverged, s.checked ? s.diff / s.checked : 0);
+    }
+}
@@ -0,0 +1,93 @@
+/**
+ * Shadow verification of our kernels against OpenCV.
+ *
+ * Runs the OpenCV equivalent of every stage of a sample of frames, on a low
+ * priority background thread, and counts how often the results diverge.
+ * Callers ask `sampleFrame` once per frame and only call the checks of frames
+ * picked.  The calling thread only queues the check.  If the background
+ * thread falls behind, checks are dropped rather than making the caller wait.
+ *
+ * Inputs are shared with the check, not copied, so callers must not modify
+ * them afterwards, but draw on a copy if the data is still shared.
+ *
+ * @file shadow.h
+ * @author Emily Ng
+ * @date Mar 12 2016
+ */
+
+#ifndef __SHADOW_H
+#define __SHADOW_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <opencv2/core.hpp>
+
+#include "debug.h"
+
+using namespace cv;
+
+// Kinds of check.
+#define SHADOW_GRAY 0
+#define SHADOW_SOBEL 1
+#define SHADOW_LABELS 2
+#define SHADOW_HU 3
+#define SHADOW_MORPH 4
+#define SHADOW_KINDS 5
+
+// Mean absolute difference per pixel above which images diverge.
+#define SHADOW_GRAY_TOL (1.0)
+#define SHADOW_SOBEL_TOL (1.0)
+
+// Relative difference above which Hu moments diverge.
+#define SHADOW_HU_TOL (1e-3)
+
+// Checks queued at most, enough for the objects of a frame.  Further checks
+// are dropped.
+#define SHADOW_QUEUE 64
+
+struct shadow_stats {
+    unsigned int sampled;       // checks of the frames picked
+    unsigned int dropped;       // checks dropped, queue full
+    unsigned int checked;       // checks completed
+    unsigned int diverged;      // checks that found a divergence
+    double diff;                // sum of differences found by checks
+};
+
+class ShadowVerifier {
+public:
+    ShadowVerifier(int rate);
+    ~ShadowVerifier();
+
+    bool sampleFrame();
+
+    void verifyGray(const Mat &src, const Mat &ours);
+    void verifySobel(const Mat &src, const Mat &ours);
+    void verifyLabels(const Mat &src, const Mat &ours);
+    void verifyHu(const Mat &src, const double ours[7]);
+    void verifyContourHu(const Mat &src, const double ours[7]);
+    void verifyMorph(const Mat &src, const Mat &ours, int op, int w, int h);
+
+    struct shadow_stats stats(int kind);
+    void report();
+
+private:
+    void queue(int kind, const std::function<double()> &check, double tol);
+    void workerLoop();
+
+    const int rate;
+    std::atomic<unsigned int> frames;
+    struct shadow_stats counters[SHADOW_KINDS];
+    std::mutex counters_lock;
+
+    std::deque<std::function<void()> > jobs;
+    std::mutex jobs_lock;
+    std::condition_variable jobs_ready;
+    bool stop;
+    std::thread worker;
+};
+
+#endif
@@ -0,0 +1,192 @@
+/**
+ * Database of reference shapes.
+ *
+ * @file shape_db.cpp
+ * @author Emily Ng
+ * @date Apr 12 2016
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "contour.h"
+#include "img_proc.h"
+#include "shape_db.h"
+
+/**
+ * Describe the first shape in a binary image with `objectMoments`, as
+ * `moment_invariants` describes an object.  Label and source are left empty.
+ *
+ * @return 0 on success, -1 if the image is empty.
+ */
+int shapeDescriptor(const Mat &binary, struct shape_record &dst)
+{
+    struct _moment m;
+
+    if (objectMoments(binary, m) < 0) {
+        return -1;
+    }
+
+    memset(&dst, 0, sizeof(dst));
+    for (int j = 0; j < 7; j++) {
+        dst.hu[j] = m.hu[j];
+    }
+    dst.area = m.m00 / WHITE;
+
+    return 0;
+}
+
+/**
+ * Write a database of \p src.
+ *
+ * The file is written next to \p path and renamed over it, so a reader never
+ * maps a file that is half written.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int writeShapeDb(const char *path, const std::vector<struct shape_record> &src)
+{
+    const std::string tmp = std::string(path) + ".tmp";
+    struct shape_db_header h;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SHAPE_MAGIC, 4);
+    h.version = SHAPE_VERSION;
+    h.record_size = sizeof(struct shape_record);
+    h.num_shapes = src.size();
+
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (!fp) {
+        ELOG("cannot create %s", tmp.c_str());
+        return -1;
+    }
+
+    bool ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+    if (ok && src.size()) {
+        ok = fwrite(&src[0], sizeof(struct shape_record), src.size(), fp)
+            == src.size();
+    }
+    ok = !fclose(fp) && ok;
+
+    if (!ok || rename(tmp.c_str(), path)) {
+        ELOG("cannot write %s", path);
+        unlink(tmp.c_str());
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Map a database.  Nothing is read beyond the header until shapes are used.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int openShapeDb(const char *path, struct shape_db *db)
+{
+    db->base = NULL;
+    db->size = 0;
+    db->num_shapes = 0;
+    db->record_size = 0;
+
+    db->fd = open(path, O_RDONLY);
+    if (db->fd < 0) {
+        ELOG("cannot open %s", path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(db->fd, &st) || st.st_size < (off_t)sizeof(shape_db_header)) {
+        ELOG("%s is not a shape database", path);
+        closeShapeDb(db);
+        return -1;
+    }
+    db->size = st.st_size;
+
+    void *base = mmap(NULL, db->size, PROT_READ, MAP_PRIVATE, db->fd, 0);
+    if (base == MAP_FAILED) {
+        ELOG("cannot map %s", path);
+        db->size = 0;
+        closeShapeDb(db);
+        return -1;
+    }
+    db->base = (const uint8_t *)base;
+
+    const struct shape_db_header *h = (const struct shape_db_header *)base;
+
+    if (memcmp(h->magic, SHAPE_MAGIC, 4)
+            || h->record_size < sizeof(struct shape_record)
+            || sizeof(*h) + (size_t)h->num_shapes * h->record_size
+                > db->size) {
+        ELOG("%s is not a shape database, or is cut short", path);
+        closeShapeDb(db);
+        return -1;
+    }
+
+    db->num_shapes = h->num_shapes;
+    db->record_size = h->record_size;
+
+    DLOG("%s: %u shapes, version %u", path, db->num_shapes, h->version);
+
+    return 0;
+}
+
+/**
+ * Unmap a database opened by `openShapeDb`.
+ *
+ * Invalidates every pointer returned by `shapeRecord`.
+ */
+void closeShapeDb(struct shape_db *db)
+{
+    if (db->base) munmap((void *)db->base, db->size);
+    if (db->fd >= 0) close(db->fd);
+
+    db->fd = -1;
+    db->base = NULL;
+    db->size = 0;
+    db->num_shapes = 0;
+    db->record_size = 0;
+}
+
+/**
+ * Shape \p k, in place.
+ */
+const struct shape_record *shapeRecord(const struct shape_db *db, uint32_t k)
+{
+    if (k >= db->num_shapes) return NULL;
+
+    const uint8_t *p = db->base + sizeof(struct shape_db_header);
+    return (const struct shape_record *)(p + (size_t)k * db->record_size);
+}
+
+/**
+ * Closest reference shape to \p hu, by `huDistance`.
+ *
+ * @param score     Set to the `compareHu` score of the match, 0 if none.
+ * @return Index of the shape, or -1 if the database is empty.
+ */
+int matchShape(const struct shape_db *db, const double hu[7],
+        unsigned int *score)
+{
+    double best_d = 0;
+    int best = -1;
+
+    for (uint32_t k = 0; k < db->num_shapes; k++) {
+        const double d = huDistance(shapeRecord(db, k)->hu, hu);
+
+        // NaN, from moments of zero, never matches.
+        if (d == d && (best < 0 || d < best_d)) {
+            best = k;
+            best_d = d;
+        }
+    }
+
+    *score = (best < 0) ? 0 : (unsigned int)best_d;
+
+    return best;
+}
@@ -0,0 +1,69 @@
+/**
+ * Database of reference shapes.
+ *
+ * Reference shapes are described once, offline, by `BuildShapeDb`, and kept
+ * in a file of fixed-size records: a header followed by one record per shape
+ * with its Hu moments, a label and the image it came from.  The file is
+ * mapped and used in place, so opening it costs the same however many shapes
+ * it holds.
+ *
+ * The header gives the size of a record, so readers skip fields added by
+ * later versions.
+ *
+ * @file shape_db.h
+ * @author Emily Ng
+ * @date Apr 12 2016
+ */
+
+#ifndef __SHAPE_DB_H
+#define __SHAPE_DB_H
+
+#include <stdint.h>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "debug.h"
+
+using namespace cv;
+
+// magic at the start of the file
+#define SHAPE_MAGIC "SHP0"
+
+// format of the records written
+#define SHAPE_VERSION 1
+
+#define SHAPE_LABEL 32
+#define SHAPE_SOURCE 64
+
+struct shape_db_header {
+    char magic[4];
+    uint16_t version;
+    uint16_t record_size;       // bytes per shape record
+    uint32_t num_shapes;
+    uint32_t pad;
+};
+
+struct shape_record {
+    double hu[7];
+    double area;                // pixels enclosed
+    char label[SHAPE_LABEL];    // NUL terminated
+    char source[SHAPE_SOURCE];  // image the shape came from, NUL terminated
+};
+
+struct shape_db {
+    int fd;
+    const uint8_t *base;
+    size_t size;
+    uint32_t num_shapes;
+    uint16_t record_size;
+};
+
+int shapeDescriptor(const Mat &binary, struct shape_record &dst);
+int writeShapeDb(const char *path, const std::vector<struct shape_record> &src);
+int openShapeDb(const char *path, struct shape_db *db);
+void closeShapeDb(struct shape_db *db);
+const struct shape_record *shapeRecord(const struct shape_db *db, uint32_t k);
+int matchShape(const struct shape_db *db, const double hu[7],
+        unsigned int *score);
+
+#endif
@@ -0,0 +1,348 @@
+/**
+ * Line-buffered edge detection.
+ *
+ * @file stream.cpp
+ * @author Emily Ng
+ * @date Mar 16 2016
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#include "img_proc.h"
+#include "orient.h"
+#include "stream.h"
+
+/**
+ * Gray values of one row, as `rgb2g` computes them.
+ */
+static void grayRow(const uchar *src, uchar *dst, int cols)
+{
+    for (int j = 0; j < cols; j++) {
+        const uchar *p = &src[j * COLOR];
+
+        // NB: endianness causes RGB to be stored as BGR
+        dst[j] = saturate_cast<uchar>(
+            B_WEIGHT * p[BLUE]
+            + G_WEIGHT * p[GREEN]
+            + R_WEIGHT * p[RED]);
+    }
+}
+
+/**
+ * Thresholded Sobel magnitude of one row, from the gray rows above, at and
+ * below it.
+ *
+ * `combine` keeps the integer part of the magnitude, saturated, so the
+ * magnitude is above \p thresh exactly when the sum of squares is at least
+ * (thresh + 1)^2.  This avoids the square root.
+ *
+ * With BINS, the orientation bin of each pixel goes to \p bins, from the
+ * signed gradient before it is saturated.
+ */
+template<bool BINS>
+static void edgeRow(const uchar *above, const uchar *row, const uchar *below,
+        uchar *dst, uchar *bins, int cols, int thresh)
+{
+    // Saturated magnitudes never exceed WHITE.
+    const int limit = (thresh >= WHITE) ? 2 * WHITE * WHITE + 1
+        : (thresh + 1) * (thresh + 1);
+
+    dst[0] = BLACK;
+    dst[cols - 1] = BLACK;
+    if (BINS) {
+        bins[0] = 0;
+        bins[cols - 1] = 0;
+    }
+
+    if (thresh >= WHITE && !BINS) {
+        memset(dst, BLACK, cols);
+        return;
+    }
+
+    for (int j = 1; j < cols - 1; j++) {
+        int x = (above[j + 1] - above[j - 1])
+            + 2 * (row[j + 1] - row[j - 1])
+            + (below[j + 1] - below[j - 1]);
+        int y = (below[j - 1] - above[j - 1])
+            + 2 * (below[j] - above[j])
+            + (below[j + 1] - above[j + 1]);
+
+        if (BINS) bins[j] = orientBin(x, y);
+
+        // As `applyKernel`: absolute value, saturated to 8 bits.
+        x = abs(x);
+        y = abs(y);
+        x = (x > WHITE) ? WHITE : x;
+        y = (y > WHITE) ? WHITE : y;
+
+        dst[j] = (x * x + y * y >= limit) ? WHITE : BLACK;
+    }
+}
+
+/**
+ * Sobel magnitude of one row, as `combine` with `hypoteneuse` computes it:
+ * the integer part, saturated.  Border pixels are 0.  With BINS, orientation
+ * bins go to \p bins as for `edgeRow`.
+ */
+template<bool BINS>
+static void magnitudeRow(const uchar *above, const uchar *row,
+        const uchar *below, uchar *dst, uchar *bins, int cols)
+{
+    dst[0] = BLACK;
+    dst[cols - 1] = BLACK;
+    if (BINS) {
+        bins[0] = 0;
+        bins[cols - 1] = 0;
+    }
+
+    for (int j = 1; j < cols - 1; j++) {
+        int x = (above[j + 1] - above[j - 1])
+            + 2 * (row[j + 1] - row[j - 1])
+            + (below[j + 1] - below[j - 1]);
+        int y = (below[j - 1] - above[j - 1])
+            + 2 * (below[j] - above[j])
+            + (below[j + 1] - above[j + 1]);
+
+        if (BINS) bins[j] = orientBin(x, y);
+
+        x = abs(x);
+        y = abs(y);
+        x = (x > WHITE) ? WHITE : x;
+        y = (y > WHITE) ? WHITE : y;
+
+        // Exact: sums of squares are below 2^24, and no square root of one
+        // is within float rounding of the next integer.
+        const int m = (int)sqrtf((float)(x * x + y * y));
+        dst[j] = (m > WHITE) ? WHITE : m;
+    }
+}
+
+/**
+ * Threshold a row of magnitudes in place.
+ */
+static void thresholdRow(uchar *row, int cols, int thresh)
+{
+    for (int j = 0; j < cols; j++) {
+        row[j] = (row[j] > thresh) ? WHITE : BLACK;
+    }
+}
+
+template<class Fn>
+static void forBands(ThreadPool *pool, int bands, const Fn &fn)
+{
+    if (pool) parallelFor(*pool, 0, bands, fn);
+    else for (int b = 0; b < bands; b++) fn(b);
+}
+
+/**
+ * Detect edges, passing each row of the binary result to a callback.
+ *
+ * Border rows and columns are BLACK, as `applyKernel` leaves them.
+ *
+ * @param src       Color image.
+ * @param thresh    Pixels with Sobel magnitude above \p thresh are edges.
+ * @param fn        Called once per row, in order.
+ * @param data      Passed to \p fn.
+ */
+void streamEdges(const Mat &src, int thresh, edge_row_fn fn, void *data)
+{
+    PERF_SCOPE("streamEdges", src.total());
+    assert(src.type() == CV_8UC3);
+
+    const int rows = src.rows;
+    const int cols = src.cols;
+
+    // Ring of three gray rows, and one binary row.
+    std::vector<uchar> buf(4 * cols);
+    uchar *ring[3] = { &buf[0], &buf[cols], &buf[2 * cols] };
+    uchar *binary = &buf[3 * cols];
+
+    memset(binary, BLACK, cols);
+
+    if (rows < 3 || cols < 3) {
+        for (int i = 0; i < rows; i++) {
+            fn(i, binary, cols, data);
+        }
+        return;
+    }
+
+    grayRow(src.ptr<uchar>(0), ring[0], cols);
+    grayRow(src.ptr<uchar>(1), ring[1], cols);
+
+    fn(0, binary, cols, data);
+
+    for (int i = 1; i < rows - 1; i++) {
+        uchar *above = ring[(i - 1) % 3];
+        uchar *row = ring[i % 3];
+        uchar *below = ring[(i + 1) % 3];
+
+        grayRow(src.ptr<uchar>(i + 1), below, cols);
+        edgeRow<false>(above, row, below, binary, NULL, cols, thresh);
+
+        fn(i, binary, cols, data);
+    }
+
+    memset(binary, BLACK, cols);
+    fn(rows - 1, binary, cols, data);
+}
+
+static void copyRow(int row, const uchar *binary, int cols, void *data)
+{
+    Mat *dst = (Mat *)data;
+    memcpy(dst->ptr<uchar>(row), binary, cols);
+}
+
+/**
+ * Detect edges into a binary image.
+ *
+ * @param src       Color image.
+ * @param dst       Binary image, WHITE at edges.
+ * @param thresh    Pixels with Sobel magnitude above \p thresh are edges.
+ */
+void streamEdges(const Mat &src, Mat &dst, int thresh)
+{
+    dst.create(src.rows, src.cols, CV_8UC1);
+    streamEdges(src, thresh, copyRow, &dst);
+}
+
+/**
+ * Detect edges into a binary image, with the threshold picked by \p rule.
+ *
+ * Bands of rows run on \p pool, if given, each with its own ring of gray
+ * rows.  A fixed threshold is applied as rows are computed.  Otherwise each
+ * band writes the Sobel magnitude into \p dst and counts the row into a
+ * histogram of its own while it is still in L1.  Once the histograms are
+ * summed and the threshold picked, \p dst is thresholded in place, one
+ * compare per pixel.  The magnitude is never stored anywhere else.
+ *
+ * The histogram counts border pixels as 0, so the threshold is the one the
+ * rule picks from the histogram of the whole Sobel image.
+ *
+ * With \p orient, the orientation bin of every pixel is written there in the
+ * same pass, from the signed gradient the magnitude is computed from.
+ *
+ * Bands poll \p deadline every DEADLINE_CHECK_ROWS rows and stop once it
+ * expires, leaving \p dst unfinished.
+ *
+ * @param src       Color image.
+ * @param dst       Binary image, WHITE at edges.
+ * @param rule      How to pick the threshold.
+ * @param pool      Runs bands in parallel, if not NULL.
+ * @param deadline  Stops the work early, if not NULL.
+ * @param orient    Orientation bins, see orient.h, if not NULL.
+ * @param scratch   Rows of the bands, kept between calls, or NULL.
+ * @return Threshold applied, or -1 if \p deadline expired.
+ */
+int streamEdges(const Mat &src, Mat &dst, const struct thresh_rule &rule,
+        ThreadPool *pool, const Deadline *deadline, Mat *orient,
+        std::vector<uchar> *scratch)
+{
+    PERF_SCOPE("streamEdges", src.total());
+    assert(src.type() == CV_8UC3);
+
+    const int rows = src.rows;
+    const int cols = src.cols;
+    const bool fixed = rule.kind == THRESH_FIXED;
+    struct histogram hist;
+
+    dst.create(rows, cols, CV_8UC1);
+    if (orient) {
+        orient->create(rows, cols, CV_8UC1);    // kept if already this size
+        orient->setTo(Scalar::all(0));
+    }
+    clearHistogram(hist);
+
+    if (rows < 3 || cols < 3) {
+        for (int i = 0; i < rows; i++) {
+            memset(dst.ptr<uchar>(i), BLACK, cols);
+        }
+        hist.bins[BLACK] = hist.total = src.total();
+        return pickThreshold(hist, rule);
+    }
+
+    // Rows 1 .. rows - 2; the first and last stay BLACK.
+    const int inner = rows - 2;
+    const int bands = numBands(inner, pool);
+    std::vector<struct histogram> parts(fixed ? 0 : bands);
+    std::vector<uchar> local;
+    std::vector<uchar> &buf = scratch ? *scratch : local;
+
+    // Three gray rows per band.
+    buf.resize(3 * cols * bands);
+
+    forBands(pool, bands, [&](int b) {
+        const int begin = 1 + inner * b / bands;
+        const int end = 1 + inner * (b + 1) / bands;
+        uchar *band = &buf[3 * cols * b];
+        uchar *ring[3] = { band, band + cols, band + 2 * cols };
+
+        grayRow(src.ptr<uchar>(begin - 1), ring[(begin - 1) % 3], cols);
+        grayRow(src.ptr<uchar>(begin), ring[begin % 3], cols);
+        if (!fixed) clearHistogram(parts[b]);
+
+        for (int i = begin; i < end; i++) {
+            if ((i - begin) % DEADLINE_CHECK_ROWS == 0
+                    && pastDeadline(deadline)) {
+                return;
+            }
+
+            uchar *above = ring[(i - 1) % 3];
+            uchar *row = ring[i % 3];
+            uchar *below = ring[(i + 1) % 3];
+            uchar *out = dst.ptr<uchar>(i);
+            uchar *bins = orient ? orient->ptr<uchar>(i) : NULL;
+
+            grayRow(src.ptr<uchar>(i + 1), below, cols);
+
+            if (fixed && bins) {
+                edgeRow<true>(above, row, below, out, bins, cols,
+                        (int)rule.value);
+            }
+            else if (fixed) {
+                edgeRow<false>(above, row, below, out, NULL, cols,
+                        (int)rule.value);
+            }
+            else {
+                if (bins) {
+                    magnitudeRow<true>(above, row, below, out, bins, cols);
+                }
+                else {
+                    magnitudeRow<false>(above, row, below, out, NULL, cols);
+                }
+
+                histogramRow(out, cols, parts[b]);
+            }
+        }
+    });
+
+    memset(dst.ptr<uchar>(0), BLACK, cols);
+    memset(dst.ptr<uchar>(rows - 1), BLACK, cols);
+
+    if (pastDeadline(deadline)) return -1;
+    if (fixed) return (int)rule.value;
+
+    hist.bins[BLACK] = hist.total = 2 * cols;
+    for (int b = 0; b < bands; b++) {
+        addHistogram(hist, parts[b]);
+    }
+    const int thresh = pickThreshold(hist, rule);
+
+    forBands(pool, bands, [&](int b) {
+        const int begin = 1 + inner * b / bands;
+        const int end = 1 + inner * (b + 1) / bands;
+
+        for (int i = begin; i < end; i++) {
+            if ((i - begin) % DEADLINE_CHECK_ROWS == 0
+                    && pastDeadline(deadline)) {
+                return;
+            }
+
+            thresholdRow(dst.ptr<uchar>(i), cols, thresh);
+        }
+    });
+
+    return pastDeadline(deadline) ? -1 : thresh;
+}
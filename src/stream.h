@@ -0,0 +1,53 @@
+/**
+ * Line-buffered edge detection.
+ *
+ * Computes the same result as `rgb2g`, `applyKernel` with both Sobel kernels,
+ * `combine` with `hypoteneuse` and a binary threshold, but one row at a time.
+ * Only three rows of gray values are kept, in a ring buffer, so intermediate
+ * images never leave the cache.  Only the binary output is written out, or
+ * handed to a callback row by row.
+ *
+ * The threshold may also be picked per image, by Otsu's method or a
+ * percentile of the Sobel magnitude.  The histogram is counted in the same
+ * pass that computes the magnitude, band by band on a thread pool.  Bands
+ * give up at a row-band boundary once the deadline of the frame passes.
+ *
+ * The same pass can also emit the orientation bin of the gradient of every
+ * pixel, see orient.h.
+ *
+ * @file stream.h
+ * @author Emily Ng
+ * @date Mar 16 2016
+ */
+
+#ifndef __STREAM_H
+#define __STREAM_H
+
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "deadline.h"
+#include "debug.h"
+#include "histogram.h"
+#include "thread_pool.h"
+
+using namespace cv;
+
+/**
+ * Consumer of binary rows.
+ *
+ * @param row       Row index.
+ * @param binary    Row of WHITE / BLACK pixels, valid until the next call.
+ * @param cols      Number of pixels in \p binary.
+ * @param data      User data.
+ */
+typedef void (*edge_row_fn)(int row, const uchar *binary, int cols,
+        void *data);
+
+void streamEdges(const Mat &src, int thresh, edge_row_fn fn, void *data);
+void streamEdges(const Mat &src, Mat &dst, int thresh);
+int streamEdges(const Mat &src, Mat &dst, const struct thresh_rule &rule,
+        ThreadPool *pool = NULL, const Deadline *deadline = NULL,
+        Mat *orient = NULL, std::vector<uchar> *scratch = NULL);
+
+#endif
@@ -0,0 +1,249 @@
+/**
+ * Work-stealing thread pool.
+ *
+ * @file thread_pool.cpp
+ * @author Emily Ng
+ * @date Mar 09 2016
+ */
+
+#include <algorithm>
+
+#include "profile.h"
+#include "thread_pool.h"
+
+// Index of the pool worker running on this thread, -1 for other threads.
+static thread_local int current_worker = -1;
+static thread_local const ThreadPool *current_pool = NULL;
+
+/**
+ * @param num_threads   Number of workers.  0 for one per hardware thread.
+ */
+ThreadPool::ThreadPool(int num_threads)
+    : next_queue(0), queued(0), stop(false)
+{
+    if (num_threads <= 0) {
+        num_threads = std::thread::hardware_concurrency();
+    }
+    if (num_threads <= 0) {
+        num_threads = 1;
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        queues.push_back(new worker_queue);
+    }
+    for (int i = 0; i < num_threads; i++) {
+        threads.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(idle_lock);
+        stop = true;
+    }
+    idle.notify_all();
+
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    for (size_t i = 0; i < queues.size(); i++) {
+        delete queues[i];
+    }
+}
+
+/**
+ * Queue a task.  Workers push to their own deque, other threads pick one.
+ *
+ * @param task  Task.
+ * @param group Group the task belongs to, if not NULL.
+ */
+void ThreadPool::submit(std::function<void()> task, TaskGroup *group)
+{
+    int q = (current_pool == this) ? current_worker
+        : (int)(next_queue++ % queues.size());
+
+    {
+        worker_queue *w = queues[q];
+        std::lock_guard<std::mutex> guard(w->lock);
+
+        if (w->count == w->ring.size()) {
+            // Full: unroll into a ring twice the size.
+            std::vector<struct pool_task> ring(std::max(2 * w->count,
+                    (size_t)16));
+            for (size_t i = 0; i < w->count; i++) {
+                ring[i] = std::move(w->ring[(w->head + i) % w->ring.size()]);
+            }
+            w->ring.swap(ring);
+            w->head = 0;
+        }
+
+        struct pool_task &t =
+            w->ring[(w->head + w->count) % w->ring.size()];
+        t.fn = std::move(task);
+        t.group = group;
+        t.stage = currentStage();
+        w->count++;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(idle_lock);
+        queued++;
+    }
+    idle.notify_one();
+    progress.notify_all();
+}
+
+/**
+ * Take a task: the newest of our own, or else the oldest of another worker.
+ *
+ * @param self  Index of calling worker, or -1.
+ */
+bool ThreadPool::pop(int self, struct pool_task &task)
+{
+    const int n = queues.size();
+
+    if (self >= 0) {
+        worker_queue *q = queues[self];
+        std::lock_guard<std::mutex> guard(q->lock);
+
+        if (q->count) {
+            q->count--;
+            task = std::move(q->ring[(q->head + q->count) % q->ring.size()]);
+            queued--;
+            return true;
+        }
+    }
+
+    const int start = (self >= 0) ? self + 1 : 0;
+    for (int i = 0; i < n; i++) {
+        worker_queue *q = queues[(start + i) % n];
+        std::lock_guard<std::mutex> guard(q->lock);
+
+        if (q->count) {
+            task = std::move(q->ring[q->head]);
+            q->head = (q->head + 1) % q->ring.size();
+            q->count--;
+            queued--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Run \p task, charged to the stage it was queued from, whichever thread runs
+ * it, then count it done in its group.
+ */
+void ThreadPool::runTask(struct pool_task &task)
+{
+    const char *outer = currentStage();
+
+    setCurrentStage(task.stage);
+    task.fn();
+    setCurrentStage(outer);
+
+    // Captures go first, as the group may be gone once it is done.
+    task.fn = nullptr;
+    if (task.group) task.group->taskDone();
+}
+
+/**
+ * Run one pending task on the calling thread, if there is one.
+ *
+ * @return true if a task was run.
+ */
+bool ThreadPool::runPending()
+{
+    struct pool_task task;
+    int self = (current_pool == this) ? current_worker : -1;
+
+    if (!pop(self, task)) {
+        return false;
+    }
+
+    runTask(task);
+    return true;
+}
+
+/**
+ * Sleep until a task is queued or \p pending, the tasks of a group, drops to
+ * 0.  Called once there is nothing left to run.
+ */
+void ThreadPool::waitQueued(const std::atomic<int> &pending)
+{
+    std::unique_lock<std::mutex> guard(idle_lock);
+    progress.wait(guard, [this, &pending] {
+        return queued > 0 || pending == 0;
+    });
+}
+
+/**
+ * Wake the threads in `waitQueued` once the last task of a group is done.
+ */
+void ThreadPool::groupDone()
+{
+    {
+        // Taken after the count dropped, so a waiter that saw it before is
+        // already asleep, and is woken.
+        std::lock_guard<std::mutex> guard(idle_lock);
+    }
+    progress.notify_all();
+}
+
+void ThreadPool::workerLoop(int id)
+{
+    current_worker = id;
+    current_pool = this;
+
+    for (;;) {
+        struct pool_task task;
+
+        if (pop(id, task)) {
+            runTask(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(idle_lock);
+        idle.wait(guard, [this] { return stop || queued > 0; });
+        if (stop && queued == 0) {
+            return;
+        }
+    }
+}
+
+/**
+ * Run a task on the pool as part of this group.
+ */
+void TaskGroup::run(std::function<void()> task)
+{
+    pending++;
+    pool.submit(std::move(task), this);
+}
+
+/**
+ * Count a task of the group done, waking waiters on the last.
+ */
+void TaskGroup::taskDone()
+{
+    ThreadPool *p = &pool;
+
+    // The group may be gone as soon as pending is 0, so only the pool is used
+    // after.
+    if (--pending == 0) p->groupDone();
+}
+
+/**
+ * Wait for all tasks of this group, running pending tasks in the meantime.
+ * Once none is left to run, the tasks of the group are running on other
+ * threads, and this one sleeps rather than spins.
+ */
+void TaskGroup::wait()
+{
+    while (pending > 0) {
+        if (!pool.runPending()) {
+            pool.waitQueued(pending);
+        }
+    }
+}
@@ -0,0 +1,112 @@
+/**
+ * Work-stealing thread pool.
+ *
+ * Each worker owns a deque of tasks.  A worker runs its own tasks newest
+ * first and, when it runs dry, steals the oldest task of another worker.
+ * Tasks submitted from outside the pool are spread over the workers.
+ *
+ * Tasks are grouped by `TaskGroup`, which waits for its own tasks only.  A
+ * thread waiting on a group runs pending tasks instead of blocking, so tasks
+ * may themselves wait on nested groups.  With nothing left to run it sleeps
+ * until a task is queued or the last task of its group finishes.
+ *
+ * @file thread_pool.h
+ * @author Emily Ng
+ * @date Mar 09 2016
+ */
+
+#ifndef __THREAD_POOL_H
+#define __THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class TaskGroup;
+
+class ThreadPool {
+public:
+    ThreadPool(int num_threads = 0);
+    ~ThreadPool();
+
+    void submit(std::function<void()> task, TaskGroup *group = NULL);
+    bool runPending();
+    void waitQueued(const std::atomic<int> &pending);
+    void groupDone();
+    int size() const { return (int)threads.size(); }
+
+private:
+    // A queued task, the group it belongs to, if any, and the stage of the
+    // thread that queued it.
+    struct pool_task {
+        std::function<void()> fn;
+        TaskGroup *group;
+        const char *stage;
+    };
+
+    // Tasks of one worker, oldest first, in a ring that only grows, so that
+    // once it has grown queueing a task allocates nothing.
+    struct worker_queue {
+        std::mutex lock;
+        std::vector<struct pool_task> ring;
+        size_t head;
+        size_t count;
+
+        worker_queue() : head(0), count(0) {}
+    };
+
+    bool pop(int self, struct pool_task &task);
+    void runTask(struct pool_task &task);
+    void workerLoop(int id);
+
+    std::vector<worker_queue *> queues;
+    std::vector<std::thread> threads;
+
+    std::atomic<unsigned int> next_queue;
+    std::atomic<int> queued;
+    std::atomic<bool> stop;
+
+    std::mutex idle_lock;
+    std::condition_variable idle;       // workers, for queued tasks
+    std::condition_variable progress;   // `TaskGroup::wait`, for either
+};
+
+class TaskGroup {
+public:
+    TaskGroup(ThreadPool &pool) : pool(pool), pending(0) {}
+    ~TaskGroup() { wait(); }
+
+    void run(std::function<void()> task);
+    void wait();
+
+private:
+    friend class ThreadPool;
+
+    void taskDone();
+
+    ThreadPool &pool;
+    std::atomic<int> pending;
+};
+
+/**
+ * Call \p fn for each index in [\p begin, \p end) on the pool.
+ *
+ * A template, so that each task holds only a reference to \p fn and an index,
+ * which `std::function` keeps without allocating.
+ */
+template<class Fn>
+void parallelFor(ThreadPool &pool, int begin, int end, const Fn &fn)
+{
+    TaskGroup group(pool);
+
+    for (int i = begin; i < end; i++) {
+        group.run([&fn, i] { fn(i); });
+    }
+
+    group.wait();
+}
+
+#endif
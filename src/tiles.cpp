@@ -0,0 +1,354 @@
+/**
+ * Tiled edge detection and labeling of images too large for memory.
+ *
+ * @file tiles.cpp
+ * @author Emily Ng
+ * @date Apr 06 2016
+ */
+
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "rle.h"
+#include "stream.h"
+#include "tiles.h"
+
+// Sums of one label, before labels are merged.
+struct label_stats {
+    uint64_t area;
+    int top, left, bottom, right;
+    double sum_x, sum_y;
+    uint64_t first;             // order of first appearance
+};
+
+// State carried from tile to tile.  Labels are numbered from 0 again after
+// each band, so only those of the band and those still open are kept.
+struct stitcher {
+    std::vector<int> parent;            // union-find over labels
+    std::vector<struct label_stats> stats;
+    std::vector<int> above;             // labels of the row above the band
+    std::vector<int> next_above;        // labels of the last row of the band
+    std::vector<int> left;              // labels of the column left of the
+                                        // tile, for the rows of the band
+    uint64_t labels_seen;               // labels of all bands so far
+    size_t peak_labels;                 // most labels kept at once
+    std::vector<struct label_stats> done;       // finished components
+};
+
+static int findRoot(std::vector<int> &parent, int x)
+{
+    while (parent[x] != x) {
+        parent[x] = parent[parent[x]];
+        x = parent[x];
+    }
+    return x;
+}
+
+static void unite(std::vector<int> &parent, int a, int b)
+{
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+
+    if (a < b) parent[b] = a;
+    else if (b < a) parent[a] = b;
+}
+
+/**
+ * Give the pages of rows [r0, r1) of a mapped image back to the kernel.
+ * They are read from the file again if touched.
+ */
+static void releaseRows(const Mat &src, int r0, int r1)
+{
+    if (r0 >= r1) return;
+
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)src.ptr(r0);
+    uintptr_t end = (uintptr_t)src.ptr(r1 - 1) + src.step[0];
+
+    start = (start + page - 1) & ~(page - 1);
+    end &= ~(page - 1);
+
+    if (start < end) {
+        madvise((void *)start, end - start, MADV_DONTNEED);
+    }
+}
+
+/**
+ * Label the edges of one tile and merge its labels with those of the tiles
+ * above and to the left.
+ *
+ * @param src       Whole image.
+ * @param y0        Top of the tile.
+ * @param y1        Bottom of the tile, exclusive.
+ * @param x0        Left of the tile.
+ * @param x1        Right of the tile, exclusive.
+ * @param thresh    Sobel threshold.
+ * @param s         Labels and sums so far.
+ */
+static void processTile(const Mat &src, int y0, int y1, int x0, int x1,
+        int thresh, struct stitcher &s)
+{
+    const int h = y1 - y0;
+    const int w = x1 - x0;
+
+    // Read a halo of one pixel, so that Sobel sees the same neighbours as on
+    // the whole image.  At the image border there is none, and the border
+    // stays BLACK as it does on the whole image.
+    const int iy0 = (y0 > 0) ? y0 - 1 : 0;
+    const int iy1 = (y1 < src.rows) ? y1 + 1 : src.rows;
+    const int ix0 = (x0 > 0) ? x0 - 1 : 0;
+    const int ix1 = (x1 < src.cols) ? x1 + 1 : src.cols;
+
+    Mat binary;
+    streamEdges(src(Range(iy0, iy1), Range(ix0, ix1)), binary, thresh);
+
+    struct rle_mask runs;
+    std::vector<int> labels;
+
+    runLengthEncode(binary(Range(y0 - iy0, y1 - iy0),
+                Range(x0 - ix0, x1 - ix0)), runs);
+    const unsigned int n = labelRuns(runs, labels);
+
+    // Local label l is label base + l - 1 of the stitcher.
+    const int base = s.parent.size();
+    for (unsigned int l = 0; l < n; l++) {
+        struct label_stats st = { 0, src.rows, src.cols, 0, 0, 0, 0,
+            s.labels_seen++ };
+        s.parent.push_back(base + l);
+        s.stats.push_back(st);
+    }
+
+    std::vector<int> first_col(h, -1);
+    std::vector<int> last_col(h, -1);
+
+    for (size_t r = 0; r < runs.runs.size(); r++) {
+        const struct run &run = runs.runs[r];
+        const int g = base + labels[r] - 1;
+        const int y = y0 + run.row;
+        const int a = x0 + run.start;
+        const int b = x0 + run.end;
+        struct label_stats &st = s.stats[g];
+
+        const double len = b - a + 1;
+        st.area += len;
+        st.sum_x += len * (a + b) / 2;
+        st.sum_y += len * y;
+        st.top = (y < st.top) ? y : st.top;
+        st.bottom = (y + 1 > st.bottom) ? y + 1 : st.bottom;
+        st.left = (a < st.left) ? a : st.left;
+        st.right = (b + 1 > st.right) ? b + 1 : st.right;
+
+        // Top seam, including the pixels diagonally across tile corners.
+        if (run.row == 0 && y0 > 0) {
+            const int c0 = (a > 0) ? a - 1 : 0;
+            const int c1 = (b + 1 < src.cols) ? b + 1 : src.cols - 1;
+
+            for (int c = c0; c <= c1; c++) {
+                if (s.above[c] >= 0) unite(s.parent, g, s.above[c]);
+            }
+        }
+
+        if (run.row == h - 1) {
+            for (int c = a; c <= b; c++) {
+                s.next_above[c] = g;
+            }
+        }
+        if (run.start == 0) first_col[run.row] = g;
+        if (run.end == w - 1) last_col[run.row] = g;
+    }
+
+    // Left seam.
+    if (x0 > 0) {
+        for (int r = 0; r < h; r++) {
+            if (first_col[r] < 0) continue;
+
+            for (int k = r - 1; k <= r + 1; k++) {
+                if (k >= 0 && k < h && s.left[k] >= 0) {
+                    unite(s.parent, first_col[r], s.left[k]);
+                }
+            }
+        }
+    }
+
+    s.left.swap(last_col);
+}
+
+/**
+ * Add the sums of \p b to those of \p a.
+ */
+static void addStats(struct label_stats &a, const struct label_stats &b)
+{
+    a.area += b.area;
+    a.sum_x += b.sum_x;
+    a.sum_y += b.sum_y;
+    a.top = (b.top < a.top) ? b.top : a.top;
+    a.bottom = (b.bottom > a.bottom) ? b.bottom : a.bottom;
+    a.left = (b.left < a.left) ? b.left : a.left;
+    a.right = (b.right > a.right) ? b.right : a.right;
+    a.first = (b.first < a.first) ? b.first : a.first;
+}
+
+/**
+ * Fold the sums of every label into its root, once a band is done.  Roots
+ * with no pixel on the last row of the band cannot grow any more, so they go
+ * to the finished components.  The others are numbered from 0 again, in
+ * order, and the row above the next band is relabeled to match.
+ */
+static void compactLabels(struct stitcher &s)
+{
+    const int n = s.parent.size();
+
+    s.peak_labels = (n > (int)s.peak_labels) ? n : s.peak_labels;
+
+    // Union by the lower label, so a root comes before its other labels.
+    for (int l = 0; l < n; l++) {
+        const int root = findRoot(s.parent, l);
+        if (root != l) addStats(s.stats[root], s.stats[l]);
+    }
+
+    std::vector<int> index(n, -1);
+    for (size_t c = 0; c < s.above.size(); c++) {
+        if (s.above[c] >= 0) index[findRoot(s.parent, s.above[c])] = 0;
+    }
+
+    int kept = 0;
+    for (int l = 0; l < n; l++) {
+        if (s.parent[l] != l) continue;
+
+        if (index[l] < 0) {
+            s.done.push_back(s.stats[l]);
+        }
+        else {
+            index[l] = kept;
+            s.stats[kept++] = s.stats[l];
+        }
+    }
+
+    for (size_t c = 0; c < s.above.size(); c++) {
+        if (s.above[c] >= 0) {
+            s.above[c] = index[findRoot(s.parent, s.above[c])];
+        }
+    }
+
+    s.stats.resize(kept);
+    s.parent.resize(kept);
+    for (int l = 0; l < kept; l++) {
+        s.parent[l] = l;
+    }
+}
+
+static bool firstSeen(const struct label_stats &a, const struct label_stats &b)
+{
+    return a.first < b.first;
+}
+
+static int tiledComponents(const Mat &src, int tile, int thresh, bool mapped,
+        std::vector<struct tile_component> &dst)
+{
+    if (src.type() != CV_8UC3 || tile < 1) {
+        ELOG("need a BGR image and a tile size of at least 1");
+        return -1;
+    }
+
+    struct stitcher s;
+
+    s.above.assign(src.cols, -1);
+    s.next_above.assign(src.cols, -1);
+    s.labels_seen = 0;
+    s.peak_labels = 0;
+
+    int released = 0;
+
+    for (int y0 = 0; y0 < src.rows; y0 += tile) {
+        const int y1 = (y0 + tile < src.rows) ? y0 + tile : src.rows;
+
+        for (int x0 = 0; x0 < src.cols; x0 += tile) {
+            const int x1 = (x0 + tile < src.cols) ? x0 + tile : src.cols;
+
+            processTile(src, y0, y1, x0, x1, thresh, s);
+        }
+
+        s.above.swap(s.next_above);
+        s.next_above.assign(src.cols, -1);
+        compactLabels(s);
+
+        // The next band reads one row above it.
+        if (mapped) {
+            releaseRows(src, released, y1 - 1);
+            released = y1 - 1;
+        }
+    }
+
+    // After the last band, every label left is a finished root.
+    s.done.insert(s.done.end(), s.stats.begin(), s.stats.end());
+    std::sort(s.done.begin(), s.done.end(), firstSeen);
+
+    dst.resize(s.done.size());
+    for (size_t k = 0; k < dst.size(); k++) {
+        const struct label_stats &st = s.done[k];
+        struct tile_component &c = dst[k];
+
+        c.area = st.area;
+        c.top = st.top;
+        c.left = st.left;
+        c.bottom = st.bottom;
+        c.right = st.right;
+        c.cx = st.sum_x / st.area;
+        c.cy = st.sum_y / st.area;
+    }
+
+    ILOG("%zu components over %d x %d tiles, at most %zu labels kept",
+            dst.size(), (src.rows + tile - 1) / tile,
+            (src.cols + tile - 1) / tile, s.peak_labels);
+
+    return 0;
+}
+
+/**
+ * Connected components of the edges of an image, tile by tile.
+ *
+ * Edges are as `streamEdges` finds them on the whole image, and components
+ * are 8-connected, numbered in order of first appearance in raster order of
+ * the tiles.
+ *
+ * @param src       Color image.
+ * @param tile      Side of a tile, in pixels.
+ * @param thresh    Pixels with Sobel magnitude above \p thresh are edges.
+ * @param dst       Components.
+ * @return 0 on success, -1 on error.
+ */
+int tiledComponents(const Mat &src, int tile, int thresh,
+        std::vector<struct tile_component> &dst)
+{
+    return tiledComponents(src, tile, thresh, false, dst);
+}
+
+/**
+ * Connected components of the edges of a mapped frame, tile by tile.
+ *
+ * Pages of the frame are released as soon as the tiles that read them are
+ * done, so only a band of tiles is resident at a time.  Pages written
+ * through the mapping are released too, so drawing on the frame is undone.
+ * The frame must be stored as BGR.
+ *
+ * @param ff        File from `openFrameFile`.
+ * @param n         Frame.
+ */
+int tiledComponents(const struct frame_file *ff, int n, int tile, int thresh,
+        std::vector<struct tile_component> &dst)
+{
+    Mat src;
+
+    if (readFrame(ff, n, src)) {
+        return -1;
+    }
+    if (ff->frames[n].layout != LAYOUT_MAT) {
+        ELOG("tiles need a raw BGR frame");
+        return -1;
+    }
+
+    return tiledComponents(src, tile, thresh, true, dst);
+}
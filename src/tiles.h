@@ -0,0 +1,49 @@
+/**
+ * Tiled edge detection and labeling of images too large for memory.
+ *
+ * The image is cut into tiles, each read with a one pixel halo so that Sobel
+ * gives the same result as on the whole image.  Edges of each tile are
+ * labeled on their own, and labels that touch across a tile seam are merged
+ * through a union-find.  After each band of tiles, labels are folded into
+ * their components, components that do not reach the last row of the band
+ * are finished, and the rest are numbered again.  Only the labels of one band
+ * and of the components open across its bottom seam are kept, so working
+ * memory depends on the tile size and the image width rather than on the
+ * image size, besides a few numbers per finished component for the result.
+ *
+ * @file tiles.h
+ * @author Emily Ng
+ * @date Apr 06 2016
+ */
+
+#ifndef __TILES_H
+#define __TILES_H
+
+#include <stdint.h>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "debug.h"
+#include "frame_io.h"
+
+using namespace cv;
+
+// Default side of a tile, in pixels.
+#define TILE_SIZE 1024
+
+struct tile_component {
+    uint64_t area;              // pixels
+    int top;                    // bounding box, bottom and right exclusive
+    int left;
+    int bottom;
+    int right;
+    double cx;                  // centroid
+    double cy;
+};
+
+int tiledComponents(const Mat &src, int tile, int thresh,
+        std::vector<struct tile_component> &dst);
+int tiledComponents(const struct frame_file *ff, int n, int tile, int thresh,
+        std::vector<struct tile_component> &dst);
+
+#endif
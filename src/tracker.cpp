@@ -0,0 +1,217 @@
+/**
+ * Tracking of objects from frame to frame.
+ *
+ * @file tracker.cpp
+ * @author Emily Ng
+ * @date Apr 26 2016
+ */
+
+#include <algorithm>
+#include <math.h>
+
+#include "tracker.h"
+
+// Buckets of the grid, at least.
+#define TRACK_MIN_BUCKETS 64
+
+/**
+ * Bucket of grid cell (\p gx, \p gy), with \p mask one less than the number
+ * of buckets, a power of two.
+ */
+static int cellBucket(int gx, int gy, int mask)
+{
+    return ((uint32_t)gx * 73856093u ^ (uint32_t)gy * 19349663u) & mask;
+}
+
+/**
+ * Where track \p t is expected next, having moved on since it was last seen.
+ */
+static void predict(const struct track &t, double &x, double &y)
+{
+    x = t.cx + t.vx * (t.misses + 1);
+    y = t.cy + t.vy * (t.misses + 1);
+}
+
+/**
+ * @param gate          Furthest an object may be from where a track is
+ *                      expected, in pixels.  Also the width of grid cells.
+ * @param max_misses    Frames a track goes unmatched before it ends.
+ */
+Tracker::Tracker(double gate, int max_misses)
+    : gate(gate), max_misses(max_misses), next_id(1), frames(0), started(0),
+      ended(0), continued(0)
+{
+}
+
+/**
+ * Bucket every track by where it is expected.
+ */
+void Tracker::buildGrid()
+{
+    size_t buckets = TRACK_MIN_BUCKETS;
+    while (buckets < 2 * tracks.size()) buckets *= 2;
+
+    heads.assign(buckets, -1);
+    chain.resize(tracks.size());
+
+    for (size_t t = 0; t < tracks.size(); t++) {
+        double x, y;
+        predict(tracks[t], x, y);
+
+        const int b = cellBucket((int)floor(x / gate), (int)floor(y / gate),
+                buckets - 1);
+        chain[t] = heads[b];
+        heads[b] = t;
+    }
+}
+
+/**
+ * Match the objects of the next frame to tracks, and set the track, velocity
+ * and age of each.  Objects without an outline are not tracked, and get
+ * track 0.
+ */
+void Tracker::update(ObjectTable &objs)
+{
+    const int n = objs.size();
+
+    frames++;
+    buildGrid();
+
+    const int mask = heads.size() - 1;
+
+    // Pairs within the gate, from the 3 x 3 cells around each object.  Cells
+    // that share a bucket may give a pair twice, which does no harm.
+    pairs.clear();
+    for (int i = 0; i < n; i++) {
+        if (!objs.valid[i]) continue;
+
+        const int gx = (int)floor(objs.cx[i] / gate);
+        const int gy = (int)floor(objs.cy[i] / gate);
+
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                const int b = cellBucket(gx + dx, gy + dy, mask);
+
+                for (int t = heads[b]; t >= 0; t = chain[t]) {
+                    double x, y;
+                    predict(tracks[t], x, y);
+
+                    const double ex = objs.cx[i] - x;
+                    const double ey = objs.cy[i] - y;
+                    const double d2 = ex * ex + ey * ey;
+
+                    if (d2 <= gate * gate) {
+                        struct pair p = { d2, i, t };
+                        pairs.push_back(p);
+                    }
+                }
+            }
+        }
+    }
+
+    // Nearest first.  Ties go by index, so runs are repeatable.
+    std::sort(pairs.begin(), pairs.end(),
+            [](const struct pair &a, const struct pair &b) {
+        if (a.d2 != b.d2) return a.d2 < b.d2;
+        if (a.obj != b.obj) return a.obj < b.obj;
+        return a.track < b.track;
+    });
+
+    taken.assign(tracks.size(), -1);
+    matched.assign(n, -1);
+    for (size_t k = 0; k < pairs.size(); k++) {
+        const struct pair &p = pairs[k];
+
+        if (taken[p.track] >= 0 || matched[p.obj] >= 0) continue;
+        taken[p.track] = p.obj;
+        matched[p.obj] = p.track;
+    }
+
+    // Continue or age the tracks, in order, so ids stay sorted.
+    kept.clear();
+    for (size_t t = 0; t < tracks.size(); t++) {
+        struct track tr = tracks[t];
+        const int i = taken[t];
+
+        if (i < 0) {
+            if ((int)++tr.misses > max_misses) {
+                ended++;
+                continue;
+            }
+            tr.age++;
+            kept.push_back(tr);
+            continue;
+        }
+
+        // Steps over missed frames are spread across them.
+        const double sx = (objs.cx[i] - tr.cx) / (tr.misses + 1);
+        const double sy = (objs.cy[i] - tr.cy) / (tr.misses + 1);
+
+        if (tr.age == 1) {
+            tr.vx = sx;
+            tr.vy = sy;
+        }
+        else {
+            tr.vx += TRACK_VELOCITY_GAIN * (sx - tr.vx);
+            tr.vy += TRACK_VELOCITY_GAIN * (sy - tr.vy);
+        }
+        tr.cx = objs.cx[i];
+        tr.cy = objs.cy[i];
+        tr.age++;
+        tr.misses = 0;
+        continued++;
+
+        matched[i] = kept.size();
+        kept.push_back(tr);
+    }
+
+    // Objects left over start tracks.
+    for (int i = 0; i < n; i++) {
+        if (!objs.valid[i] || matched[i] >= 0) continue;
+
+        struct track tr;
+
+        tr.id = next_id++;
+        tr.cx = objs.cx[i];
+        tr.cy = objs.cy[i];
+        tr.vx = 0;
+        tr.vy = 0;
+        tr.age = 1;
+        tr.misses = 0;
+        started++;
+
+        matched[i] = kept.size();
+        kept.push_back(tr);
+    }
+
+    tracks.swap(kept);
+
+    for (int i = 0; i < n; i++) {
+        if (matched[i] < 0) {
+            objs.track[i] = 0;
+            objs.vx[i] = 0;
+            objs.vy[i] = 0;
+            objs.track_age[i] = 0;
+            continue;
+        }
+
+        const struct track &tr = tracks[matched[i]];
+
+        objs.track[i] = tr.id;
+        objs.vx[i] = tr.vx;
+        objs.vy[i] = tr.vy;
+        objs.track_age[i] = tr.age;
+    }
+}
+
+/**
+ * Log tracks started, continued and ended.
+ */
+void Tracker::report()
+{
+    if (!frames) return;
+
+    ILOG("tracker: %lu frames, %lu tracks started, %lu continued, %lu ended, "
+            "%lu live", frames, started, continued, ended,
+            (unsigned long)tracks.size());
+}
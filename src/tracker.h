@@ -0,0 +1,106 @@
+/**
+ * Tracking of objects from frame to frame.
+ *
+ * Each track remembers where its object was last seen, how fast it moves
+ * and how long it has been followed.  The objects of a new frame are matched
+ * to tracks by centroid: a track is expected at its last centroid plus its
+ * velocity, and an object within the gate of that point may continue it.
+ *
+ * Expected positions are bucketed in a uniform grid, one gate wide, hashed
+ * into a table of chains.  An object only looks at the 3 x 3 cells around
+ * it, so matching costs O(n) on average however many objects there are,
+ * rather than comparing every object with every track.  The candidate pairs
+ * are then taken nearest first, so each track continues at most one object.
+ *
+ * Objects no track takes start new tracks, with ids never reused.  Tracks
+ * that go unmatched for more than TRACK_MAX_MISSES frames end.  The grid,
+ * chains and pairs keep their storage from frame to frame.
+ *
+ * @file tracker.h
+ * @author Emily Ng
+ * @date Apr 26 2016
+ */
+
+#ifndef __TRACKER_H
+#define __TRACKER_H
+
+#include <stdint.h>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "debug.h"
+#include "objects.h"
+
+using namespace cv;
+
+// Furthest an object may be from where a track is expected, in pixels.
+#define TRACK_GATE 48
+
+// Frames a track goes unmatched before it ends.
+#define TRACK_MAX_MISSES 5
+
+// Weight of the latest step in the velocity of a track.
+#define TRACK_VELOCITY_GAIN 0.5
+
+struct track {
+    uint32_t id;
+    double cx;                  // centroid when last matched
+    double cy;
+    double vx;                  // pixels per frame
+    double vy;
+    uint32_t age;               // frames since it started
+    uint32_t misses;            // frames since last matched
+};
+
+class Tracker {
+public:
+    Tracker(double gate = TRACK_GATE, int max_misses = TRACK_MAX_MISSES);
+
+    void update(ObjectTable &objs);
+    size_t size() const { return tracks.size(); }
+    void report();
+
+private:
+    struct pair {
+        double d2;              // squared distance
+        int obj;
+        int track;
+    };
+
+    void buildGrid();
+
+    const double gate;
+    const int max_misses;
+    uint32_t next_id;
+
+    std::vector<struct track> tracks;
+    std::vector<int> heads;             // first track of each bucket, or -1
+    std::vector<int> chain;             // next track in the same bucket
+    std::vector<struct pair> pairs;
+    std::vector<int> taken;             // object of each track, or -1
+    std::vector<int> matched;           // track of each object, or -1
+    std::vector<struct track> kept;
+
+    // statistics
+    unsigned long frames;
+    unsigned long started;
+    unsigned long ended;
+    unsigned long continued;
+};
+
+/**
+ * Color of label or track \p id, the same on every run.  Label 0 is black.
+ */
+static inline Vec3b labelColor(uint32_t id)
+{
+    if (!id) return Vec3b(0, 0, 0);
+
+    // Spread neighboring ids apart, and keep clear of black.
+    uint32_t h = id * 2654435761u;
+    h ^= h >> 15;
+
+    return Vec3b(64 + (h & 255) * 3 / 4, 64 + ((h >> 8) & 255) * 3 / 4,
+            64 + ((h >> 16) & 255) * 3 / 4);
+}
+
+#endif
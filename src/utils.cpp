@@ -6,17 +6,26 @@
  * @date Feb 15 2016
  */
 
+#include <mutex>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "debug.h"
+#include "display.h"
 #include "utils.h"
 
+// Top of the next row of images.  Rows may be posted from any thread.
+static std::mutex row_lock;
+static int row_y = 0;
+
 /**
  * Display row of images side by side.
  *
- * Calls to this method move a global position forward, so that subsequent rows
- * of images appear below the current one.
+ * Calls to this method move a position forward, so that subsequent rows of
+ * images appear below the current one.  Images are posted to the display
+ * thread, see `DisplaySink`, so this returns without waiting for them to be
+ * shown.
 
  * @param window_name   Name for image window.
  * @param n             Number of images to show.
@@ -30,9 +39,12 @@ void displayImageRow(const char *window_name, int n, ...)
     va_start(args, n);
 
     char buf[256];
+    int x = 0;
     int X_INC = 0;
     int Y_INC = 0;
 
+    std::lock_guard<std::mutex> guard(row_lock);
+
     for (int i = 0; i < n; i++) {
         Mat *img = va_arg(args, Mat*);
 
@@ -48,25 +60,19 @@ void displayImageRow(const char *window_name, int n, ...)
         strcpy(buf, window_name);
         sprintf(buf+strlen(buf), " %d", i);
 
-        namedWindow(buf, WINDOW_AUTOSIZE );
-        Mat I = *img;
-        imshow(buf, I);
-        moveWindow(buf, x, y);
+        displaySink().post(buf, *img, Point(x, row_y));
         x += X_INC;
     }
 
-    x = 0;
-    y += Y_INC;
+    row_y += Y_INC;
 
     va_end(args);
 
-    waitKey(0);
-
     return;
 }
 
 void resetDisplayPosition()
 {
-    x = 0;
-    y = 0;
+    std::lock_guard<std::mutex> guard(row_lock);
+    row_y = 0;
 };
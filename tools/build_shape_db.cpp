@@ -0,0 +1,163 @@
+/**
+ * Build a database of reference shapes from a directory of images.
+ *
+ * Each image should hold one shape.  Its edges are found as `DisplayImage`
+ * finds them, with the same threshold (-t) and closing (-M), and are split
+ * into objects the same way.  The largest object is described as objects are
+ * at run time, so the database can be matched against them.  Give the same
+ * -t and -M as `DisplayImage` is run with.  A shape is labeled with the name
+ * of its image, less the extension.
+ *
+ *     BuildShapeDb [-t thresh|otsu|p<pct>] [-M close_w[xclose_h]] <out.db>
+ *             <dir> [<dir> ...]
+ *
+ * @file build_shape_db.cpp
+ * @author Emily Ng
+ * @date Apr 12 2016
+ */
+
+#include <algorithm>
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "debug.h"
+#include "histogram.h"
+#include "morph.h"
+#include "objects.h"
+#include "shape_db.h"
+#include "stream.h"
+
+// Threshold applied to the Sobel magnitude, as in `DisplayImage`.
+#define EDGE_THRESH 150
+
+/**
+ * Describe the largest object of the edges \p binary, by the area its outline
+ * encloses.
+ *
+ * @return 0, or -1 if there is no object.
+ */
+static int largestShape(const Mat &binary, ObjectTable &objs,
+        struct shape_record &dst)
+{
+    int found = -1;
+
+    isolateObjects(binary, NULL, objs);
+    for (int i = 0; i < objs.size(); i++) {
+        struct shape_record s;
+        const Range rows(objs.top[i], objs.bottom[i]);
+        const Range cols(objs.left[i], objs.right[i]);
+
+        if (shapeDescriptor(binary(rows, cols), s)) continue;
+        if (found == 0 && s.area <= dst.area) continue;
+
+        dst = s;
+        found = 0;
+    }
+
+    return found;
+}
+
+/**
+ * Append the paths of the files in \p dir to \p dst, sorted so that the
+ * database does not depend on the order of the directory.
+ */
+static int listDir(const char *dir, std::vector<std::string> &dst)
+{
+    DIR *d = opendir(dir);
+    if (!d) {
+        ELOG("cannot open %s", dir);
+        return -1;
+    }
+
+    std::vector<std::string> names;
+    struct dirent *e;
+    while ((e = readdir(d))) {
+        if (e->d_name[0] != '.') names.push_back(e->d_name);
+    }
+    closedir(d);
+
+    std::sort(names.begin(), names.end());
+    for (size_t i = 0; i < names.size(); i++) {
+        dst.push_back(std::string(dir) + "/" + names[i]);
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    struct thresh_rule rule = { THRESH_FIXED, EDGE_THRESH };
+    int close_w = 1;
+    int close_h = 1;
+    bool bad = false;
+    int opt;
+
+    while (!bad && (opt = getopt(argc, argv, "M:t:")) != -1) {
+        switch (opt) {
+            case 'M':
+                if (sscanf(optarg, "%dx%d", &close_w, &close_h) == 1) {
+                    close_h = close_w;
+                }
+                bad = close_w < 1 || close_h < 1;
+                break;
+            case 't': bad = parseThreshRule(optarg, rule) != 0; break;
+            default: bad = true; break;
+        }
+    }
+    if (bad || argc - optind < 2) {
+        ILOG("usage: BuildShapeDb [-t thresh|otsu|p<pct>] "
+                "[-M close_w[xclose_h]] <out.db> <dir> [<dir> ...]");
+        return -1;
+    }
+
+    std::vector<std::string> paths;
+    for (int arg = optind + 1; arg < argc; arg++) {
+        if (listDir(argv[arg], paths)) return -1;
+    }
+
+    std::vector<struct shape_record> shapes;
+    ObjectTable objs;
+    for (size_t i = 0; i < paths.size(); i++) {
+        Mat img = imread(paths[i], CV_LOAD_IMAGE_COLOR);
+        if (!img.data) {
+            WLOG("No image data in %s, skipping.", paths[i].c_str());
+            continue;
+        }
+
+        Mat binary;
+        struct shape_record s;
+
+        streamEdges(img, binary, rule);
+        if (close_w > 1 || close_h > 1) {
+            Mat edges = binary;
+            binary.release();
+            morphRect(edges, binary, MORPH_OP_CLOSE, close_w, close_h);
+        }
+
+        if (largestShape(binary, objs, s)) {
+            WLOG("No shape in %s, skipping.", paths[i].c_str());
+            continue;
+        }
+
+        const std::string &path = paths[i];
+        const size_t slash = path.rfind('/');
+        std::string label = path.substr(slash + 1);
+        label = label.substr(0, label.rfind('.'));
+
+        snprintf(s.label, sizeof(s.label), "%s", label.c_str());
+        snprintf(s.source, sizeof(s.source), "%s", path.c_str());
+        shapes.push_back(s);
+    }
+
+    if (writeShapeDb(argv[optind], shapes)) {
+        return -1;
+    }
+    ILOG("wrote %zu shapes", shapes.size());
+
+    return 0;
+}
@@ -0,0 +1,208 @@
+/**
+ * Send images to a detection server and save the replies.
+ *
+ * Requests are sent without waiting for replies, which are appended to a
+ * detection file as they come back, so `ExportDetections` can read them.  The
+ * frame id of each image is its position on the command line.
+ *
+ *     DetectClient [-f] <socket> <out.det> <img> [<img> ...]
+ *
+ * By default the server is sent the paths and decodes the images itself.
+ * With -f the images are decoded here and sent as raw frames, for servers
+ * that cannot see our files.
+ *
+ * @file detect_client.cpp
+ * @author Emily Ng
+ * @date Apr 14 2016
+ */
+
+#include <chrono>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "daemon.h"
+#include "debug.h"
+#include "detections.h"
+#include "frame_io.h"
+
+typedef std::chrono::steady_clock client_clock;
+
+static int readFull(int fd, void *buf, size_t len)
+{
+    uint8_t *p = (uint8_t *)buf;
+
+    while (len) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static int writeFull(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+
+    while (len) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/**
+ * Payload of a REQ_FRAME request: the image as `writeFrame` writes it.
+ */
+static int framePayload(const char *path, std::vector<uint8_t> &dst)
+{
+    Mat img = imread(path, CV_LOAD_IMAGE_COLOR);
+    if (!img.data) {
+        WLOG("No image data in %s.", path);
+        return -1;
+    }
+
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *fp = open_memstream(&buf, &len);
+
+    int ret = fp ? writeFrame(fp, img) : -1;
+    if (fp) fclose(fp);
+
+    if (!ret) dst.assign(buf, buf + len);
+    free(buf);
+
+    return ret;
+}
+
+/**
+ * Send a request per image, and tell the server there are no more.
+ */
+static void sendRequests(int fd, bool frames, int num, char **paths)
+{
+    std::vector<uint8_t> payload;
+
+    for (int i = 0; i < num; i++) {
+        if (frames) {
+            // An empty frame still gets its reply, as an error.
+            if (framePayload(paths[i], payload)) payload.clear();
+        }
+        else {
+            payload.assign(paths[i], paths[i] + strlen(paths[i]));
+        }
+
+        struct daemon_request h;
+        memcpy(h.magic, DAEMON_REQ_MAGIC, 4);
+        h.kind = frames ? REQ_FRAME : REQ_PATH;
+        h.id = i;
+        h.length = payload.size();
+
+        if (writeFull(fd, &h, sizeof(h))
+                || (h.length && writeFull(fd, &payload[0], h.length))) {
+            ELOG("cannot send request %d", i);
+            break;
+        }
+    }
+
+    shutdown(fd, SHUT_WR);
+}
+
+int main(int argc, char** argv)
+{
+    bool frames = false;
+    int arg = 1;
+
+    if (arg < argc && !strcmp(argv[arg], "-f")) {
+        frames = true;
+        arg++;
+    }
+
+    if (argc - arg < 3) {
+        ILOG("usage: DetectClient [-f] <socket> <out.det> <img> [<img> ...]");
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, argv[arg], sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        ELOG("cannot connect to %s", argv[arg]);
+        return -1;
+    }
+
+    FILE *out = fopen(argv[arg + 1], "ab");
+    if (!out) {
+        ELOG("cannot open %s", argv[arg + 1]);
+        close(fd);
+        return -1;
+    }
+
+    const int num = argc - arg - 2;
+    client_clock::time_point start = client_clock::now();
+
+    // Send from another thread, so that neither side blocks on a full socket.
+    std::thread sender(sendRequests, fd, frames, num, argv + arg + 2);
+
+    std::vector<uint8_t> body;
+    int received = 0, failed = 0;
+
+    while (received < num) {
+        struct daemon_reply r;
+
+        if (readFull(fd, &r, sizeof(r))
+                || memcmp(r.magic, DAEMON_REP_MAGIC, 4)) {
+            ELOG("lost the server after %d replies", received);
+            break;
+        }
+
+        body.resize(r.length);
+        if (r.length && readFull(fd, &body[0], r.length)) {
+            ELOG("lost the server after %d replies", received);
+            break;
+        }
+        received++;
+
+        if (r.status) {
+            WLOG("%s: %s",
+                    (r.id < (uint32_t)num) ? argv[arg + 2 + r.id] : "?",
+                    (r.status == REPLY_LATE) ? "missed its deadline"
+                    : "not processed");
+            failed++;
+            continue;
+        }
+        if (fwrite(&body[0], body.size(), 1, out) != 1) {
+            ELOG("cannot write %s", argv[arg + 1]);
+            break;
+        }
+    }
+
+    std::chrono::duration<double, std::milli> d = client_clock::now() - start;
+
+    sender.join();
+    fclose(out);
+    close(fd);
+
+    ILOG("%d replies, %d failed, %.1f ms (%.2f ms per image)", received,
+            failed, d.count(), received ? d.count() / received : 0);
+
+    return received == num ? 0 : -1;
+}
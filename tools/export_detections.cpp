@@ -0,0 +1,88 @@
+/**
+ * Export detection records as JSON lines.
+ *
+ * Prints one line per frame, with its objects as an array, for tools that
+ * would rather not read the binary format.  Bounding boxes are given as
+ * [left, top, right, bottom].  Values that are not finite are written as
+ * null, which JSON allows where NaN is not.
+ *
+ *     ExportDetections <in.det>
+ *
+ * @file export_detections.cpp
+ * @author Emily Ng
+ * @date Apr 04 2016
+ */
+
+#include <math.h>
+#include <stdio.h>
+
+#include "debug.h"
+#include "detections.h"
+
+static void printNumber(double x)
+{
+    if (isfinite(x)) printf("%.17g", x);
+    else printf("null");
+}
+
+static void printFloat(float x)
+{
+    if (isfinite(x)) printf("%.9g", x);
+    else printf("null");
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2) {
+        ILOG("usage: ExportDetections <in.det>");
+        return -1;
+    }
+
+    struct det_file df;
+    if (openDetFile(argv[1], &df)) {
+        return -1;
+    }
+
+    for (size_t n = 0; n < df.frames.size(); n++) {
+        const struct det_frame *f = detFrame(&df, n);
+
+        printf("{\"frame\":%u,\"objects\":[", f->frame);
+
+        for (uint32_t k = 0; k < f->num_objects; k++) {
+            const struct det_object *o = detObject(f, k);
+
+            printf("%s{\"bbox\":[%d,%d,%d,%d],\"area\":",
+                    k ? "," : "", o->left, o->top, o->right, o->bottom);
+            printNumber(o->area);
+            printf(",\"centroid\":[");
+            printNumber(o->cx);
+            printf(",");
+            printNumber(o->cy);
+            printf("],\"hu\":[");
+            for (int i = 0; i < 7; i++) {
+                if (i) printf(",");
+                printNumber(o->hu[i]);
+            }
+            printf("],\"score\":%u,\"orient\":[", o->score);
+            for (int i = 0; i < DET_ORIENT_BINS; i++) {
+                if (i) printf(",");
+                printFloat(o->orient[i]);
+            }
+            printf("]");
+            if (o->track_id) {
+                printf(",\"track\":%u,\"velocity\":[", o->track_id);
+                printFloat(o->vx);
+                printf(",");
+                printFloat(o->vy);
+                printf("],\"age\":%u", o->track_age);
+            }
+            printf("}");
+        }
+
+        printf("]}\n");
+    }
+
+    closeDetFile(&df);
+
+    return 0;
+}